@@ -0,0 +1,346 @@
+#include <r2p/Middleware.hpp>
+
+#include "BinaryTransport.hpp"
+
+namespace r2p {
+
+BinarySubscriber::BinarySubscriber(BinaryTransport & transport, TimestampedMsgPtrQueue::Entry queue_buf[],
+		size_t queue_length) :
+		RemoteSubscriber(transport), transport(transport), tmsgp_queue(queue_buf, queue_length), next_pendingp(NULL),
+		pending(false) {
+}
+
+bool BinarySubscriber::fetch_unsafe(Message *& msgp, Time & timestamp) {
+	TimestampedMsgPtrQueue::Entry entry;
+
+	if (!tmsgp_queue.fetch_unsafe(entry))
+		return false;
+
+	msgp = entry.msgp;
+	timestamp = entry.timestamp;
+	return true;
+}
+
+/*
+ * Called by the topic with the system locked: only the pointer is queued,
+ * the message stays in the pool until the transmitter has written it.
+ */
+bool BinarySubscriber::notify_unsafe(Message & msg, const Time & timestamp) {
+	TimestampedMsgPtrQueue::Entry entry(&msg, timestamp);
+
+	/* Filtered out by the routing table, as if delivered.*/
+	if (!transport.route_unsafe(route, get_topic()->get_name(), timestamp))
+		return true;
+
+	if (!tmsgp_queue.post_unsafe(entry))
+		return false;
+
+	msg.acquire_unsafe();
+	transport.notify_pending_unsafe(*this);
+	return true;
+}
+
+BinaryTransport::BinaryTransport(const char * namep, BaseChannel * channelp) :
+		Transport(namep), sent(0), received(0), tx_errors(0), channelp(channelp), routingp(NULL), rx_threadp(NULL),
+		tx_threadp(NULL), pending_headp(NULL), pending_tailp(NULL) {
+
+	bfDecoderInit(&decoder);
+	chSemInit(&pending_sem, 0);
+	chMtxInit(&send_lock);
+}
+
+void BinaryTransport::initialize(void * rx_stackp, size_t rx_stacklen, Thread::Priority rx_priority,
+		void * tx_stackp, size_t tx_stacklen, Thread::Priority tx_priority) {
+
+	rx_threadp = Thread::create_static(rx_stackp, rx_stacklen, rx_priority, rx_threadf, this, "BinaryTransport_rx");
+	tx_threadp = Thread::create_static(tx_stackp, tx_stacklen, tx_priority, tx_threadf, this, "BinaryTransport_tx");
+
+	Middleware::instance.add(*this);
+}
+
+/*
+ * Writes a frame: header and trailer are built on the stack, the payload
+ * goes from where it is to the channel output queue.
+ */
+bool BinaryTransport::send_frame(uint8_t type, const char * topicp, const void * payloadp, size_t payload_len) {
+	uint8_t hdr[BF_MAX_HEADER_SIZE];
+	uint8_t trailer[BF_CRC_SIZE];
+	size_t hdr_len;
+	bool ok;
+
+	hdr_len = bfHeader(hdr, type, topicp, payload_len);
+	if (hdr_len == 0)
+		return false;
+	bfTrailer(trailer, bfCRC(hdr, hdr_len, payloadp, payload_len));
+
+	/* Frames of concurrent senders must not interleave.*/
+	chMtxLock(&send_lock);
+	ok = (chnWriteTimeout(channelp, hdr, hdr_len, TIME_INFINITE) == hdr_len);
+	ok = ok && (chnWriteTimeout(channelp, (const uint8_t *) payloadp, payload_len, TIME_INFINITE) == payload_len);
+	ok = ok && (chnWriteTimeout(channelp, trailer, BF_CRC_SIZE, TIME_INFINITE) == BF_CRC_SIZE);
+	chMtxUnlock();
+
+	return ok;
+}
+
+bool BinaryTransport::send_advertisement(const Topic & topic) {
+	size_t type_size = topic.get_type_size();
+	uint8_t payload[2] = { (uint8_t) type_size, (uint8_t) (type_size >> 8) };
+
+	if (!routed(topic.get_name()))
+		return true;
+	return send_frame(BF_TYPE_ADVERTISE, topic.get_name(), payload, sizeof(payload));
+}
+
+bool BinaryTransport::send_subscription(const Topic & topic, size_t queue_length) {
+	uint8_t payload[2] = { (uint8_t) queue_length, (uint8_t) (queue_length >> 8) };
+
+	if (!routed(topic.get_name()))
+		return true;
+	return send_frame(BF_TYPE_SUBSCRIBE, topic.get_name(), payload, sizeof(payload));
+}
+
+bool BinaryTransport::send_stop() {
+	return send_frame(BF_TYPE_STOP, "", NULL, 0);
+}
+
+bool BinaryTransport::send_reboot() {
+	return send_frame(BF_TYPE_REBOOT, "", NULL, 0);
+}
+
+bool BinaryTransport::send_bootload() {
+	return send_frame(BF_TYPE_BOOTLOAD, "", NULL, 0);
+}
+
+/*
+ * Queues a subscriber for the transmitter, once until it is served.
+ */
+void BinaryTransport::notify_pending_unsafe(BinarySubscriber & sub) {
+
+	if (sub.pending)
+		return;
+
+	sub.pending = true;
+	sub.next_pendingp = NULL;
+	if (pending_tailp != NULL)
+		pending_tailp->next_pendingp = &sub;
+	else
+		pending_headp = &sub;
+	pending_tailp = &sub;
+	chSemSignalI(&pending_sem);
+}
+
+/*
+ * Routing decision for one message, the state is kept by the caller.
+ */
+bool BinaryTransport::route_unsafe(RouteState & route, const char * topicp, const Time & timestamp) {
+
+	if (routingp == NULL)
+		return true;
+
+	routingp->resolve(route, topicp, get_name());
+	return routingp->forward(route, (uint32_t) timestamp.to_us_raw());
+}
+
+/*
+ * Whether a topic may be advertised or subscribed on this transport.
+ */
+bool BinaryTransport::routed(const char * topicp) {
+	bool allowed;
+
+	if (routingp == NULL)
+		return true;
+
+	chSysLock();
+	allowed = routingp->allowed(topicp, get_name());
+	chSysUnlock();
+	return allowed;
+}
+
+RemotePublisher * BinaryTransport::create_publisher(Topic & topic, const uint8_t * raw_params) const {
+
+	(void) topic;
+	(void) raw_params;
+	return new BinaryPublisher(const_cast<BinaryTransport &>(*this));
+}
+
+RemoteSubscriber * BinaryTransport::create_subscriber(Topic & topic, TimestampedMsgPtrQueue::Entry queue_buf[],
+		size_t queue_length) const {
+
+	(void) topic;
+	return new BinarySubscriber(const_cast<BinaryTransport &>(*this), queue_buf, queue_length);
+}
+
+void BinaryTransport::fill_raw_params(const Topic & topic, uint8_t raw_params[]) {
+
+	/* Topics are named in every frame, no parameters to exchange.*/
+	(void) topic;
+	(void) raw_params;
+}
+
+bool BinaryTransport::spin_tx() {
+	BinarySubscriber * subp;
+	Message * msgp;
+	Time timestamp;
+	bool fetched;
+
+	chSemWait(&pending_sem);
+
+	/* Cleared before draining, a message notified meanwhile queues it again.*/
+	chSysLock();
+	subp = pending_headp;
+	pending_headp = subp->next_pendingp;
+	if (pending_headp == NULL)
+		pending_tailp = NULL;
+	subp->pending = false;
+	chSysUnlock();
+
+	const Topic & topic = *subp->get_topic();
+
+	for (;;) {
+		chSysLock();
+		fetched = subp->fetch_unsafe(msgp, timestamp);
+		chSysUnlock();
+		if (!fetched)
+			break;
+
+		/* Only the payload, the reference count stays in the pool.*/
+		if (send_frame(BF_TYPE_PUBLISH, topic.get_name(), msgp->get_raw_data(), topic.get_payload_size()))
+			sent++;
+		else
+			tx_errors++;
+		subp->release(*msgp);
+	}
+
+	return true;
+}
+
+/*
+ * Reads exactly n bytes, a frame cut short is given up after RX_TIMEOUT_MS.
+ */
+bool BinaryTransport::receive(void * bufp, size_t n) {
+
+	return chnReadTimeout(channelp, (uint8_t *) bufp, n, MS2ST(RX_TIMEOUT_MS)) == n;
+}
+
+void BinaryTransport::skip(size_t n) {
+
+	while ((n-- > 0) && (chnGetTimeout(channelp, MS2ST(RX_TIMEOUT_MS)) >= 0))
+		;
+}
+
+bool BinaryTransport::spin_rx() {
+	uint8_t trailer[BF_CRC_SIZE];
+	uint8_t payload[2];
+	msg_t c;
+
+	c = chnGetTimeout(channelp, TIME_INFINITE);
+	if (c < 0)
+		return false;
+	if (!bfDecoderPut(&decoder, (uint8_t) c))
+		return true;
+
+	if (decoder.type == BF_TYPE_PUBLISH) {
+		BinaryPublisher * pubp = static_cast<BinaryPublisher *>(find_publisher(decoder.topic));
+		Message * msgp;
+		bool routed;
+
+		if ((pubp == NULL) || (pubp->get_topic()->get_payload_size() != decoder.payload_len) || !pubp->alloc(msgp)) {
+			skip(decoder.payload_len + BF_CRC_SIZE);
+			bfDecoderDrop(&decoder);
+			return true;
+		}
+
+		/* The payload lands in the pool message, checked before publishing.*/
+		if (!receive(msgp->get_raw_data(), decoder.payload_len) || !receive(trailer, BF_CRC_SIZE)) {
+			pubp->get_topic()->free(*msgp);
+			bfDecoderDrop(&decoder);
+			return true;
+		}
+		if (!bfDecoderCheck(&decoder, msgp->get_raw_data(), trailer)) {
+			pubp->get_topic()->free(*msgp);
+			return true;
+		}
+
+		chSysLock();
+		routed = route_unsafe(pubp->route, decoder.topic, Time::now());
+		chSysUnlock();
+		if (!routed) {
+			pubp->get_topic()->free(*msgp);
+			return true;
+		}
+
+		pubp->publish_locally(*msgp);
+#if R2P_USE_BRIDGE_MODE
+		pubp->publish_remotely(*msgp);
+#endif
+		received++;
+		return true;
+	}
+
+	/* Control frames, the payload is at most a 16 bits parameter.*/
+	if (decoder.payload_len > sizeof(payload)) {
+		skip(decoder.payload_len + BF_CRC_SIZE);
+		bfDecoderDrop(&decoder);
+		return true;
+	}
+	if (!receive(payload, decoder.payload_len) || !receive(trailer, BF_CRC_SIZE)) {
+		bfDecoderDrop(&decoder);
+		return true;
+	}
+	if (!bfDecoderCheck(&decoder, payload, trailer))
+		return true;
+
+	switch (decoder.type) {
+	case BF_TYPE_ADVERTISE:
+	case BF_TYPE_SUBSCRIBE: {
+		size_t value = (decoder.payload_len == 2) ? (size_t) (payload[0] | (payload[1] << 8)) : 0;
+		Topic * topicp;
+
+		if ((value == 0) || !routed(decoder.topic))
+			break;
+
+		if (decoder.type == BF_TYPE_ADVERTISE) {
+			topicp = Middleware::instance.touch_topic(decoder.topic, value);
+			if (topicp != NULL)
+				touch_publisher(*topicp);
+		} else {
+			topicp = Middleware::instance.find_topic(decoder.topic);
+			if (topicp != NULL)
+				touch_subscriber(*topicp, value);
+		}
+		break;
+	}
+	case BF_TYPE_STOP:
+		Middleware::instance.stop();
+		break;
+	case BF_TYPE_REBOOT:
+		Middleware::instance.reboot();
+		break;
+	case BF_TYPE_BOOTLOAD:
+		Middleware::instance.preload_bootloader_mode(true);
+		Middleware::instance.reboot();
+		break;
+	}
+
+	return true;
+}
+
+Thread::Return BinaryTransport::rx_threadf(Thread::Argument arg) {
+
+	for (;;) {
+		if (!reinterpret_cast<BinaryTransport *>(arg)->spin_rx())
+			Thread::sleep(Time::ms(RX_TIMEOUT_MS));
+	}
+	return static_cast<Thread::Return>(0);
+}
+
+Thread::Return BinaryTransport::tx_threadf(Thread::Argument arg) {
+
+	for (;;) {
+		reinterpret_cast<BinaryTransport *>(arg)->spin_tx();
+	}
+	return static_cast<Thread::Return>(0);
+}
+
+} /* namespace r2p */
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <r2p/common.hpp>
+#include <r2p/Transport.hpp>
+#include <r2p/RemotePublisher.hpp>
+#include <r2p/RemoteSubscriber.hpp>
+#include <r2p/TimestampedMsgPtrQueue.hpp>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "binframe.h"
+#include "routing.hpp"
+
+namespace r2p {
+
+class BinaryTransport;
+
+class BinaryPublisher : public RemotePublisher {
+	friend class BinaryTransport;
+
+private:
+	/* Route of the messages coming in, limited apart from the outgoing ones.*/
+	RouteState route;
+
+public:
+	BinaryPublisher(Transport & transport) :
+			RemotePublisher(transport) {
+	}
+};
+
+/*
+ * Remote subscriber of a BinaryTransport: queues pointers to the pool
+ * messages, the transmitter thread frames them from the pool.
+ */
+class BinarySubscriber : public RemoteSubscriber {
+	friend class BinaryTransport;
+
+private:
+	BinaryTransport & transport;
+	TimestampedMsgPtrQueue tmsgp_queue;
+	BinarySubscriber * next_pendingp;
+	bool pending;
+	RouteState route;
+
+public:
+	bool fetch_unsafe(Message *& msgp, Time & timestamp);
+	bool notify_unsafe(Message & msg, const Time & timestamp);
+
+	BinarySubscriber(BinaryTransport & transport, TimestampedMsgPtrQueue::Entry queue_buf[], size_t queue_length);
+};
+
+/*
+ * Binary replacement of DebugTransport.
+ *
+ * Same interface and threads, but messages are sent as binframe.h frames
+ * instead of hex text: the header is built on the stack, the payload is
+ * written to the channel straight from the message pool and the message is
+ * released as soon as it is in the output queue. On the receive side the
+ * header names the topic before the payload arrives, so the payload is read
+ * straight into a message allocated from the publisher pool. Nothing is
+ * copied through an intermediate buffer in either direction.
+ *
+ * With a routing table, topics denied on the transport are neither
+ * advertised nor subscribed in either direction, and the messages of the
+ * allowed ones are decimated and rate limited before being queued.
+ */
+class BinaryTransport : public Transport {
+	friend class BinarySubscriber;
+
+public:
+	enum {
+		RX_TIMEOUT_MS = 100
+	};
+
+	/* Statistics, the receive errors are in the decoder.*/
+	uint32_t sent;
+	uint32_t received;
+	uint32_t tx_errors;
+
+private:
+	BaseChannel * channelp;
+	BinFrameDecoder decoder;
+	RoutingTable * routingp;
+	Thread * rx_threadp;
+	Thread * tx_threadp;
+
+	/* Subscribers with queued messages, in notification order.*/
+	BinarySubscriber * pending_headp;
+	BinarySubscriber * pending_tailp;
+	::Semaphore pending_sem;
+	::Mutex send_lock;
+
+public:
+	bool send_advertisement(const Topic & topic);
+	bool send_subscription(const Topic & topic, size_t queue_length);
+	bool send_stop();
+	bool send_reboot();
+	bool send_bootload();
+
+	void initialize(void * rx_stackp, size_t rx_stacklen, Thread::Priority rx_priority, void * tx_stackp,
+			size_t tx_stacklen, Thread::Priority tx_priority);
+
+	const BinFrameDecoder & get_decoder() const {
+		return decoder;
+	}
+
+	/*
+	 * Sets the routing table, NULL lets every topic cross. Set it before
+	 * initialize(), the table is then only edited with the system locked.
+	 */
+	void set_routing(RoutingTable * routingp) {
+		this->routingp = routingp;
+	}
+
+private:
+	bool send_frame(uint8_t type, const char * topicp, const void * payloadp, size_t payload_len);
+	bool receive(void * bufp, size_t n);
+	void skip(size_t n);
+	void notify_pending_unsafe(BinarySubscriber & sub);
+	bool route_unsafe(RouteState & route, const char * topicp, const Time & timestamp);
+	bool routed(const char * topicp);
+
+	RemotePublisher * create_publisher(Topic & topic, const uint8_t * raw_params = NULL) const;
+	RemoteSubscriber * create_subscriber(Topic & topic, TimestampedMsgPtrQueue::Entry queue_buf[],
+			size_t queue_length) const;
+	void fill_raw_params(const Topic & topic, uint8_t raw_params[]);
+
+	bool spin_tx();
+	bool spin_rx();
+
+	static Thread::Return rx_threadf(Thread::Argument arg);
+	static Thread::Return tx_threadf(Thread::Argument arg);
+
+public:
+	BinaryTransport(const char * namep, BaseChannel * channelp);
+};
+
+} /* namespace r2p */
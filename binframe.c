@@ -0,0 +1,135 @@
+/*
+ * Binary r2p transport framing, see binframe.h for the frame layout.
+ */
+
+#include <string.h>
+
+#include "binframe.h"
+#include "telemetry.h"
+
+/**
+ * @brief   Writes a frame header.
+ *
+ * @param[out] hdrp     header buffer, at least BF_MAX_HEADER_SIZE bytes
+ * @param[in] type      frame type
+ * @param[in] topicp    topic name, truncated to BF_MAX_TOPIC characters
+ * @param[in] payload_len payload size
+ * @return              The header size, zero if the payload does not fit.
+ */
+size_t bfHeader(uint8_t *hdrp, uint8_t type, const char *topicp,
+                size_t payload_len) {
+  size_t topic_len = 0;
+
+  while ((topic_len < BF_MAX_TOPIC) && (topicp[topic_len] != '\0'))
+    topic_len++;
+  if (2 + topic_len + payload_len > BF_MAX_LEN)
+    return 0;
+
+  hdrp[0] = BF_SYNC;
+  hdrp[1] = (uint8_t)(2 + topic_len + payload_len);
+  hdrp[2] = type;
+  hdrp[3] = (uint8_t)topic_len;
+  memcpy(&hdrp[4], topicp, topic_len);
+  return 4 + topic_len;
+}
+
+/**
+ * @brief   Computes the CRC of a frame, the payload is read in place.
+ */
+uint16_t bfCRC(const uint8_t *hdrp, size_t hdr_len,
+               const void *payloadp, size_t payload_len) {
+  uint16_t crc;
+
+  crc = tlmCRC16(0xFFFF, hdrp + 1, hdr_len - 1);
+  return tlmCRC16(crc, (const uint8_t *)payloadp, payload_len);
+}
+
+/**
+ * @brief   Writes the frame trailer.
+ */
+void bfTrailer(uint8_t *trailerp, uint16_t crc) {
+
+  trailerp[0] = (uint8_t)crc;
+  trailerp[1] = (uint8_t)(crc >> 8);
+}
+
+/**
+ * @brief   Resets a frame decoder.
+ */
+void bfDecoderInit(BinFrameDecoder *decp) {
+
+  memset(decp, 0, sizeof(*decp));
+}
+
+/**
+ * @brief   Feeds one received header byte to the decoder.
+ * @details Bytes before a sync are skipped, an invalid header is counted
+ *          and the decoder waits for the next sync.
+ *
+ * @return              Non-zero when a header has been decoded into
+ *                      @p type, @p topic and @p payload_len, the caller
+ *                      then reads the payload and the trailer and passes
+ *                      them to bfDecoderCheck().
+ */
+int bfDecoderPut(BinFrameDecoder *decp, uint8_t c) {
+  size_t topic_len;
+
+  if (decp->hdr_len == 0) {
+    if (c == BF_SYNC)
+      decp->hdr[decp->hdr_len++] = c;
+    return 0;
+  }
+
+  decp->hdr[decp->hdr_len++] = c;
+  if (decp->hdr_len < 4)
+    return 0;
+
+  topic_len = decp->hdr[3];
+  if ((topic_len > BF_MAX_TOPIC) || (decp->hdr[1] < 2 + topic_len) ||
+      (decp->hdr[2] < BF_TYPE_PUBLISH) || (decp->hdr[2] > BF_TYPE_BOOTLOAD)) {
+    decp->hdr_len = 0;
+    decp->framing_errors++;
+    return 0;
+  }
+  if (decp->hdr_len < 4 + topic_len)
+    return 0;
+
+  decp->type = decp->hdr[2];
+  memcpy(decp->topic, &decp->hdr[4], topic_len);
+  decp->topic[topic_len] = '\0';
+  decp->payload_len = decp->hdr[1] - 2 - topic_len;
+  return 1;
+}
+
+/**
+ * @brief   Checks the CRC of the frame whose header was last decoded.
+ * @details The decoder is ready for the next frame in any case.
+ *
+ * @param[in] payloadp  received payload, @p payload_len bytes
+ * @param[in] trailerp  received trailer, BF_CRC_SIZE bytes
+ * @return              Non-zero if the frame is valid.
+ */
+int bfDecoderCheck(BinFrameDecoder *decp, const void *payloadp,
+                   const uint8_t *trailerp) {
+  uint16_t crc = (uint16_t)(trailerp[0] | (trailerp[1] << 8));
+  size_t hdr_len = decp->hdr_len;
+
+  decp->hdr_len = 0;
+  if (bfCRC(decp->hdr, hdr_len, payloadp, decp->payload_len) != crc) {
+    decp->crc_errors++;
+    return 0;
+  }
+  decp->frames++;
+  return 1;
+}
+
+/**
+ * @brief   Discards the frame whose header was last decoded.
+ * @details Used when the receiver has no use for the payload, which it
+ *          skips on its own.
+ */
+void bfDecoderDrop(BinFrameDecoder *decp) {
+
+  decp->hdr_len = 0;
+  decp->dropped++;
+}
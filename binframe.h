@@ -0,0 +1,76 @@
+/*
+ * Binary r2p transport framing.
+ *
+ * Every middleware message is sent as a single frame:
+ *
+ *   sync | len | type | topic_len | topic | payload | crc16
+ *
+ * sync is 0x7E, len counts the bytes from type to the end of the payload.
+ * The CRC is CRC-16/CCITT-FALSE (tlmCRC16) computed over len .. payload and
+ * sent little endian. A frame is written as header, payload and trailer, so
+ * the payload goes from the message pool straight to the channel queue, and
+ * the receiver learns the topic and payload length from the header before
+ * reading the payload straight into a message. A decoder that finds a bad
+ * header or CRC resynchronizes on the next sync byte.
+ *
+ * This file is shared with the host tools, it must not depend on ChibiOS.
+ */
+
+#ifndef _BINFRAME_H_
+#define _BINFRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Frame geometry.
+ */
+#define BF_SYNC                 0x7E
+#define BF_MAX_TOPIC            16
+#define BF_MAX_LEN              255
+#define BF_MAX_HEADER_SIZE      (4 + BF_MAX_TOPIC)
+#define BF_CRC_SIZE             2
+
+/*
+ * Frame types.
+ */
+#define BF_TYPE_PUBLISH         0x01
+#define BF_TYPE_ADVERTISE       0x02    /* payload: type size, 16 bits.     */
+#define BF_TYPE_SUBSCRIBE       0x03    /* payload: queue length, 16 bits.  */
+#define BF_TYPE_STOP            0x04
+#define BF_TYPE_REBOOT          0x05
+#define BF_TYPE_BOOTLOAD        0x06
+
+/**
+ * @brief   Frame header decoder, fed one byte at a time.
+ */
+typedef struct {
+  uint8_t   hdr[BF_MAX_HEADER_SIZE];    /* Header bytes since the sync.      */
+  size_t    hdr_len;
+  uint8_t   type;                       /* Last decoded header.              */
+  char      topic[BF_MAX_TOPIC + 1];
+  size_t    payload_len;
+  uint32_t  frames;                     /* Statistics.                       */
+  uint32_t  crc_errors;
+  uint32_t  framing_errors;
+  uint32_t  dropped;                    /* Valid headers, payload skipped.   */
+} BinFrameDecoder;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  size_t bfHeader(uint8_t *hdrp, uint8_t type, const char *topicp,
+                  size_t payload_len);
+  uint16_t bfCRC(const uint8_t *hdrp, size_t hdr_len,
+                 const void *payloadp, size_t payload_len);
+  void bfTrailer(uint8_t *trailerp, uint16_t crc);
+  void bfDecoderInit(BinFrameDecoder *decp);
+  int bfDecoderPut(BinFrameDecoder *decp, uint8_t c);
+  int bfDecoderCheck(BinFrameDecoder *decp, const void *payloadp,
+                     const uint8_t *trailerp);
+  void bfDecoderDrop(BinFrameDecoder *decp);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BINFRAME_H_ */
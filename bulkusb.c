@@ -0,0 +1,253 @@
+/*
+ * Message oriented vendor bulk driver, see bulkusb.h.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "bulkusb.h"
+
+/*
+ * Checks that the driver is started and the device configured.
+ */
+static bool_t is_active(BulkUSBDriver *budp) {
+
+  return (budp->state == BUD_READY) &&
+         (usbGetDriverStateI(budp->config->usbp) == USB_ACTIVE);
+}
+
+/*
+ * Sends the buffer being filled as one transfer and swaps buffers, the IN
+ * endpoint must be idle.
+ */
+static void start_transmit(BulkUSBDriver *budp) {
+  USBDriver *usbp = budp->config->usbp;
+  size_t n = budp->txlen[budp->txfill];
+
+  usbPrepareTransmit(usbp, budp->config->bulk_in,
+                     budp->txbuf[budp->txfill], n);
+  usbStartTransmitI(usbp, budp->config->bulk_in);
+  budp->txbusy = TRUE;
+  budp->txzlp = ((n % BULKUSB_PACKET_SIZE) == 0);
+  budp->tx_transfers++;
+  budp->tx_bytes += n;
+
+  budp->txfill ^= 1;
+  budp->txlen[budp->txfill] = 0;
+}
+
+/*
+ * Arms the OUT endpoint on the driver receive buffer.
+ */
+static void start_receive(BulkUSBDriver *budp) {
+  USBDriver *usbp = budp->config->usbp;
+
+  usbPrepareReceive(usbp, budp->config->bulk_out,
+                    budp->rxbuf, BULKUSB_RX_SIZE);
+  usbStartReceiveI(usbp, budp->config->bulk_out);
+}
+
+/**
+ * @brief   Initializes a driver object.
+ */
+void budObjectInit(BulkUSBDriver *budp) {
+
+  memset(budp, 0, sizeof(*budp));
+  budp->state = BUD_STOP;
+  chBSemInit(&budp->txsem, TRUE);
+  chBSemInit(&budp->rxsem, TRUE);
+  chMtxInit(&budp->txmtx);
+}
+
+/**
+ * @brief   Configures and starts the driver.
+ */
+void budStart(BulkUSBDriver *budp, const BulkUSBConfig *config) {
+  USBDriver *usbp = config->usbp;
+
+  chSysLock();
+  budp->config = config;
+  usbp->in_params[config->bulk_in - 1] = budp;
+  usbp->out_params[config->bulk_out - 1] = budp;
+  budp->state = BUD_READY;
+  chSysUnlock();
+}
+
+/**
+ * @brief   USB device configured handler.
+ * @details Pending data is discarded, a message being copied included,
+ *          waiting writers are woken up and the OUT endpoint is armed.
+ */
+void budConfigureHookI(BulkUSBDriver *budp) {
+
+  budp->txlen[0] = budp->txlen[1] = 0;
+  budp->txfill = 0;
+  budp->txbusy = FALSE;
+  budp->txzlp = FALSE;
+  budp->txcopying = FALSE;
+  budp->rxfull = FALSE;
+  chBSemSignalI(&budp->txsem);
+  start_receive(budp);
+}
+
+/**
+ * @brief   Start of frame handler, flushes the buffer being filled.
+ * @details A buffer a writer is copying into waits for the next frame.
+ */
+void budSOFHookI(BulkUSBDriver *budp) {
+
+  if (is_active(budp) && !budp->txbusy && !budp->txcopying &&
+      (budp->txlen[budp->txfill] > 0))
+    start_transmit(budp);
+}
+
+/**
+ * @brief   Bulk IN completion callback.
+ */
+void budDataTransmitted(USBDriver *usbp, usbep_t ep) {
+  BulkUSBDriver *budp = usbp->in_params[ep - 1];
+
+  if (budp == NULL)
+    return;
+
+  chSysLockFromIsr();
+  if (budp->txzlp) {
+    /* The transfer ended on a full packet, terminating it.*/
+    budp->txzlp = FALSE;
+    usbPrepareTransmit(usbp, ep, NULL, 0);
+    usbStartTransmitI(usbp, ep);
+  }
+  else {
+    budp->txbusy = FALSE;
+    chBSemSignalI(&budp->txsem);
+  }
+  chSysUnlockFromIsr();
+}
+
+/**
+ * @brief   Bulk OUT completion callback.
+ * @details The endpoint is not re-armed until the transfer has been read,
+ *          the host is NAKed meanwhile.
+ */
+void budDataReceived(USBDriver *usbp, usbep_t ep) {
+  BulkUSBDriver *budp = usbp->out_params[ep - 1];
+
+  if (budp == NULL)
+    return;
+
+  chSysLockFromIsr();
+  budp->rxlen = usbGetReceiveTransactionSizeI(usbp, ep);
+  budp->rxfull = TRUE;
+  budp->rx_transfers++;
+  budp->rx_bytes += budp->rxlen;
+  chBSemSignalI(&budp->rxsem);
+  chSysUnlockFromIsr();
+}
+
+/**
+ * @brief   Queues one message for transmission.
+ * @details The message is copied into the transfer buffer being filled, it
+ *          is never split across transfers. Space is reserved with the
+ *          system locked, the copy itself runs unlocked; writers are
+ *          serialized by a mutex.
+ *
+ * @param[in] budp      pointer to the driver object
+ * @param[in] bp        message buffer
+ * @param[in] n         message size, at most @p BULKUSB_TX_SIZE bytes
+ * @param[in] timeout   maximum time to wait for a free buffer
+ * @return              The message size, zero if the message could not be
+ *                      queued.
+ */
+size_t budWrite(BulkUSBDriver *budp, const uint8_t *bp, size_t n,
+                systime_t timeout) {
+
+  uint8_t *dstp;
+
+  if ((n == 0) || (n > BULKUSB_TX_SIZE))
+    return 0;
+
+  chMtxLock(&budp->txmtx);
+  chSysLock();
+  for (;;) {
+    if (!is_active(budp)) {
+      chSysUnlock();
+      chMtxUnlock();
+      return 0;
+    }
+    if (budp->txlen[budp->txfill] + n <= BULKUSB_TX_SIZE)
+      break;
+    if (!budp->txbusy) {
+      start_transmit(budp);
+      continue;
+    }
+    if (chBSemWaitTimeoutS(&budp->txsem, timeout) == RDY_TIMEOUT) {
+      chSysUnlock();
+      chMtxUnlock();
+      return 0;
+    }
+  }
+  /* The buffer cannot be sent or swapped while the flag is set.*/
+  dstp = &budp->txbuf[budp->txfill][budp->txlen[budp->txfill]];
+  budp->txcopying = TRUE;
+  chSysUnlock();
+
+  memcpy(dstp, bp, n);
+
+  chSysLock();
+  if (budp->txcopying) {
+    budp->txcopying = FALSE;
+    budp->txlen[budp->txfill] += n;
+    budp->tx_messages++;
+  }
+  else {
+    /* Reconfigured meanwhile, the buffer was discarded.*/
+    n = 0;
+  }
+  chSysUnlock();
+  chMtxUnlock();
+  return n;
+}
+
+/**
+ * @brief   Receives one transfer from the host.
+ * @details Single reader, the transfer is copied with the system unlocked.
+ *
+ * @param[in] budp      pointer to the driver object
+ * @param[out] bp       receive buffer, excess bytes are discarded
+ * @param[in] n         buffer size
+ * @param[in] timeout   maximum time to wait for a transfer
+ * @return              The number of bytes received, zero on timeout or if
+ *                      the device is not configured.
+ */
+size_t budRead(BulkUSBDriver *budp, uint8_t *bp, size_t n,
+               systime_t timeout) {
+
+  chSysLock();
+  while (!budp->rxfull) {
+    if (!is_active(budp) ||
+        (chBSemWaitTimeoutS(&budp->rxsem, timeout) == RDY_TIMEOUT)) {
+      chSysUnlock();
+      return 0;
+    }
+  }
+  if (n > budp->rxlen)
+    n = budp->rxlen;
+  chSysUnlock();
+
+  /* The OUT endpoint stays disarmed until the buffer is released.*/
+  memcpy(bp, budp->rxbuf, n);
+
+  chSysLock();
+  if (budp->rxfull) {
+    budp->rxfull = FALSE;
+    start_receive(budp);
+  }
+  else {
+    /* Reconfigured meanwhile, the transfer was discarded.*/
+    n = 0;
+  }
+  chSysUnlock();
+  return n;
+}
@@ -0,0 +1,98 @@
+/*
+ * Message oriented driver for a vendor specific bulk interface.
+ *
+ * Host tools talk to this interface with libusb instead of going through
+ * CDC ACM and the tty layer. Outgoing messages are never split: they are
+ * packed into two ping-pong transfer buffers and each buffer is sent as one
+ * multi-packet bulk transfer, either when it cannot take the next message or
+ * at the next start of frame. Transfers whose size is a multiple of the
+ * packet size are terminated by a zero length packet. Incoming transfers are
+ * received into a driver buffer and handed out one at a time.
+ */
+
+#ifndef _BULKUSB_H_
+#define _BULKUSB_H_
+
+/**
+ * @brief   Bulk packet size.
+ */
+#define BULKUSB_PACKET_SIZE     64
+
+/**
+ * @brief   Size of each of the two transmit buffers.
+ */
+#if !defined(BULKUSB_TX_SIZE) || defined(__DOXYGEN__)
+#define BULKUSB_TX_SIZE         512
+#endif
+
+/**
+ * @brief   Receive buffer size, a multiple of the packet size.
+ */
+#if !defined(BULKUSB_RX_SIZE) || defined(__DOXYGEN__)
+#define BULKUSB_RX_SIZE         256
+#endif
+
+/**
+ * @brief   Driver state machine possible states.
+ */
+typedef enum {
+  BUD_UNINIT = 0,
+  BUD_STOP = 1,
+  BUD_READY = 2
+} budstate_t;
+
+/**
+ * @brief   Bulk USB driver configuration.
+ */
+typedef struct {
+  USBDriver             *usbp;
+  usbep_t               bulk_in;
+  usbep_t               bulk_out;
+} BulkUSBConfig;
+
+/**
+ * @brief   Bulk USB driver.
+ */
+typedef struct {
+  budstate_t            state;
+  const BulkUSBConfig   *config;
+  /* Transmit side.*/
+  uint8_t               txbuf[2][BULKUSB_TX_SIZE];
+  size_t                txlen[2];
+  unsigned              txfill;         /* Buffer being filled.              */
+  bool_t                txbusy;         /* The other buffer is on the wire.  */
+  bool_t                txzlp;          /* Zero length packet owed.          */
+  bool_t                txcopying;      /* A writer fills the buffer.        */
+  BinarySemaphore       txsem;          /* Signaled when a buffer is freed.  */
+  Mutex                 txmtx;          /* Serializes the writers.           */
+  /* Receive side.*/
+  uint8_t               rxbuf[BULKUSB_RX_SIZE];
+  size_t                rxlen;
+  bool_t                rxfull;         /* A transfer waits to be read.      */
+  BinarySemaphore       rxsem;
+  /* Statistics.*/
+  uint32_t              tx_messages;
+  uint32_t              tx_transfers;
+  uint32_t              tx_bytes;
+  uint32_t              rx_transfers;
+  uint32_t              rx_bytes;
+} BulkUSBDriver;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void budObjectInit(BulkUSBDriver *budp);
+  void budStart(BulkUSBDriver *budp, const BulkUSBConfig *config);
+  void budConfigureHookI(BulkUSBDriver *budp);
+  void budSOFHookI(BulkUSBDriver *budp);
+  void budDataTransmitted(USBDriver *usbp, usbep_t ep);
+  void budDataReceived(USBDriver *usbp, usbep_t ep);
+  size_t budWrite(BulkUSBDriver *budp, const uint8_t *bp, size_t n,
+                  systime_t timeout);
+  size_t budRead(BulkUSBDriver *budp, uint8_t *bp, size_t n,
+                 systime_t timeout);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _BULKUSB_H_ */
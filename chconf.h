@@ -452,7 +452,8 @@
  */
 #if !defined(THREAD_EXT_FIELDS) || defined(__DOXYGEN__)
 #define THREAD_EXT_FIELDS                                                   \
-  /* Add threads custom fields here.*/
+  /* Add threads custom fields here.*/                                      \
+  uint32_t p_switches;  /* Times the thread was switched in, see top.c.*/
 #endif
 
 /**
@@ -465,6 +466,7 @@
 #if !defined(THREAD_EXT_INIT_HOOK) || defined(__DOXYGEN__)
 #define THREAD_EXT_INIT_HOOK(tp) {                                          \
   /* Add threads initialization code here.*/                                \
+  (tp)->p_switches = 0;                                                     \
 }
 #endif
 
@@ -489,6 +491,7 @@
 #if !defined(THREAD_CONTEXT_SWITCH_HOOK) || defined(__DOXYGEN__)
 #define THREAD_CONTEXT_SWITCH_HOOK(ntp, otp) {                              \
   /* System halt code here.*/                                               \
+  (ntp)->p_switches++;                                                      \
 }
 #endif
 
@@ -1,60 +1,193 @@
 
 #include <ch.h>
 
+#include "chnew.hpp"
+
+
+/*
+ * Size classes, each pool is loaded from its own static arena on first use.
+ * The arena address range tells on release whether an object belongs to a
+ * pool or to the heap.
+ */
+struct SizeClass {
+  MemoryPool  pool;
+  uint8_t     *arenap;
+  size_t      count;
+  bool        loaded;
+};
+
+#define ARENA_DECL(name, size, count)                                       \
+  static stkalign_t name[((size) * (count)) / sizeof(stkalign_t)]
+
+ARENA_DECL(arena16, 16, CHNEW_POOL16_COUNT);
+ARENA_DECL(arena32, 32, CHNEW_POOL32_COUNT);
+ARENA_DECL(arena64, 64, CHNEW_POOL64_COUNT);
+ARENA_DECL(arena128, 128, CHNEW_POOL128_COUNT);
+
+static SizeClass classes[CHNEW_NUM_CLASSES] = {
+  { _MEMORYPOOL_DATA(classes[0].pool, 16, NULL), (uint8_t *)arena16, CHNEW_POOL16_COUNT, false },
+  { _MEMORYPOOL_DATA(classes[1].pool, 32, NULL), (uint8_t *)arena32, CHNEW_POOL32_COUNT, false },
+  { _MEMORYPOOL_DATA(classes[2].pool, 64, NULL), (uint8_t *)arena64, CHNEW_POOL64_COUNT, false },
+  { _MEMORYPOOL_DATA(classes[3].pool, 128, NULL), (uint8_t *)arena128, CHNEW_POOL128_COUNT, false }
+};
+
+static NewClassStats stats[CHNEW_NUM_CLASSES + 1];
+
+
+static void *heap_alloc(::MemoryHeap *heapp, size_t size) {
+  void *objp;
+
+  objp = chHeapAlloc(heapp, size);
+  if (objp != NULL) {
+    chSysLock();
+    stats[CHNEW_NUM_CLASSES].allocs++;
+    if (++stats[CHNEW_NUM_CLASSES].used > stats[CHNEW_NUM_CLASSES].peak) {
+      stats[CHNEW_NUM_CLASSES].peak = stats[CHNEW_NUM_CLASSES].used;
+    }
+    chSysUnlock();
+  }
+  return objp;
+}
+
+
+static void *alloc(size_t size) {
+  unsigned i;
+  void *objp;
+
+  if (size == 0) {
+    size = 1;
+  }
+
+  chSysLock();
+  for (i = 0; i < CHNEW_NUM_CLASSES; i++) {
+    SizeClass *cp = &classes[i];
+
+    if (size > cp->pool.mp_object_size) {
+      continue;
+    }
+    if (!cp->loaded) {
+      for (size_t j = 0; j < cp->count; j++) {
+        chPoolFreeI(&cp->pool, cp->arenap + j * cp->pool.mp_object_size);
+      }
+      cp->loaded = true;
+    }
+    objp = chPoolAllocI(&cp->pool);
+    if (objp != NULL) {
+      stats[i].allocs++;
+      if (++stats[i].used > stats[i].peak) {
+        stats[i].peak = stats[i].used;
+      }
+      chSysUnlock();
+      return objp;
+    }
+    stats[i].fallbacks++;
+    break;
+  }
+  chSysUnlock();
+
+  return heap_alloc(NULL, size);
+}
+
+
+static void release(void *objp) {
+  unsigned i;
+
+  if (objp == NULL) {
+    return;
+  }
+
+  for (i = 0; i < CHNEW_NUM_CLASSES; i++) {
+    SizeClass *cp = &classes[i];
+
+    if (((uint8_t *)objp >= cp->arenap) &&
+        ((uint8_t *)objp < cp->arenap + cp->count * cp->pool.mp_object_size)) {
+      chSysLock();
+      chPoolFreeI(&cp->pool, objp);
+      stats[i].used--;
+      chSysUnlock();
+      return;
+    }
+  }
+
+  chHeapFree(objp);
+  chSysLock();
+  stats[CHNEW_NUM_CLASSES].used--;
+  chSysUnlock();
+}
+
+
+/*
+ * Copies the statistics of the size classes followed by the heap fallback,
+ * returns the number of entries written.
+ */
+size_t chnew_stats(NewClassStats *statsp, size_t n) {
+  size_t i;
+
+  if (n > CHNEW_NUM_CLASSES + 1) {
+    n = CHNEW_NUM_CLASSES + 1;
+  }
+
+  chSysLock();
+  for (i = 0; i < n; i++) {
+    statsp[i] = stats[i];
+    if (i < CHNEW_NUM_CLASSES) {
+      statsp[i].size = classes[i].pool.mp_object_size;
+      statsp[i].capacity = classes[i].count;
+    } else {
+      statsp[i].size = 0;
+      statsp[i].capacity = 0;
+    }
+  }
+  chSysUnlock();
+  return n;
+}
+
 
 void *operator new (size_t size) {
 
-  return chHeapAlloc(NULL, (size > 0) ? size : 1);
+  return alloc(size);
 }
 
 
 void *operator new (size_t size, ::MemoryHeap *heapp) {
 
-  return chHeapAlloc(heapp, (size > 0) ? size : 1);
+  return heap_alloc(heapp, (size > 0) ? size : 1);
 }
 
 
 void *operator new [] (size_t size) {
 
-  return chHeapAlloc(NULL, (size > 0) ? size : 1);
+  return alloc(size);
 }
 
 
 void *operator new [] (size_t size, ::MemoryHeap *heapp) {
 
-  return chHeapAlloc(heapp, (size > 0) ? size : 1);
+  return heap_alloc(heapp, (size > 0) ? size : 1);
 }
 
 
 void operator delete (void *objp) {
 
-  if (objp != NULL) {
-    chHeapFree(objp);
-  }
+  release(objp);
 }
 
 
 void operator delete (void *objp, ::MemoryHeap *heapp) {
 
   (void)heapp;
-  if (objp != NULL) {
-    chHeapFree(objp);
-  }
+  release(objp);
 }
 
 
 void operator delete [] (void *objp) {
 
-  if (objp != NULL) {
-    chHeapFree(objp);
-  }
+  release(objp);
 }
 
 
 void operator delete [] (void *objp, ::MemoryHeap *heapp) {
 
   (void)heapp;
-  if (objp != NULL) {
-    chHeapFree(objp);
-  }
+  release(objp);
 }
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <ch.h>
+
+/*
+ * Size-class allocator behind operator new, see chnew.cpp.
+ *
+ * Small objects come from MemoryPools of fixed size classes, each backed by
+ * a static arena, so allocation and release are O(1) and never fragment the
+ * heap. Larger objects, and small ones whose class is exhausted, fall back
+ * to the default heap.
+ */
+
+#ifndef CHNEW_POOL16_COUNT
+#define CHNEW_POOL16_COUNT      32
+#endif
+
+#ifndef CHNEW_POOL32_COUNT
+#define CHNEW_POOL32_COUNT      32
+#endif
+
+#ifndef CHNEW_POOL64_COUNT
+#define CHNEW_POOL64_COUNT      16
+#endif
+
+#ifndef CHNEW_POOL128_COUNT
+#define CHNEW_POOL128_COUNT     8
+#endif
+
+#define CHNEW_NUM_CLASSES       4
+
+/*
+ * Statistics of a size class, the heap fallback is reported as a last class
+ * with zero object size.
+ */
+struct NewClassStats {
+  size_t    size;                       /* Object size, zero for the heap.   */
+  size_t    capacity;                   /* Objects in the arena.             */
+  uint32_t  used;
+  uint32_t  peak;
+  uint32_t  allocs;
+  uint32_t  fallbacks;                  /* Served by the heap, class full.   */
+};
+
+size_t chnew_stats(NewClassStats *statsp, size_t n);
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <ch.h>
+
+#include <r2p/Middleware.hpp>
+
+/*
+ * Publisher for commands, it owns its node and keeps it enabled while
+ * commands are flowing.
+ *
+ * The node is enabled, and advertised the first time, by alloc() and
+ * disabled by idle() once no command was sent for idle_ms milliseconds, so
+ * a stream of commands pays the enable and disable cost only once. alloc()
+ * holds the publisher mutex until the matching publish(), a successful
+ * alloc() must always be followed by publish().
+ *
+ * Every command publisher registers itself on construction, the main loop
+ * calls CommandPublisherBase::idle_all() periodically.
+ */
+class CommandPublisherBase {
+private:
+	CommandPublisherBase * next;
+
+	static CommandPublisherBase *& head() {
+		static CommandPublisherBase * headp = NULL;
+		return headp;
+	}
+
+protected:
+	r2p::Node node;
+	const char * const topic;
+	Mutex mtx;
+	bool advertised;
+	bool enabled;
+	systime_t last_use;
+
+	/* Called with the mutex locked.*/
+	void enable() {
+		node.set_enabled(true);
+		enabled = true;
+		enables++;
+	}
+
+public:
+	uint16_t idle_ms;
+	uint32_t enables;
+
+	CommandPublisherBase(const char * node_name, const char * topic, uint16_t idle_ms) :
+			next(NULL), node(node_name, false), topic(topic), advertised(false), enabled(false), last_use(0),
+			idle_ms(idle_ms), enables(0) {
+		CommandPublisherBase ** pp = &head();
+
+		chMtxInit(&mtx);
+		while (*pp != NULL)
+			pp = &(*pp)->next;
+		*pp = this;
+	}
+
+	/*
+	 * Disables the node if it was idle for idle_ms, skipped if a command is
+	 * being sent. The time is read with the mutex held, after any alloc()
+	 * that set last_use.
+	 */
+	void idle() {
+		if (!chMtxTryLock(&mtx))
+			return;
+		if (enabled && (chTimeNow() - last_use >= MS2ST(idle_ms))) {
+			node.set_enabled(false);
+			enabled = false;
+		}
+		chMtxUnlock();
+	}
+
+	static void idle_all() {
+		for (CommandPublisherBase * cp = head(); cp != NULL; cp = cp->next) {
+			cp->idle();
+		}
+	}
+};
+
+
+template<typename MessageType>
+class CommandPublisher : public CommandPublisherBase {
+private:
+	r2p::Publisher<MessageType> pub;
+
+public:
+	CommandPublisher(const char * node_name, const char * topic, uint16_t idle_ms = 500) :
+			CommandPublisherBase(node_name, topic, idle_ms) {
+	}
+
+	bool alloc(MessageType *& msgp) {
+		chMtxLock(&mtx);
+		if (!enabled) {
+			enable();
+			if (!advertised) {
+				node.advertise(pub, topic, r2p::Time::INFINITE);
+				advertised = true;
+			}
+		}
+		last_use = chTimeNow();
+
+		if (pub.alloc(msgp))
+			return true;
+
+		chMtxUnlock();
+		return false;
+	}
+
+	bool publish(MessageType & msg) {
+		bool success = pub.publish(msg);
+
+		chMtxUnlock();
+		return success;
+	}
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Wheeled base kinematics.
+ *
+ * The geometry is given as template parameters in micrometres, so every
+ * coefficient of the wheel Jacobian and of its inverse is a compile time
+ * constant: a Ratio, folded by the compiler for float and an integral
+ * fixed point constant for Q16. inverse() maps a body velocity (x forward [m/s], y left
+ * [m/s], w counterclockwise [rad/s]) to wheel angular speeds [rad/s],
+ * forward() maps the wheel speeds back to the body velocity.
+ *
+ * The number type is float or Q16. No ChibiOS dependency, the classes are
+ * also used by the host tools.
+ */
+
+/*
+ * Q16.16 fixed point.
+ */
+class Q16 {
+public:
+	int32_t raw;
+
+	Q16() :
+			raw(0) {
+	}
+
+	explicit Q16(float value) :
+			raw((int32_t) (value * 65536.0f + ((value >= 0.0f) ? 0.5f : -0.5f))) {
+	}
+
+	static Q16 from_raw(int32_t raw) {
+		Q16 q;
+
+		q.raw = raw;
+		return q;
+	}
+
+	float to_float() const {
+		return (float) raw / 65536.0f;
+	}
+
+	Q16 operator+(Q16 b) const {
+		return from_raw(raw + b.raw);
+	}
+
+	Q16 operator-(Q16 b) const {
+		return from_raw(raw - b.raw);
+	}
+
+	Q16 operator-() const {
+		return from_raw(-raw);
+	}
+
+	Q16 operator*(Q16 b) const {
+		return from_raw((int32_t) (((int64_t) raw * b.raw + 0x8000) >> 16));
+	}
+};
+
+/*
+ * Positive compile time constant N / D, below 128 with D below 2^51.
+ * fixed holds it with 24 fractional bits, computed 12 bits at a time so
+ * that the intermediate products do not overflow; the small coefficients
+ * of the inverse Jacobians would lose too much precision in Q16.
+ */
+template<int64_t N, int64_t D>
+struct Ratio {
+	static const int64_t fixed = ((N / D) << 24) + ((((N % D) << 12) / D) << 12)
+			+ (((((N % D) << 12) % D) << 12) + D / 2) / D;
+
+	static float to_float() {
+		return (float) N / (float) D;
+	}
+};
+
+template<typename K> inline float scale(float value) {
+	return value * K::to_float();
+}
+
+template<typename K> inline Q16 scale(Q16 value) {
+	return Q16::from_raw((int32_t) (((int64_t) value.raw * K::fixed + 0x800000) >> 24));
+}
+
+template<typename T>
+struct BodyVelocity {
+	T x;
+	T y;
+	T w;
+};
+
+/*
+ * Differential drive, wheel 0 on the right and wheel 1 on the left, both
+ * positive when driving forward. TRACK is the distance between the wheels.
+ *
+ * R * dth0 = x + TRACK / 2 * w
+ * R * dth1 = x - TRACK / 2 * w
+ */
+template<typename T, int32_t TRACK_UM, int32_t RADIUS_UM>
+class DifferentialKinematics {
+private:
+	typedef Ratio<1000000, RADIUS_UM> InvR;             // 1 / R
+	typedef Ratio<TRACK_UM, 2 * (int64_t) RADIUS_UM> HalfTrackR; // TRACK / 2R
+	typedef Ratio<RADIUS_UM, 2000000> HalfR;            // R / 2
+	typedef Ratio<RADIUS_UM, TRACK_UM> RTrack;          // R / TRACK
+
+public:
+	typedef T Number;
+
+	static const unsigned NUM_WHEELS = 2;
+
+	static void inverse(const BodyVelocity<T> & v, T dth[NUM_WHEELS]) {
+		const T x = scale<InvR>(v.x);
+		const T w = scale<HalfTrackR>(v.w);
+
+		dth[0] = x + w;
+		dth[1] = x - w;
+	}
+
+	static void forward(const T dth[NUM_WHEELS], BodyVelocity<T> & v) {
+		v.x = scale<HalfR>(dth[0] + dth[1]);
+		v.y = T();
+		v.w = scale<RTrack>(dth[0] - dth[1]);
+	}
+};
+
+/*
+ * Three omni wheels at 120 degrees, wheel 2 at the back with its axis along
+ * x, wheels 0 and 1 at the front right and front left. DISTANCE is from the
+ * center to the wheels.
+ *
+ * R * dth0 = cos(60°) * y - cos(30°) * x - DISTANCE * w
+ * R * dth1 = cos(60°) * y + cos(30°) * x - DISTANCE * w
+ * R * dth2 =           -y                 - DISTANCE * w
+ */
+template<typename T, int32_t DISTANCE_UM, int32_t RADIUS_UM>
+class Omni3Kinematics {
+private:
+	typedef Ratio<500000, RADIUS_UM> C60R;                                  // cos(60°) / R
+	typedef Ratio<866025404, 1000 * (int64_t) RADIUS_UM> C30R;              // cos(30°) / R
+	typedef Ratio<1000000, RADIUS_UM> InvR;                                 // 1 / R
+	typedef Ratio<DISTANCE_UM, RADIUS_UM> DistanceR;                        // DISTANCE / R
+	typedef Ratio<RADIUS_UM * (int64_t) 57735027, 100000000000000LL> RSqrt3; // R / sqrt(3)
+	typedef Ratio<RADIUS_UM, 3000000> R3;                                   // R / 3
+	typedef Ratio<RADIUS_UM, 3 * (int64_t) DISTANCE_UM> R3Distance;         // R / (3 * DISTANCE)
+
+public:
+	typedef T Number;
+
+	static const unsigned NUM_WHEELS = 3;
+
+	static void inverse(const BodyVelocity<T> & v, T dth[NUM_WHEELS]) {
+		const T y = scale<C60R>(v.y);
+		const T x = scale<C30R>(v.x);
+		const T w = scale<DistanceR>(v.w);
+
+		dth[0] = y - x - w;
+		dth[1] = y + x - w;
+		dth[2] = -scale<InvR>(v.y) - w;
+	}
+
+	static void forward(const T dth[NUM_WHEELS], BodyVelocity<T> & v) {
+		v.x = scale<RSqrt3>(dth[1] - dth[0]);
+		v.y = scale<R3>(dth[0] + dth[1] - dth[2] - dth[2]);
+		v.w = -scale<R3Distance>(dth[0] + dth[1] + dth[2]);
+	}
+};
+
+/*
+ * Mecanum wheels, front left, front right, rear left and rear right, the
+ * rollers at 45 degrees forming an O seen from above. LX and LY are the half
+ * wheelbase and the half track.
+ *
+ * R * dth0 = x - y - (LX + LY) * w
+ * R * dth1 = x + y + (LX + LY) * w
+ * R * dth2 = x + y - (LX + LY) * w
+ * R * dth3 = x - y + (LX + LY) * w
+ */
+template<typename T, int32_t LX_UM, int32_t LY_UM, int32_t RADIUS_UM>
+class MecanumKinematics {
+private:
+	typedef Ratio<1000000, RADIUS_UM> InvR;                                  // 1 / R
+	typedef Ratio<(int64_t) LX_UM + LY_UM, RADIUS_UM> LR;                    // (LX + LY) / R
+	typedef Ratio<RADIUS_UM, 4000000> R4;                                    // R / 4
+	typedef Ratio<RADIUS_UM, 4 * ((int64_t) LX_UM + LY_UM)> R4L;             // R / (4 * (LX + LY))
+
+public:
+	typedef T Number;
+
+	static const unsigned NUM_WHEELS = 4;
+
+	static void inverse(const BodyVelocity<T> & v, T dth[NUM_WHEELS]) {
+		const T x = scale<InvR>(v.x);
+		const T y = scale<InvR>(v.y);
+		const T w = scale<LR>(v.w);
+
+		dth[0] = x - y - w;
+		dth[1] = x + y + w;
+		dth[2] = x + y - w;
+		dth[3] = x - y + w;
+	}
+
+	static void forward(const T dth[NUM_WHEELS], BodyVelocity<T> & v) {
+		v.x = scale<R4>(dth[0] + dth[1] + dth[2] + dth[3]);
+		v.y = scale<R4>(dth[1] + dth[2] - dth[0] - dth[3]);
+		v.w = scale<R4L>(dth[1] + dth[3] - dth[0] - dth[2]);
+	}
+};
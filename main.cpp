@@ -1,4 +1,5 @@
 #include <stdlib.h> // atof()
+#include <string.h>
 
 #include "ch.h"
 #include "hal.h"
@@ -6,6 +7,11 @@
 #include "shell.h"
 
 #include "usbcfg.h"
+#include "telemetry.h"
+#include "streamq.h"
+#include "timesync.h"
+#include "top.h"
+#include "stackinfo.h"
 
 #include <r2p/Middleware.hpp>
 #include <r2p/node/led.hpp>
@@ -13,6 +19,15 @@
 #include <r2p/msg/imu.hpp>
 #include <r2p/msg/proximity.hpp>
 
+#include "cmdpub.hpp"
+#include "setpoint.hpp"
+#include "profile.hpp"
+#include "kinematics.hpp"
+#include "saturation.hpp"
+#include "odometry.hpp"
+#include "msgs.hpp"
+#include "chnew.hpp"
+
 
 #ifndef R2P_MODULE_NAME
 #define R2P_MODULE_NAME "uDC"
@@ -25,17 +40,34 @@ RTCANConfig rtcan_config = { 1000000, 100, 60 };
 
 r2p::Middleware r2p::Middleware::instance(R2P_MODULE_NAME, "BOOT_"R2P_MODULE_NAME);
 
-r2p::Node vel_node("speedpub", false);
-r2p::Publisher<r2p::Speed2Msg> vel_pub;
+CommandPublisher<r2p::Speed2Msg> vel_pub("speedpub", "speed2");
+
+CommandPublisher<r2p::PIDCfgMsg> pidcfg_pub("pidcfg", "pidcfg");
+
+r2p::Node latency_node("subbench", false);
+r2p::Publisher<r2p::LatencyMsg> latency_pub;
 
-r2p::Node pidcfg_node("pidcfg", false);
-r2p::Publisher<r2p::PIDCfgMsg> pidcfg_pub;
+r2p::Node cmdbench_node("cmdbench", false);
+r2p::Publisher<r2p::LatencyMsg> cmdbench_pub;
+CommandPublisher<r2p::LatencyMsg> cmdbench_cmdpub("cmdpub", "cmdbench");
 
 bool stream_imu = false;
 bool stream_enc = false;
 bool stream_proxy = false;
-
-BaseSequentialStream * serialp;
+bool stream_pose = false;
+/* Aggregated snapshots, every aggr_period_ms (0 is off) or per encoder sample.*/
+uint32_t aggr_period_ms = 0;
+bool aggr_on_encoder = false;
+#if USB_DATA_VENDOR
+/* The vendor interface only carries frames, text streams go to the shell.*/
+bool stream_binary = true;
+BaseSequentialStream * serialp = (BaseSequentialStream *) &SDU1;
+#else
+bool stream_binary = false;
+BaseSequentialStream * serialp = (BaseSequentialStream *) &SDU2;
+#endif
+static MUTEX_DECL(stream_mtx);
+static StreamQueue streamq;
 
 /*
  * DP resistor control is not possible on the STM32F3-Discovery, using stubs
@@ -63,8 +95,291 @@ BaseSequentialStream * serialp;
  */
 
 // Robot parameters
-#define _L        0.400f    // Wheel distance [m]
-#define _R        0.05f    // Wheel radius [m]
+#define _L_UM     400000   // Wheel distance [um]
+#define _R_UM     50000    // Wheel radius [um]
+#define _MAX_DTH  52.0f    // Maximum wheel angular speed [rad/s]
+#define _MAX_ACC  1.0f     // Body acceleration [m/s^2] and jerk [m/s^3] limits
+#define _MAX_JERK 5.0f
+#define _MAX_DW   4.0f     // Body angular acceleration [rad/s^2] and jerk [rad/s^3] limits
+#define _MAX_DDW  20.0f
+
+typedef DifferentialKinematics<float, _L_UM, _R_UM> Kinematics;
+
+/* Only used by the streamer thread, the shell sets the priority.*/
+WheelSaturation<Kinematics> wheel_saturation(_MAX_DTH);
+
+void speed2_fill(r2p::Speed2Msg & msg, const Setpoint & sp) {
+	const BodyVelocity<float> v = { sp.x, sp.y, sp.w };
+	float dth[Kinematics::NUM_WHEELS];
+
+	wheel_saturation.apply(v, dth);
+	msg.value[0] = dth[0];
+	msg.value[1] = -dth[1]; // Motor 2 is mirrored
+}
+
+typedef SetpointStreamer<r2p::Speed2Msg, speed2_fill> VelocityStreamer;
+VelocityStreamer vel_streamer(vel_pub, _MAX_ACC, _MAX_JERK, _MAX_DW, _MAX_DDW);
+ProfilePlayer<VelocityStreamer> vel_profile(vel_streamer);
+
+/* Owned by the dispatcher node, the shell reads the pose snapshot.*/
+Odometry<Kinematics> odometry;
+static Snapshot<tlm_pose_t> pose_snapshot;
+static volatile bool odometry_reset = false;
+static uint32_t odometry_last_us = 0;
+static r2p::Publisher<r2p::OdometryMsg> pose_pub;
+
+/*===========================================================================*/
+/* Binary commands.                                                          */
+/*===========================================================================*/
+
+static TelemetryDecoder command_decoder;
+static uint32_t command_frames = 0;
+
+static void profile_report_frames(void);
+
+/*
+ * Handles a command frame received from the host.
+ */
+static void command_frame(const TelemetryDecoder * decp) {
+
+	switch (decp->topic) {
+	case TLM_TOPIC_SETPOINT: {
+		tlm_setpoint_t tsp;
+		Setpoint sp;
+
+		if (decp->payload_len != sizeof(tsp))
+			return;
+		memcpy(&tsp, decp->payload, sizeof(tsp));
+		sp.x = tsp.x;
+		sp.y = tsp.y;
+		sp.w = tsp.w;
+		vel_streamer.set(SETPOINT_BINARY, sp);
+		break;
+	}
+	case TLM_TOPIC_PROFILE: {
+		tlm_profile_point_t tpp;
+		ProfilePoint point;
+
+		if (decp->payload_len != sizeof(tpp))
+			return;
+		memcpy(&tpp, decp->payload, sizeof(tpp));
+		point.t_us = tpp.t_us;
+		point.sp.x = tpp.x;
+		point.sp.y = tpp.y;
+		point.sp.w = tpp.w;
+		vel_profile.put(tpp.index, point);
+		break;
+	}
+	case TLM_TOPIC_PROFILE_CTRL: {
+		tlm_profile_ctrl_t tpc;
+
+		if (decp->payload_len != sizeof(tpc))
+			return;
+		memcpy(&tpc, decp->payload, sizeof(tpc));
+		switch (tpc.cmd) {
+		case TLM_PROFILE_PLAY:
+			vel_profile.play();
+			break;
+		case TLM_PROFILE_PAUSE:
+			vel_profile.pause();
+			break;
+		case TLM_PROFILE_RESUME:
+			vel_profile.resume();
+			break;
+		case TLM_PROFILE_ABORT:
+			vel_profile.abort();
+			break;
+		case TLM_PROFILE_REPORT:
+			profile_report_frames();
+			break;
+		default:
+			return;
+		}
+		break;
+	}
+	default:
+		return;
+	}
+
+	command_frames++;
+}
+
+/*
+ * Receives command frames from the host on the data port.
+ */
+msg_t command_rx_node(void * arg) {
+#if USB_DATA_VENDOR
+	/* budRead() discards what does not fit, a whole transfer must.*/
+	static uint8_t buf[BULKUSB_RX_SIZE];
+#else
+	uint8_t buf[64];
+#endif
+	size_t n;
+
+	(void) arg;
+	chRegSetThreadName("command_rx");
+
+	tlmDecoderInit(&command_decoder);
+
+	for (;;) {
+#if USB_DATA_VENDOR
+		n = budRead(&BUD1, buf, sizeof(buf), MS2ST(100));
+		if (n == 0) {
+			/* Returns at once while the interface is not configured.*/
+			chThdSleepMilliseconds(10);
+		}
+#else
+		n = chnReadTimeout((BaseChannel *) &SDU2, buf, sizeof(buf), MS2ST(100));
+#endif
+		for (size_t i = 0; i < n; i++) {
+			if (tlmDecoderPut(&command_decoder, buf[i])) {
+				command_frame(&command_decoder);
+			}
+		}
+	}
+
+	return CH_SUCCESS;
+}
+
+/*===========================================================================*/
+/* Streaming.                                                                */
+/*===========================================================================*/
+
+/*
+ * Sends a raw message body as a single binary telemetry frame.
+ */
+static void stream_frame(uint8_t topic, uint32_t stamp, const void * payloadp, size_t n) {
+	static uint8_t seq[TLM_NUM_TOPICS];
+	uint8_t frame[TLM_MAX_FRAME_SIZE];
+	size_t len;
+
+	chMtxLock(&stream_mtx);
+	len = tlmEncode(frame, topic, seq[topic]++, stamp, payloadp, n);
+#if USB_DATA_VENDOR
+	budWrite(&BUD1, frame, len, TIME_INFINITE);
+#else
+	chSequentialStreamWrite(serialp, frame, len);
+#endif
+	chMtxUnlock();
+}
+
+/*
+ * Sends the last start of frame latch, binary streams only.
+ */
+static void stream_sync(void) {
+	TimeSyncLatch latch;
+	tlm_sync_t sync;
+
+	tsGetLatch(&latch);
+	sync.sof_us = latch.sof_us;
+	sync.frame = latch.frame;
+	stream_frame(TLM_TOPIC_SYNC, tsNow(), &sync, sizeof(sync));
+}
+
+/*
+ * Stream writer, the only thread that waits on the host. Samples come from
+ * the subscribers through the stream queue, a sync message is interleaved
+ * every 100ms while a binary stream is on.
+ */
+msg_t stream_writer_node(void * arg) {
+	StreamSample sample;
+	systime_t last_sync = chTimeNow();
+
+	(void) arg;
+	chRegSetThreadName("stream_writer");
+
+	for (;;) {
+		bool fetched = sqFetch(&streamq, &sample, MS2ST(100));
+
+		if (stream_binary && (stream_enc || stream_imu || stream_proxy || stream_pose) &&
+				(chTimeNow() - last_sync >= MS2ST(100))) {
+			last_sync = chTimeNow();
+			stream_sync();
+		}
+
+		if (!fetched)
+			continue;
+
+		if (stream_binary) {
+			stream_frame(sample.topic, sample.stamp, sample.payload, sample.len);
+			continue;
+		}
+
+		switch (sample.topic) {
+		case TLM_TOPIC_ENCODER2: {
+			tlm_encoder2_t enc;
+			memcpy(&enc, sample.payload, sizeof(enc));
+			chprintf(serialp, "%f %f\r\n", enc.delta[0], enc.delta[1]);
+			break;
+		}
+		case TLM_TOPIC_IMU: {
+			tlm_imu_t imu;
+			memcpy(&imu, sample.payload, sizeof(imu));
+			chprintf(serialp, "%f %f %f\r\n", imu.roll, imu.pitch, imu.yaw);
+			break;
+		}
+		case TLM_TOPIC_PROXIMITY: {
+			tlm_proximity_t prox;
+			memcpy(&prox, sample.payload, sizeof(prox));
+			chprintf(serialp, "%5d %5d %5d %5d %5d %5d %5d %5d \r\n", prox.value[0], prox.value[1], prox.value[2], prox.value[3], prox.value[4], prox.value[5], prox.value[6], prox.value[7]);
+			break;
+		}
+		case TLM_TOPIC_POSE: {
+			tlm_pose_t pose;
+			memcpy(&pose, sample.payload, sizeof(pose));
+			chprintf(serialp, "%f %f %f %f %f %f\r\n", pose.x, pose.y, pose.theta, pose.vx, pose.vy, pose.w);
+			break;
+		}
+		case TLM_TOPIC_SNAPSHOT: {
+			tlm_snapshot_t snap;
+			memcpy(&snap, sample.payload, sizeof(snap));
+			chprintf(serialp, "%f %f %f %f %f ", snap.encoder2.delta[0], snap.encoder2.delta[1], snap.imu.roll, snap.imu.pitch, snap.imu.yaw);
+			chprintf(serialp, "%5d %5d %5d %5d %5d %5d %5d %5d ", snap.proximity.value[0], snap.proximity.value[1], snap.proximity.value[2], snap.proximity.value[3], snap.proximity.value[4], snap.proximity.value[5], snap.proximity.value[6], snap.proximity.value[7]);
+			chprintf(serialp, "%5u %5u %5u %u\r\n", snap.age[0], snap.age[1], snap.age[2], snap.valid);
+			break;
+		}
+		}
+	}
+
+	return CH_SUCCESS;
+}
+
+
+/*
+ * Dispatch latency statistics, in microseconds.
+ */
+struct LatencyStats {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint32_t sum;
+};
+
+static LatencyStats dispatch_latency;
+static LatencyStats poll_latency;
+
+static void latency_reset(LatencyStats & stats) {
+	chSysLock();
+	stats.count = 0;
+	stats.min = 0xFFFFFFFF;
+	stats.max = 0;
+	stats.sum = 0;
+	chSysUnlock();
+}
+
+static void latency_add(LatencyStats & stats, const r2p::LatencyMsg & msg) {
+	uint32_t us = tsNow() - msg.stamp;
+
+	chSysLock();
+	stats.count++;
+	stats.sum += us;
+	if (us < stats.min)
+		stats.min = us;
+	if (us > stats.max)
+		stats.max = us;
+	chSysUnlock();
+}
+
 
 /*===========================================================================*/
 /* Command line related.                                                     */
@@ -74,6 +389,7 @@ BaseSequentialStream * serialp;
 #define TEST_WA_SIZE    THD_WA_SIZE(256)
 
 static void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
+	NewClassStats stats[CHNEW_NUM_CLASSES + 1];
 	size_t n, size;
 
 	(void) argv;
@@ -85,6 +401,17 @@ static void cmd_mem(BaseSequentialStream *chp, int argc, char *argv[]) {
 	chprintf(chp, "core free memory : %u bytes\r\n", chCoreStatus());
 	chprintf(chp, "heap fragments   : %u\r\n", n);
 	chprintf(chp, "heap free total  : %u bytes\r\n", size);
+
+	n = chnew_stats(stats, CHNEW_NUM_CLASSES + 1);
+	chprintf(chp, "class  used/cap  peak   allocs fallbacks\r\n");
+	for (unsigned i = 0; i < n; i++) {
+		if (stats[i].size > 0) {
+			chprintf(chp, "%5u %5lu/%-3u %5lu %8lu %9lu\r\n", stats[i].size, stats[i].used, stats[i].capacity,
+					stats[i].peak, stats[i].allocs, stats[i].fallbacks);
+		} else {
+			chprintf(chp, " heap %5lu     %5lu %8lu\r\n", stats[i].used, stats[i].peak, stats[i].allocs);
+		}
+	}
 }
 
 static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
@@ -105,34 +432,226 @@ static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
 	} while (tp != NULL);
 }
 
-static void cmd_run(BaseSequentialStream *chp, int argc, char *argv[]) {
-	r2p::Speed2Msg * msgp;
+static void cmd_usb(BaseSequentialStream *chp, int argc, char *argv[]) {
+#if USB_DATA_VENDOR
+	static USBTxDriver * const utxs[] = { &UTX1 };
+#else
+	static USBTxDriver * const utxs[] = { &UTX1, &UTX2 };
+#endif
+	uint32_t packets, zlps, bytes, frames;
 
 	(void) argv;
+	if (argc > 0) {
+		chprintf(chp, "Usage: usb\r\n");
+		return;
+	}
+	chprintf(chp, "port  packets      zlp    bytes   frames b/pkt b/frame\r\n");
+	for (unsigned i = 0; i < sizeof(utxs) / sizeof(utxs[0]); i++) {
+		chSysLock();
+		packets = utxs[i]->packets;
+		zlps = utxs[i]->zlps;
+		bytes = utxs[i]->bytes;
+		frames = utxs[i]->frames;
+		chSysUnlock();
+		chprintf(chp, "SDU%u %8lu %8lu %8lu %8lu %5lu %7lu\r\n", i + 1, packets, zlps, bytes, frames,
+				packets ? bytes / packets : 0, frames ? bytes / frames : 0);
+	}
+#if USB_DATA_VENDOR
+	chprintf(chp, "BUD1 messages %lu transfers %lu bytes %lu in, %lu transfers %lu bytes out\r\n",
+			BUD1.tx_messages, BUD1.tx_transfers, BUD1.tx_bytes, BUD1.rx_transfers, BUD1.rx_bytes);
+#endif
+}
 
-	if (argc != 2) {
-		chprintf(chp, "Usage: r <forward> <angular>\r\n");
+static void cmd_bench(BaseSequentialStream *chp, int argc, char *argv[]) {
+	tlm_imu_t imu = { 0, 0, 0 };
+	uint32_t frames = 0;
+	systime_t start, duration;
+
+	if (argc != 1) {
+		chprintf(chp, "Usage: bench <ms>\r\n");
+		return;
+	}
+
+	duration = MS2ST(atoi(argv[0]));
+	start = chTimeNow();
+	while (chTimeNow() - start < duration) {
+		imu.yaw = (float) frames;
+		stream_frame(TLM_TOPIC_IMU, tsNow(), &imu, sizeof(imu));
+		frames++;
+	}
+	duration = chTimeNow() - start;
+	chprintf(chp, "%lu frames in %lu ms, %lu frames/s\r\n", frames, duration * 1000 / CH_FREQUENCY,
+			duration ? (frames * CH_FREQUENCY) / duration : 0);
+}
+
+static void cmd_queue(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static const char * const policies[] = { "oldest", "newest", "decimate" };
+	static const char * const topics[] = { "", "encoder2", "imu", "proximity", "sync", "snapshot", "setpoint", "profile",
+			"profctrl", "pose" };
+	uint32_t posted, dropped;
+
+	if ((argc > 2) || ((argc == 2) && (strcmp(argv[0], "decimate") != 0))) {
+		chprintf(chp, "Usage: q [oldest|newest|decimate [n]]\r\n");
+		return;
+	}
+
+	if (argc > 0) {
+		unsigned i;
+
+		for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+			if (strcmp(argv[0], policies[i]) == 0)
+				break;
+		}
+		if (i == sizeof(policies) / sizeof(policies[0])) {
+			chprintf(chp, "Usage: q [oldest|newest|decimate [n]]\r\n");
+			return;
+		}
+		sqSetPolicy(&streamq, (sqpolicy_t) i, (argc == 2) ? atoi(argv[1]) : 2);
+	}
+
+	chprintf(chp, "policy %s", policies[streamq.policy]);
+	if (streamq.policy == SQ_DECIMATE)
+		chprintf(chp, " 1/%u", streamq.decimation);
+	chprintf(chp, ", queued %u/%u, peak %u\r\n", streamq.count, STREAMQ_DEPTH, streamq.peak);
+	for (unsigned i = 1; i < TLM_NUM_TOPICS; i++) {
+		chSysLock();
+		posted = streamq.posted[i];
+		dropped = streamq.dropped[i];
+		chSysUnlock();
+		chprintf(chp, "%-10s posted %8lu dropped %8lu\r\n", topics[i], posted, dropped);
+	}
+}
+
+msg_t latency_poll_node(void * arg);
+
+static void cmd_subbench(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static bool first_time = true;
+	static bool poller_started = false;
+	r2p::LatencyMsg * msgp;
+	uint32_t n = 100;
+	bool poll = false;
+
+	if ((argc > 2) || ((argc == 2) && (strcmp(argv[1], "poll") != 0))) {
+		chprintf(chp, "Usage: subbench [n [poll]]\r\n");
 		return;
 	}
+	if (argc > 0)
+		n = atoi(argv[0]);
+	if (argc > 1)
+		poll = true;
+
+	if (poll && !poller_started) {
+		/* Left running, it only serves this benchmark.*/
+		poller_started = true;
+		r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, latency_poll_node, NULL);
+		r2p::Thread::sleep(r2p::Time::ms(100));
+	}
+
+	latency_node.set_enabled(true);
+	if (first_time) {
+		latency_node.advertise(latency_pub, "latency", r2p::Time::INFINITE);
+		first_time = false;
+	}
+
+	latency_reset(dispatch_latency);
+	latency_reset(poll_latency);
+	for (uint32_t i = 0; i < n; i++) {
+		if (latency_pub.alloc(msgp)) {
+			msgp->seq = i;
+			msgp->stamp = tsNow();
+			latency_pub.publish(*msgp);
+		}
+		/* Lets the subscribers go idle again, with a varying phase.*/
+		chThdSleepMicroseconds(2000 + (i % 7) * 131);
+	}
+	latency_node.set_enabled(false);
+	chThdSleepMilliseconds(10);
+
+	chprintf(chp, "path        count   min   avg   max [us]\r\n");
+	chprintf(chp, "dispatcher %6lu %5lu %5lu %5lu\r\n", dispatch_latency.count,
+			dispatch_latency.count ? dispatch_latency.min : 0,
+			dispatch_latency.count ? dispatch_latency.sum / dispatch_latency.count : 0, dispatch_latency.max);
+	if (poller_started) {
+		chprintf(chp, "polling    %6lu %5lu %5lu %5lu\r\n", poll_latency.count,
+				poll_latency.count ? poll_latency.min : 0,
+				poll_latency.count ? poll_latency.sum / poll_latency.count : 0, poll_latency.max);
+	}
+}
 
-	serialp = chp;
-	vel_node.set_enabled(true);
+/*
+ * Per command cost of enabling the node around every message against a
+ * CommandPublisher, both publish on the same topic.
+ */
+static void cmd_cmdbench(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static bool first_time = true;
+	r2p::LatencyMsg * msgp;
+	uint32_t n = 100;
+	uint32_t start, toggled, persistent;
+	uint32_t enables;
+
+	if (argc > 1) {
+		chprintf(chp, "Usage: cmdbench [n]\r\n");
+		return;
+	}
+	if (argc > 0)
+		n = atoi(argv[0]);
+	if (n == 0)
+		n = 1;
 
-	float forward = atof(argv[0]);
-	float angular = atof(argv[1]);
+	if (first_time) {
+		cmdbench_node.set_enabled(true);
+		cmdbench_node.advertise(cmdbench_pub, "cmdbench", r2p::Time::INFINITE);
+		cmdbench_node.set_enabled(false);
+		first_time = false;
+	}
 
-	// Motor setpoints
-	if (vel_pub.alloc(msgp)) {
-		msgp->value[0] = (1 / _R) * (forward + (_L / 2) * angular);
-		msgp->value[1] = -(1 / _R) * (forward - (_L / 2) * angular);
-		vel_pub.publish(*msgp);
+	start = tsNow();
+	for (uint32_t i = 0; i < n; i++) {
+		cmdbench_node.set_enabled(true);
+		if (cmdbench_pub.alloc(msgp)) {
+			msgp->seq = i;
+			msgp->stamp = tsNow();
+			cmdbench_pub.publish(*msgp);
+		}
+		cmdbench_node.set_enabled(false);
 	}
+	toggled = tsNow() - start;
+
+	enables = cmdbench_cmdpub.enables;
+	start = tsNow();
+	for (uint32_t i = 0; i < n; i++) {
+		if (cmdbench_cmdpub.alloc(msgp)) {
+			msgp->seq = i;
+			msgp->stamp = tsNow();
+			cmdbench_cmdpub.publish(*msgp);
+		}
+	}
+	persistent = tsNow() - start;
+	enables = cmdbench_cmdpub.enables - enables;
 
-	vel_node.set_enabled(false);
+	chprintf(chp, "%lu commands\r\n", n);
+	chprintf(chp, "set_enabled per command %6lu us, %4lu us/cmd\r\n", toggled, toggled / n);
+	chprintf(chp, "command publisher       %6lu us, %4lu us/cmd, %lu enables\r\n", persistent, persistent / n, enables);
+}
+
+static void cmd_run(BaseSequentialStream *chp, int argc, char *argv[]) {
+	Setpoint sp;
+
+	(void) argv;
+
+	if (argc != 2) {
+		chprintf(chp, "Usage: r <forward> <angular>\r\n");
+		return;
+	}
+
+	sp.x = atof(argv[0]);
+	sp.y = 0.0f;
+	sp.w = atof(argv[1]);
+	vel_streamer.set(SETPOINT_SHELL, sp);
 }
 
 static void cmd_stop(BaseSequentialStream *chp, int argc, char *argv[]) {
-	r2p::Speed2Msg * msgp;
+	Setpoint sp = { 0.0f, 0.0f, 0.0f };
 
 	(void) argv;
 
@@ -141,19 +660,120 @@ static void cmd_stop(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	vel_node.set_enabled(true);
+	vel_streamer.set(SETPOINT_SHELL, sp);
+}
+
+static void cmd_setpoint(BaseSequentialStream *chp, int argc, char *argv[]) {
+
+	if ((argc != 0) && (argc != 3)) {
+		chprintf(chp, "Usage: sp [<period_ms> <timeout_ms> <ramp_ms>]\r\n");
+		return;
+	}
+
+	if (argc == 3) {
+		if (atoi(argv[0]) <= 0) {
+			chprintf(chp, "Period must be positive\r\n");
+			return;
+		}
+		vel_streamer.period_ms = atoi(argv[0]);
+		vel_streamer.timeout_ms = atoi(argv[1]);
+		vel_streamer.ramp_ms = atoi(argv[2]);
+	}
+
+	chprintf(chp, "period %u ms, timeout %u ms, ramp %u ms\r\n", vel_streamer.period_ms, vel_streamer.timeout_ms,
+			vel_streamer.ramp_ms);
+	chprintf(chp, "limits %f m/s^2 %f m/s^3, %f rad/s^2 %f rad/s^3\r\n", vel_streamer.traj_x.max_accel,
+			vel_streamer.traj_x.max_jerk, vel_streamer.traj_w.max_accel, vel_streamer.traj_w.max_jerk);
+	chprintf(chp, "published %lu, timeouts %lu, binary frames %lu, crc errors %lu\r\n", vel_streamer.published,
+			vel_streamer.timeouts, command_frames, command_decoder.crc_errors);
+}
+
+/*
+ * Sends the profile report, one frame per played point with its actual
+ * publish time.
+ */
+static void profile_report_frames(void) {
+	tlm_profile_point_t tpp;
+
+	for (uint16_t i = 0; i < vel_profile.played; i++) {
+		tpp.index = i;
+		tpp.t_us = vel_profile.actual_us[i];
+		tpp.x = vel_profile.points[i].sp.x;
+		tpp.y = vel_profile.points[i].sp.y;
+		tpp.w = vel_profile.points[i].sp.w;
+		stream_frame(TLM_TOPIC_PROFILE, tsNow(), &tpp, sizeof(tpp));
+	}
+}
+
+static void cmd_profile(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static const char * const states[] = { "idle", "playing", "paused", "done", "aborted" };
+
+	if (argc == 0) {
+		chprintf(chp, "%s, %u/%u points played\r\n", states[vel_profile.state], vel_profile.played,
+				vel_profile.count);
+	} else if ((argc == 1) && (strcmp(argv[0], "clear") == 0)) {
+		if (!vel_profile.clear()) {
+			chprintf(chp, "Playing\r\n");
+		}
+	} else if ((argc == 4) && (strcmp(argv[0], "add") == 0)) {
+		ProfilePoint point;
+
+		point.t_us = (uint32_t) (atof(argv[1]) * 1000.0f);
+		point.sp.x = atof(argv[2]);
+		point.sp.y = 0.0f;
+		point.sp.w = atof(argv[3]);
+		if (!vel_profile.put(vel_profile.count, point)) {
+			chprintf(chp, "Rejected, full, out of order or playing\r\n");
+		}
+	} else if ((argc == 1) && (strcmp(argv[0], "play") == 0)) {
+		if (!vel_profile.play()) {
+			chprintf(chp, "Nothing to play or already playing\r\n");
+		}
+	} else if ((argc == 1) && (strcmp(argv[0], "pause") == 0)) {
+		vel_profile.pause();
+	} else if ((argc == 1) && (strcmp(argv[0], "resume") == 0)) {
+		vel_profile.resume();
+	} else if ((argc == 1) && (strcmp(argv[0], "abort") == 0)) {
+		vel_profile.abort();
+	} else if ((argc == 1) && (strcmp(argv[0], "report") == 0)) {
+		int32_t max_error = 0;
+
+		chprintf(chp, "point   planned    actual error [us]\r\n");
+		for (uint16_t i = 0; i < vel_profile.played; i++) {
+			int32_t error = (int32_t) (vel_profile.actual_us[i] - vel_profile.points[i].t_us);
+
+			chprintf(chp, "%5u %9lu %9lu %5ld\r\n", i, vel_profile.points[i].t_us, vel_profile.actual_us[i], error);
+			if (error < 0)
+				error = -error;
+			if (error > max_error)
+				max_error = error;
+		}
+		chprintf(chp, "max error %ld us\r\n", max_error);
+	} else {
+		chprintf(chp, "Usage: prof [clear|add <t_ms> <forward> <angular>|play|pause|resume|abort|report]\r\n");
+	}
+}
+
+static void cmd_saturation(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static const char * const priorities[] = { "uniform", "rotation", "translation" };
+
+	if (argc == 0) {
+		chprintf(chp, "max %f rad/s, %s first, %lu saturated\r\n", wheel_saturation.max_dth,
+				priorities[wheel_saturation.priority], wheel_saturation.saturations);
+		return;
+	}
 
-	if (vel_pub.alloc(msgp)) {
-		msgp->value[0] = 0;
-		msgp->value[1] = 0;
-		vel_pub.publish(*msgp);
+	for (unsigned i = 0; i < sizeof(priorities) / sizeof(priorities[0]); i++) {
+		if ((argc == 1) && (strcmp(argv[0], priorities[i]) == 0)) {
+			wheel_saturation.priority = (SaturationPriority) i;
+			return;
+		}
 	}
 
-	vel_node.set_enabled(false);
+	chprintf(chp, "Usage: sat [uniform|rotation|translation]\r\n");
 }
 
 static void cmd_pidcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
-	static bool first_time = true;
 	r2p::PIDCfgMsg * msgp;
 
 	(void) argv;
@@ -163,20 +783,12 @@ static void cmd_pidcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	pidcfg_node.set_enabled(true);
-
-	if (first_time) {
-		pidcfg_node.advertise(pidcfg_pub, "pidcfg", r2p::Time::INFINITE);
-		first_time = false;
-	}
 	if (pidcfg_pub.alloc(msgp)) {
 		msgp->k = atof(argv[0]);
 		msgp->ti = atof(argv[1]);
 		msgp->td = atof(argv[2]);
 		pidcfg_pub.publish(*msgp);
 	}
-
-	pidcfg_node.set_enabled(false);
 }
 
 static void cmd_enc(BaseSequentialStream *chp, int argc, char *argv[]) {
@@ -188,7 +800,6 @@ static void cmd_enc(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	serialp = chp;
 	stream_enc = !stream_enc;
 }
 
@@ -201,7 +812,6 @@ static void cmd_imu(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	serialp = chp;
 	stream_imu = !stream_imu;
 }
 
@@ -214,12 +824,82 @@ static void cmd_proxy(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	serialp = chp;
 	stream_proxy = !stream_proxy;
 }
 
-static const ShellCommand commands[] = { { "mem", cmd_mem }, { "threads", cmd_threads }, { "r", cmd_run }, { "s",
-		cmd_stop }, { "pidcfg", cmd_pidcfg }, { "e", cmd_enc }, { "i", cmd_imu }, { "p", cmd_proxy }, { NULL, NULL } };
+static void cmd_pose(BaseSequentialStream *chp, int argc, char *argv[]) {
+
+	(void) argv;
+
+	if (argc > 0) {
+		chprintf(chp, "Usage: o\r\n");
+		return;
+	}
+
+	stream_pose = !stream_pose;
+}
+
+static void cmd_odometry(BaseSequentialStream *chp, int argc, char *argv[]) {
+	tlm_pose_t pose;
+
+	if ((argc == 1) && (strcmp(argv[0], "reset") == 0)) {
+		odometry_reset = true;
+		return;
+	} else if ((argc == 2) && (strcmp(argv[0], "imu") == 0)) {
+		float gain = atof(argv[1]);
+
+		if ((gain < 0.0f) || (gain > 1.0f)) {
+			chprintf(chp, "IMU gain must be between 0 and 1\r\n");
+			return;
+		}
+		odometry.imu_gain = gain;
+		return;
+	} else if (argc > 0) {
+		chprintf(chp, "Usage: odom [reset|imu <gain>]\r\n");
+		return;
+	}
+
+	pose_snapshot.read(pose);
+	chprintf(chp, "pose %f %f %f, twist %f %f %f\r\n", pose.x, pose.y, pose.theta, pose.vx, pose.vy, pose.w);
+	chprintf(chp, "samples %lu, IMU gain %f\r\n", odometry.samples, odometry.imu_gain);
+}
+
+static void cmd_aggregate(BaseSequentialStream *chp, int argc, char *argv[]) {
+
+	if (argc != 1) {
+		chprintf(chp, "Usage: a off|enc|<ms>\r\n");
+		return;
+	}
+
+	if (strcmp(argv[0], "off") == 0) {
+		aggr_on_encoder = false;
+		aggr_period_ms = 0;
+	} else if (strcmp(argv[0], "enc") == 0) {
+		aggr_period_ms = 0;
+		aggr_on_encoder = true;
+	} else if (atoi(argv[0]) > 0) {
+		aggr_on_encoder = false;
+		aggr_period_ms = atoi(argv[0]);
+	} else {
+		chprintf(chp, "Usage: a off|enc|<ms>\r\n");
+	}
+}
+
+static void cmd_binary(BaseSequentialStream *chp, int argc, char *argv[]) {
+
+	(void) argv;
+
+	if (argc > 0) {
+		chprintf(chp, "Usage: b\r\n");
+		return;
+	}
+
+	stream_binary = !stream_binary;
+}
+
+static const ShellCommand commands[] = { { "mem", cmd_mem }, { "threads", cmd_threads }, { "top", cmd_top }, { "stack", cmd_stack }, { "usb", cmd_usb }, { "bench", cmd_bench }, { "q", cmd_queue }, { "subbench", cmd_subbench }, { "cmdbench", cmd_cmdbench }, { "r", cmd_run }, { "s",
+		cmd_stop }, { "sp", cmd_setpoint }, { "prof", cmd_profile }, { "sat", cmd_saturation }, { "pidcfg", cmd_pidcfg }, { "e", cmd_enc }, { "i", cmd_imu }, { "p", cmd_proxy }, { "o", cmd_pose }, { "odom", cmd_odometry }, { "a", cmd_aggregate }, { "b",
+		cmd_binary }, { NULL, NULL } };
 
 static const ShellConfig usb_shell_cfg = { (BaseSequentialStream *) &SDU1, commands };
 
@@ -227,27 +907,167 @@ static const ShellConfig usb_shell_cfg = { (BaseSequentialStream *) &SDU1, comma
 
 
 /*
- * Encoder subscriber node.
+ * Latest sample of each streamed topic with its arrival time, only touched
+ * by the dispatcher thread.
+ */
+static struct {
+	tlm_snapshot_t snap;
+	uint32_t stamp[3];
+} aggr;
+
+static void aggr_emit(void) {
+	uint32_t now = tsNow();
+
+	for (unsigned i = 0; i < 3; i++) {
+		uint32_t age = now - aggr.stamp[i];
+		aggr.snap.age[i] = (age < 0xFFFF) ? age : 0xFFFF;
+	}
+	sqPost(&streamq, TLM_TOPIC_SNAPSHOT, &aggr.snap, sizeof(aggr.snap));
+}
+
+
+/*
+ * Integrates an encoder sample through the forward kinematics, fusing the
+ * IMU yaw if enabled, and publishes the pose and twist on "pose".
+ */
+static void odometry_update(const r2p::Encoder2Msg & msg) {
+	/* Motor 2 is mirrored.*/
+	float delta[2] = { msg.delta[0], -msg.delta[1] };
+	uint32_t now = tsNow();
+	r2p::OdometryMsg * msgp;
+	tlm_pose_t pose;
+
+	if (odometry_reset) {
+		odometry_reset = false;
+		odometry.reset();
+		odometry_last_us = 0;
+	}
+	odometry.update(delta, (odometry_last_us != 0) ? (now - odometry_last_us) * 1e-6f : 0.0f);
+	odometry_last_us = now;
+
+	pose.x = odometry.pose.x;
+	pose.y = odometry.pose.y;
+	pose.theta = odometry.pose.theta;
+	pose.vx = odometry.twist.x;
+	pose.vy = odometry.twist.y;
+	pose.w = odometry.twist.w;
+	pose_snapshot.write(pose);
+	if (stream_pose)
+		sqPost(&streamq, TLM_TOPIC_POSE, &pose, sizeof(pose));
+
+	if (pose_pub.alloc(msgp)) {
+		msgp->x = pose.x;
+		msgp->y = pose.y;
+		msgp->theta = pose.theta;
+		msgp->vx = pose.vx;
+		msgp->vy = pose.vy;
+		msgp->w = pose.w;
+		pose_pub.publish(*msgp);
+	}
+}
+
+/*
+ * Subscriber callbacks, run by the dispatcher node.
+ */
+static bool encoder_cb(const r2p::Encoder2Msg & msg) {
+
+	odometry_update(msg);
+
+	if (stream_enc)
+		sqPost(&streamq, TLM_TOPIC_ENCODER2, msg.delta, sizeof(tlm_encoder2_t));
+
+	memcpy(&aggr.snap.encoder2, msg.delta, sizeof(aggr.snap.encoder2));
+	aggr.stamp[0] = tsNow();
+	aggr.snap.valid |= TLM_SNAPSHOT_ENCODER2;
+	if (aggr_on_encoder)
+		aggr_emit();
+
+	return true;
+}
+
+static bool imu_cb(const r2p::IMUMsg & msg) {
+	tlm_imu_t imu = { msg.roll, msg.pitch, msg.yaw };
+
+	odometry.imu(msg.yaw);
+
+	if (stream_imu)
+		sqPost(&streamq, TLM_TOPIC_IMU, &imu, sizeof(imu));
+
+	aggr.snap.imu = imu;
+	aggr.stamp[1] = tsNow();
+	aggr.snap.valid |= TLM_SNAPSHOT_IMU;
+
+	return true;
+}
+
+static bool proxy_cb(const r2p::ProximityMsg & msg) {
+
+	if (stream_proxy)
+		sqPost(&streamq, TLM_TOPIC_PROXIMITY, msg.value, sizeof(tlm_proximity_t));
+
+	memcpy(&aggr.snap.proximity, msg.value, sizeof(aggr.snap.proximity));
+	aggr.stamp[2] = tsNow();
+	aggr.snap.valid |= TLM_SNAPSHOT_PROXIMITY;
+
+	return true;
+}
+
+static bool latency_cb(const r2p::LatencyMsg & msg) {
+
+	latency_add(dispatch_latency, msg);
+
+	return true;
+}
+
+
+/*
+ * Subscriber dispatcher node.
+ * A single thread serves all the subscriptions: spin() sleeps on the node
+ * event until any subscriber has a message, then runs the callbacks of the
+ * subscribers with pending messages, odometry included. With periodic
+ * snapshots on, the spin timeout is the time left to the next snapshot.
  */
-msg_t encoder_sub_node(void * arg) {
-	r2p::Node node("enc_sub");
-	r2p::Subscriber<r2p::Encoder2Msg, 5> enc_sub;
-	r2p::Encoder2Msg * msgp;
+msg_t sub_dispatcher_node(void * arg) {
+	r2p::Node node("sub_disp");
+	r2p::Subscriber<r2p::Encoder2Msg, 5> enc_sub(encoder_cb);
+	r2p::Subscriber<r2p::IMUMsg, 5> imu_sub(imu_cb);
+	r2p::Subscriber<r2p::ProximityMsg, 5> proxy_sub(proxy_cb);
+	r2p::Subscriber<r2p::LatencyMsg, 2> latency_sub(latency_cb);
+	systime_t next;
 
 	(void) arg;
-	chRegSetThreadName("enc_sub");
+	chRegSetThreadName("sub_disp");
 
 	node.subscribe(enc_sub, "encoder2");
+	node.subscribe(imu_sub, "imu");
+	node.subscribe(proxy_sub, "proximity");
+	node.subscribe(latency_sub, "latency");
+	node.advertise(pose_pub, "pose", r2p::Time::INFINITE);
+
+	next = chTimeNow();
 
 	for (;;) {
-		node.spin(r2p::Time::ms(1000));
-		if (enc_sub.fetch(msgp)) {
-			if (stream_enc) {
-				chprintf((BaseSequentialStream*) serialp, "%f %f\r\n", msgp->delta[0], msgp->delta[1]);
-			}
-			enc_sub.release(*msgp);
-		} else {
-			r2p::Thread::sleep(r2p::Time::ms(1));
+		uint32_t period = aggr_period_ms;
+		int32_t left;
+
+		if (period == 0) {
+			/* Messages wake the node up anyway, the timeout only re-checks the configuration.*/
+			node.spin(r2p::Time::ms(100));
+			next = chTimeNow();
+			continue;
+		}
+
+		left = (int32_t)(next - chTimeNow());
+		if (left > 0) {
+			node.spin(r2p::Time::us(left * (1000000 / CH_FREQUENCY)));
+			continue;
+		}
+
+		aggr_emit();
+		next += MS2ST(period);
+		if ((int32_t)(next - chTimeNow()) <= 0) {
+			/* Overrun, restarting the schedule.*/
+			next = chTimeNow() + MS2ST(period);
 		}
 	}
 
@@ -256,25 +1076,24 @@ msg_t encoder_sub_node(void * arg) {
 
 
 /*
- * IMU subscriber node.
+ * Polling subscriber, the former per-topic design, only started by the
+ * "subbench poll" command for comparison.
  */
-msg_t r2p_sub_node(void * arg) {
-	r2p::Node node("tilt_sub");
-	r2p::Subscriber<r2p::IMUMsg, 5> imu_sub;
-	r2p::IMUMsg * msgp;
+msg_t latency_poll_node(void * arg) {
+	r2p::Node node("lat_poll");
+	r2p::Subscriber<r2p::LatencyMsg, 2> latency_sub;
+	r2p::LatencyMsg * msgp;
 
 	(void) arg;
-	chRegSetThreadName("imu_sub");
+	chRegSetThreadName("lat_poll");
 
-	node.subscribe(imu_sub, "imu");
+	node.subscribe(latency_sub, "latency");
 
 	for (;;) {
 		node.spin(r2p::Time::ms(1000));
-		if (imu_sub.fetch(msgp)) {
-			if (stream_imu) {
-				chprintf((BaseSequentialStream*) serialp, "%f %f %f\r\n", msgp->roll, msgp->pitch, msgp->yaw);
-			}
-			imu_sub.release(*msgp);
+		if (latency_sub.fetch(msgp)) {
+			latency_add(poll_latency, *msgp);
+			latency_sub.release(*msgp);
 		} else {
 			r2p::Thread::sleep(r2p::Time::ms(1));
 		}
@@ -285,28 +1104,61 @@ msg_t r2p_sub_node(void * arg) {
 
 
 /*
- * Proximity subscriber node.
+ * Stack usage publisher node.
  */
-msg_t proxy_sub_node(void * arg) {
-	r2p::Node node("prox_sub");
-	r2p::Subscriber<r2p::ProximityMsg, 5> proxy_sub;
-	r2p::ProximityMsg * msgp;
+struct stackinfo_conf {
+	const char * topic;
+	uint32_t period_ms;
+};
 
-	(void) arg;
-	chRegSetThreadName("proxy_sub");
+msg_t stackinfo_node(void * arg) {
+	stackinfo_conf * conf = (stackinfo_conf *) arg;
+	r2p::Node node("stackinfo");
+	r2p::Publisher<r2p::StackInfoMsg> pub;
+	r2p::StackInfoMsg * msgp;
+	StackInfo si;
+	Thread * tp;
+	unsigned count, index;
 
-	node.subscribe(proxy_sub, "proximity");
+	chRegSetThreadName("stackinfo");
+
+	node.advertise(pub, conf->topic, r2p::Time::INFINITE);
 
 	for (;;) {
-		node.spin(r2p::Time::ms(1000));
-		if (proxy_sub.fetch(msgp)) {
-			if (stream_proxy) {
-				chprintf((BaseSequentialStream*) serialp, "%5d %5d %5d %5d %5d %5d %5d %5d \r\n", msgp->value[0], msgp->value[1], msgp->value[2], msgp->value[3], msgp->value[4], msgp->value[5], msgp->value[6], msgp->value[7]);
+		count = 1;
+		tp = chRegFirstThread();
+		do {
+			count++;
+			tp = chRegNextThread(tp);
+		} while (tp != NULL);
+
+		tp = chRegFirstThread();
+		for (index = 0; index < count; index++) {
+			if (index == count - 1) {
+				stkGetExceptionInfo(&si);
+			} else if (tp != NULL) {
+				stkGetInfo(tp, &si);
+				tp = chRegNextThread(tp);
+			} else {
+				/* A thread terminated meanwhile.*/
+				continue;
 			}
-			proxy_sub.release(*msgp);
-		} else {
-			r2p::Thread::sleep(r2p::Time::ms(1));
+			if (pub.alloc(msgp)) {
+				strncpy(msgp->name, si.name ? si.name : "?", sizeof(msgp->name) - 1);
+				msgp->name[sizeof(msgp->name) - 1] = '\0';
+				msgp->size = si.size;
+				msgp->free = si.free;
+				msgp->index = index;
+				msgp->count = count;
+				pub.publish(*msgp);
+			}
+		}
+		if (tp != NULL) {
+			/* A thread was created meanwhile, dropping the registry reference.*/
+			chThdRelease(tp);
 		}
+
+		r2p::Thread::sleep(r2p::Time::ms(conf->period_ms));
 	}
 
 	return CH_SUCCESS;
@@ -329,6 +1181,21 @@ int main(void) {
 	 */
 	sduObjectInit(&SDU1);
 	sduStart(&SDU1, &serusbcfg);
+	utxObjectInit(&UTX1);
+	utxStart(&UTX1, &SDU1);
+
+	/*
+	 * Initializes the data port, streams do not share the shell queues.
+	 */
+#if USB_DATA_VENDOR
+	budObjectInit(&BUD1);
+	budStart(&BUD1, &bulkusbcfg);
+#else
+	sduObjectInit(&SDU2);
+	sduStart(&SDU2, &serusbcfg2);
+	utxObjectInit(&UTX2);
+	utxStart(&UTX2, &SDU2);
+#endif
 
 	/*
 	 * Activates the USB driver and then the USB bus pull-up on D+.
@@ -358,9 +1225,17 @@ int main(void) {
 	r2p::ledsub_conf ledsub_conf = { "led" };
 	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, r2p::ledsub_node, &ledsub_conf);
 
-	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, r2p_sub_node, NULL);
+	sqObjectInit(&streamq);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(1024), NORMALPRIO - 1, stream_writer_node, NULL);
+
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(1024), NORMALPRIO, sub_dispatcher_node, NULL);
+
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO + 1, vel_streamer.thread, &vel_streamer);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO + 2, vel_profile.thread, &vel_profile);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, command_rx_node, NULL);
 
-	vel_node.advertise(vel_pub, "speed2", r2p::Time::INFINITE);
+	static stackinfo_conf stackinfo_conf = { "stackinfo", 5000 };
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO - 1, stackinfo_node, &stackinfo_conf);
 
 	for (;;) {
 		if (!usb_shelltp && (SDU1.config->usbp->state == USB_ACTIVE))
@@ -378,6 +1253,7 @@ int main(void) {
 		 serial_shelltp = NULL;
 		 }
 		 */
+		CommandPublisherBase::idle_all();
 		r2p::Thread::sleep(r2p::Time::ms(500));
 	}
 
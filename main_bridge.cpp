@@ -0,0 +1,342 @@
+#include <stdlib.h> // atoi()
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+#include "shell.h"
+
+#include "usbcfg.h"
+#include "timesync.h"
+
+#include <r2p/Middleware.hpp>
+#include <r2p/node/led.hpp>
+
+#include "msgs.hpp"
+#include "BinaryTransport.hpp"
+
+/*
+ * USB to RTCAN bridge.
+ *
+ * The middleware runs in bridge mode with two transports, RTCAN and a
+ * binary transport on the USB data port: advertisements and subscriptions seen on
+ * one side are forwarded to the other, so a topic only crosses once the
+ * other side subscribed to it and the host sees every CAN topic without
+ * flooding the USB link with the ones it does not use. The data port goes
+ * through the packet aggregating transmitter, messages are batched into
+ * full 64 byte packets. The shell on the first port shows the link load.
+ */
+
+#if !R2P_USE_BRIDGE_MODE
+#error "The bridge needs R2P_USE_BRIDGE_MODE=1, build with APP=bridge"
+#endif
+
+#if USB_DATA_VENDOR
+#error "The bridge transport needs the CDC data port"
+#endif
+
+#ifndef R2P_MODULE_NAME
+#define R2P_MODULE_NAME "BRIDGE"
+#endif
+
+static WORKING_AREA(wa_info, 1024);
+
+/* Pending advertisements and subscriptions to forward.*/
+enum { PUBSUB_BUFFER_LENGTH = 32 };
+r2p::Middleware::PubSubStep pubsub_buf[PUBSUB_BUFFER_LENGTH];
+
+static r2p::RTCANTransport rtcantra(RTCAND1);
+
+RTCANConfig rtcan_config = { 1000000, 100, 60 };
+
+static r2p::BinaryTransport usbtra("SDU2", reinterpret_cast<BaseChannel *>(&SDU2));
+
+/*
+ * Default routes of the data port, first match wins and unlisted topics
+ * cross. The shell edits a copy in RAM.
+ */
+static const RouteConfig default_routes[] = {
+	/* topic       transport  allow  rate_hz  decimation */
+	{ "imu_raw",   "*",       false, 0,       0 },
+	{ "encoder*",  "SDU2",    true,  100,     0 },
+};
+
+enum { ROUTING_TABLE_LENGTH = 16 };
+static Route routes[ROUTING_TABLE_LENGTH];
+static RoutingTable routing(routes, ROUTING_TABLE_LENGTH);
+
+static WORKING_AREA(wa_rx_usbtra, 1024);
+static WORKING_AREA(wa_tx_usbtra, 1024);
+
+r2p::Middleware r2p::Middleware::instance(R2P_MODULE_NAME, "BOOT_"R2P_MODULE_NAME, pubsub_buf,
+		PUBSUB_BUFFER_LENGTH);
+
+/*
+ * Worst case bits of a CAN frame with 8 data bytes and bit stuffing, the
+ * bus capacity is rtcan_config.baudrate / CAN_FRAME_BITS frames per second.
+ */
+#define CAN_FRAME_BITS  135
+
+/*
+ * Load generator, started by the "load" command: publishes probes on a
+ * topic at a fixed rate so that the host can measure what crosses the
+ * bridge.
+ */
+struct LoadConf {
+	char topic[16];
+	uint32_t rate;
+	uint32_t count;
+	volatile uint32_t published;
+	volatile uint32_t dropped;
+	volatile bool running;
+};
+
+static LoadConf load_conf;
+
+msg_t load_node(void * arg) {
+	LoadConf * confp = (LoadConf *) arg;
+	r2p::Node node("bridgeload");
+	r2p::Publisher<r2p::LatencyMsg> pub;
+	r2p::LatencyMsg * msgp;
+	systime_t next = chTimeNow();
+
+	chRegSetThreadName("bridgeload");
+
+	node.advertise(pub, confp->topic, r2p::Time::INFINITE);
+
+	for (uint32_t i = 0; i < confp->count; i++) {
+		if (pub.alloc(msgp)) {
+			msgp->stamp = tsNow();
+			msgp->seq = i;
+			pub.publish(*msgp);
+			confp->published++;
+		} else {
+			confp->dropped++;
+		}
+
+		next += MS2ST(1000) / confp->rate;
+		if ((int32_t) (next - chTimeNow()) > 0)
+			chThdSleepUntil(next);
+		else
+			next = chTimeNow();
+	}
+
+	confp->running = false;
+	return CH_SUCCESS;
+}
+
+/*
+ * DP resistor control is not possible on the STM32F3-Discovery, using stubs
+ * for the connection macros.
+ */
+void usb_lld_disconnect_bus(USBDriver *usbp) {
+
+	(void)usbp;
+	palClearPort(GPIOA, (1<<GPIOA_USB_DM) | (1<<GPIOA_USB_DP));
+	palSetPadMode(GPIOA, GPIOA_USB_DM, PAL_MODE_OUTPUT_PUSHPULL);
+	palSetPadMode(GPIOA, GPIOA_USB_DP, PAL_MODE_OUTPUT_PUSHPULL);
+}
+
+void usb_lld_connect_bus(USBDriver *usbp) {
+
+	(void)usbp;
+	palClearPort(GPIOA, (1<<GPIOA_USB_DM) | (1<<GPIOA_USB_DP));
+	palSetPadMode(GPIOA, GPIOA_USB_DM, PAL_MODE_ALTERNATE(14));
+	palSetPadMode(GPIOA, GPIOA_USB_DP, PAL_MODE_ALTERNATE(14));
+}
+
+/*===========================================================================*/
+/* Command line related.                                                     */
+/*===========================================================================*/
+
+#define SHELL_WA_SIZE   THD_WA_SIZE(2048)
+
+/*
+ * Samples the data port transmitter over a window and compares the payload
+ * rate with the CAN bus capacity.
+ */
+static void cmd_bridge(BaseSequentialStream *chp, int argc, char *argv[]) {
+	uint32_t ms = (argc == 1) ? atoi(argv[0]) : 1000;
+	uint32_t packets, bytes, frames;
+	uint32_t can_frames = rtcan_config.baudrate / CAN_FRAME_BITS;
+
+	if ((argc > 1) || (ms == 0)) {
+		chprintf(chp, "Usage: bridge [<ms>]\r\n");
+		return;
+	}
+
+	chSysLock();
+	packets = UTX2.packets;
+	bytes = UTX2.bytes;
+	frames = UTX2.frames;
+	chSysUnlock();
+
+	chThdSleepMilliseconds(ms);
+
+	chSysLock();
+	packets = UTX2.packets - packets;
+	bytes = UTX2.bytes - bytes;
+	frames = UTX2.frames - frames;
+	chSysUnlock();
+
+	chprintf(chp, "USB out %lu B/s, %lu packets/s, %lu B/packet, %lu frames/s\r\n", bytes * 1000 / ms,
+			packets * 1000 / ms, packets ? bytes / packets : 0, frames * 1000 / ms);
+	chprintf(chp, "CAN %lu bit/s, at most %lu frames/s, %lu payload B/s\r\n", rtcan_config.baudrate, can_frames,
+			can_frames * 8);
+}
+
+static void cmd_load(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static Thread * load_tp = NULL;
+
+	if (argc == 0) {
+		chprintf(chp, "%s, %lu published, %lu dropped\r\n", load_conf.running ? "running" : "idle",
+				load_conf.published, load_conf.dropped);
+		return;
+	}
+
+	if ((argc != 3) || (atoi(argv[1]) <= 0) || (atoi(argv[1]) > CH_FREQUENCY) || (atoi(argv[2]) <= 0)) {
+		chprintf(chp, "Usage: load [<topic> <rate_hz, up to the tick rate> <count>]\r\n");
+		return;
+	}
+
+	if (load_conf.running) {
+		chprintf(chp, "Already running\r\n");
+		return;
+	}
+	if (load_tp != NULL) {
+		/* Recovers the memory of the previous run.*/
+		chThdWait(load_tp);
+		load_tp = NULL;
+	}
+
+	strncpy(load_conf.topic, argv[0], sizeof(load_conf.topic) - 1);
+	load_conf.topic[sizeof(load_conf.topic) - 1] = '\0';
+	load_conf.rate = atoi(argv[1]);
+	load_conf.count = atoi(argv[2]);
+	load_conf.published = 0;
+	load_conf.dropped = 0;
+	load_conf.running = true;
+
+	load_tp = chThdCreateFromHeap(NULL, THD_WA_SIZE(512), NORMALPRIO, load_node, &load_conf);
+}
+
+/*
+ * Lists the routes with their counters, or edits the table. Added routes go
+ * first, so that they override the defaults.
+ */
+static void cmd_route(BaseSequentialStream *chp, int argc, char *argv[]) {
+	bool ok = true;
+
+	if ((argc >= 4) && (argc <= 6) && (strcmp(argv[0], "add") == 0)
+			&& ((strcmp(argv[3], "allow") == 0) || (strcmp(argv[3], "deny") == 0))) {
+		chSysLock();
+		ok = routing.insert(0, argv[1], argv[2], strcmp(argv[3], "allow") == 0, (argc >= 5) ? atoi(argv[4]) : 0,
+				(argc >= 6) ? atoi(argv[5]) : 0);
+		chSysUnlock();
+	} else if ((argc == 2) && (strcmp(argv[0], "del") == 0)) {
+		chSysLock();
+		ok = routing.remove(atoi(argv[1]));
+		chSysUnlock();
+	} else if ((argc == 1) && (strcmp(argv[0], "defaults") == 0)) {
+		chSysLock();
+		routing.load(default_routes, sizeof(default_routes) / sizeof(default_routes[0]));
+		chSysUnlock();
+	} else if ((argc == 1) && (strcmp(argv[0], "clear") == 0)) {
+		chSysLock();
+		routing.clear_counters();
+		chSysUnlock();
+	} else if (argc != 0) {
+		chprintf(chp, "Usage: route [add <topic> <transport> allow|deny [<rate_hz> [<decimation>]] | del <index> |"
+				" defaults | clear]\r\n");
+		return;
+	}
+
+	if (!ok) {
+		chprintf(chp, "Failed\r\n");
+		return;
+	}
+
+	chprintf(chp, "#  topic            transport action  rate 1/N  forwarded    denied decimated   limited\r\n");
+	for (unsigned i = 0; i < routing.size(); i++) {
+		Route route;
+
+		chSysLock();
+		route = routing[i];
+		chSysUnlock();
+
+		chprintf(chp, "%-2u %-16s %-9s %-6s %5u %3u %10lu %9lu %9lu %9lu\r\n", i, route.topic, route.transport,
+				route.allow ? "allow" : "deny", route.rate_hz, route.decimation, route.forwarded, route.denied,
+				route.decimated, route.limited);
+	}
+}
+
+static const ShellCommand commands[] = { { "bridge", cmd_bridge }, { "load", cmd_load }, { "route", cmd_route }, {
+		NULL, NULL } };
+
+static const ShellConfig usb_shell_cfg = { (BaseSequentialStream *) &SDU1, commands };
+
+/*
+ * Application entry point.
+ */
+extern "C" {
+int main(void) {
+	Thread *usb_shelltp = NULL;
+
+	halInit();
+	chSysInit();
+
+	/*
+	 * Initializes the shell port and the data port, both with the packet
+	 * aggregating transmitter.
+	 */
+	sduObjectInit(&SDU1);
+	sduStart(&SDU1, &serusbcfg);
+	utxObjectInit(&UTX1);
+	utxStart(&UTX1, &SDU1);
+
+	sduObjectInit(&SDU2);
+	sduStart(&SDU2, &serusbcfg2);
+	utxObjectInit(&UTX2);
+	utxStart(&UTX2, &SDU2);
+
+	/*
+	 * Activates the USB driver and then the USB bus pull-up on D+.
+	 * Note, a delay is inserted in order to not have to disconnect the cable
+	 * after a reset.
+	 */
+	usbDisconnectBus(serusbcfg.usbp);
+	chThdSleepMilliseconds(500);
+	usbStart(serusbcfg.usbp, &usbcfg);
+	usbConnectBus(serusbcfg.usbp);
+
+	/*
+	 * Shell manager initialization.
+	 */
+	shellInit();
+
+	routing.load(default_routes, sizeof(default_routes) / sizeof(default_routes[0]));
+	usbtra.set_routing(&routing);
+
+	r2p::Middleware::instance.initialize(wa_info, sizeof(wa_info), r2p::Thread::LOWEST);
+	rtcantra.initialize(rtcan_config);
+	usbtra.initialize(wa_rx_usbtra, sizeof(wa_rx_usbtra), r2p::Thread::LOWEST + 11, wa_tx_usbtra,
+			sizeof(wa_tx_usbtra), r2p::Thread::LOWEST + 10);
+	r2p::Middleware::instance.start();
+
+	r2p::ledsub_conf ledsub_conf = { "led" };
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, r2p::ledsub_node, &ledsub_conf);
+
+	for (;;) {
+		if (!usb_shelltp && (SDU1.config->usbp->state == USB_ACTIVE))
+			usb_shelltp = shellCreate(&usb_shell_cfg, SHELL_WA_SIZE, NORMALPRIO);
+		else if (chThdTerminated(usb_shelltp)) {
+			chThdRelease(usb_shelltp); /* Recovers memory of the previous shell.   */
+			usb_shelltp = NULL; /* Triggers spawning of a new shell.        */
+		}
+
+		r2p::Thread::sleep(r2p::Time::ms(500));
+	}
+
+	return CH_SUCCESS;
+}
+}
@@ -1,4 +1,6 @@
-#include <stdint.h> // atof()
+#include <stdint.h>
+#include <stdlib.h> // atof()
+#include <string.h>
 
 #include "ch.h"
 #include "hal.h"
@@ -6,12 +8,17 @@
 #include "shell.h"
 
 #include "usbcfg.h"
+#include "top.h"
+#include "stackinfo.h"
 
 #include <r2p/Middleware.hpp>
 #include <r2p/node/led.hpp>
 #include <r2p/msg/motor.hpp>
 #include <r2p/msg/imu.hpp>
 
+#include "cmdpub.hpp"
+#include "setpoint.hpp"
+
 #define USE_USB_SERIAL 1
 
 #include <ros.h>
@@ -23,6 +30,17 @@
 #include <r2p_msgs/PidParameters.h>
 #include <r2p_msgs/Vector3_32.h>
 
+#include "rosbridge.hpp"
+
+/* Same channel selection as the rosserial hardware layer, the shell gets the other port.*/
+#if USE_USB_SERIAL
+#define ROS_CHANNEL     ((BaseAsynchronousChannel *) &SDU1)
+#define SHELL_CHANNEL   ((BaseSequentialStream *) &SD3)
+#else
+#define ROS_CHANNEL     ((BaseAsynchronousChannel *) &SD3)
+#define SHELL_CHANNEL   ((BaseSequentialStream *) &SDU1)
+#endif
+
 #ifndef R2P_MODULE_NAME
 #define R2P_MODULE_NAME "uDC"
 #endif
@@ -34,14 +52,18 @@ RTCANConfig rtcan_config = { 1000000, 100, 60 };
 
 r2p::Middleware r2p::Middleware::instance(R2P_MODULE_NAME, "BOOT_"R2P_MODULE_NAME);
 
-r2p::Node vel_node("velpub", false);
-r2p::Publisher<r2p::Velocity3Msg> vel_pub;
+CommandPublisher<r2p::Velocity3Msg> vel_pub("velpub", "velocity");
+CommandPublisher<r2p::PIDCfgMsg> balcfg_pub("balcfg", "balcfg");
+CommandPublisher<r2p::PIDCfgMsg> velcfg_pub("velcfg", "velcfg");
 
-r2p::Node balcfg_node("balcfg", false);
-r2p::Publisher<r2p::PIDCfgMsg> balcfg_pub;
+void velocity3_fill(r2p::Velocity3Msg & msg, const Setpoint & sp) {
+	msg.x = sp.x;
+	msg.y = sp.y;
+	msg.w = sp.w;
+}
 
-r2p::Node velcfg_node("velcfg", false);
-r2p::Publisher<r2p::PIDCfgMsg> velcfg_pub;
+/* Gentler limits, the balance loop has to follow.*/
+SetpointStreamer<r2p::Velocity3Msg, velocity3_fill> vel_streamer(vel_pub, 0.5f, 2.5f, 2.0f, 10.0f);
 
 ros::NodeHandle nh;
 
@@ -116,16 +138,12 @@ static void cmd_balcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	balcfg_node.set_enabled(true);
-
 	if (balcfg_pub.alloc(msgp)) {
 		msgp->k = atof(argv[0]);
 		msgp->ti = atof(argv[1]);
 		msgp->td = atof(argv[2]);
 		balcfg_pub.publish(*msgp);
 	}
-
-	balcfg_node.set_enabled(false);
 }
 
 static void cmd_velcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
@@ -138,235 +156,231 @@ static void cmd_velcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	velcfg_node.set_enabled(true);
-
 	if (velcfg_pub.alloc(msgp)) {
 		msgp->k = atof(argv[0]);
 		msgp->ti = atof(argv[1]);
 		msgp->td = atof(argv[2]);
 		velcfg_pub.publish(*msgp);
 	}
+}
+
+static void cmd_rate(BaseSequentialStream *chp, int argc, char *argv[]) {
+	RosBridgeBase * bp;
+
+	if ((argc != 0) && (argc != 3)) {
+		chprintf(chp, "Usage: rate [<topic> <min_ms> <threshold>]\r\n");
+		return;
+	}
 
-	velcfg_node.set_enabled(false);
+	if (argc == 3) {
+		bp = RosBridgeBase::find(argv[0]);
+		if (bp == NULL) {
+			chprintf(chp, "Unknown topic %s\r\n", argv[0]);
+			return;
+		}
+		bp->min_period_ms = atoi(argv[1]);
+		bp->threshold = atof(argv[2]);
+	}
+
+	chprintf(chp, "topic    min_ms  published   skipped threshold\r\n");
+	for (bp = RosBridgeBase::first(); bp != NULL; bp = bp->get_next()) {
+		chprintf(chp, "%-8s %6u %10lu %9lu %f\r\n", bp->ros_topic, bp->min_period_ms,
+				bp->published, bp->skipped, bp->threshold);
+	}
 }
 
-static const ShellCommand commands[] = { { "mem", cmd_mem }, { "threads", cmd_threads },
+static const ShellCommand commands[] = { { "mem", cmd_mem }, { "threads", cmd_threads }, { "top", cmd_top }, { "stack", cmd_stack }, { "rate", cmd_rate },
 		{ "bcfg", cmd_balcfg }, { "vcfg", cmd_velcfg }, { NULL, NULL } };
 
-static const ShellConfig usb_shell_cfg = { (BaseSequentialStream *) &SDU1, commands };
-
-static const ShellConfig serial_shell_cfg = { (BaseSequentialStream *) &SD3, commands };
+static const ShellConfig shell_cfg = { SHELL_CHANNEL, commands };
 
 /*
- * R2P subscriber node.
+ * R2P to ROS bridged topics.
+ * One line per topic: r2p type, ROS type, converter and change metric, r2p
+ * and ROS topic names, minimum period in milliseconds and change threshold.
+ * The change metric compares a new r2p message with the ROS message last
+ * published.
  */
-struct imu_data_t {
-	float roll;
-	float pitch;
-	float yaw;
-} imu_data;
-
-struct imu_raw_data_t {
-	int16_t acc_x;
-	int16_t acc_y;
-	int16_t acc_z;
-	int16_t gyro_x;
-	int16_t gyro_y;
-	int16_t gyro_z;
-	int16_t mag_x;
-	int16_t mag_y;
-	int16_t mag_z;
-} imu_raw_data;
-
-struct odometry_data_t {
-	float x;
-	float y;
-	float w;
-} odometry_data;
-
-bool imu_cb(const r2p::IMUMsg &msg) {
-
-	imu_data.roll = msg.roll;
-	imu_data.pitch = msg.pitch;
-	imu_data.yaw= msg.yaw;
-
-	return true;
+void odometry_convert(const r2p::Velocity3Msg & msg, r2p_msgs::Vector3_32 & ros_msg) {
+	ros_msg.x = msg.x;
+	ros_msg.y = msg.y;
+	ros_msg.z = msg.w;
 }
 
-bool imu_raw_cb(const r2p::IMURaw9 &msg) {
+float odometry_delta(const r2p::Velocity3Msg & msg, const r2p_msgs::Vector3_32 & ros_msg) {
+	float delta = 0.0f;
 
-	imu_raw_data.acc_x = msg.acc_x;
-	imu_raw_data.acc_y = msg.acc_y;
-	imu_raw_data.acc_z = msg.acc_z;
-	imu_raw_data.gyro_x = msg.gyro_x;
-	imu_raw_data.gyro_y = msg.gyro_y;
-	imu_raw_data.gyro_z = msg.gyro_z;
-	imu_raw_data.mag_x = msg.mag_x;
-	imu_raw_data.mag_y = msg.mag_y;
-	imu_raw_data.mag_z = msg.mag_z;
+	delta = max_delta(delta, msg.x, ros_msg.x);
+	delta = max_delta(delta, msg.y, ros_msg.y);
+	delta = max_delta(delta, msg.w, ros_msg.z);
 
-	return true;
+	return delta;
 }
 
-bool odometry_cb(const r2p::Velocity3Msg &msg) {
+void imu_convert(const r2p::IMUMsg & msg, r2p_msgs::Vector3_32 & ros_msg) {
+	ros_msg.x = msg.roll;
+	ros_msg.y = msg.pitch;
+	ros_msg.z = msg.yaw;
+}
 
-	odometry_data.x = msg.x;
-	odometry_data.y = msg.y;
-	odometry_data.w= msg.w;
+float imu_delta(const r2p::IMUMsg & msg, const r2p_msgs::Vector3_32 & ros_msg) {
+	float delta = 0.0f;
 
-	return true;
-}
+	delta = max_delta(delta, msg.roll, ros_msg.x);
+	delta = max_delta(delta, msg.pitch, ros_msg.y);
+	delta = max_delta(delta, msg.yaw, ros_msg.z);
 
-msg_t r2p_sub_node(void * arg) {
-	r2p::Node node("r2p_sub");
-	r2p::Subscriber<r2p::IMUMsg, 5> imu_sub(imu_cb);
-	r2p::Subscriber<r2p::IMURaw9, 5> imu_raw_sub(imu_raw_cb);
-	r2p::Subscriber<r2p::Velocity3Msg, 5> odometry_sub(odometry_cb);
+	return delta;
+}
 
-	(void) arg;
-	chRegSetThreadName("r2p_sub");
+void imu_raw_convert(const r2p::IMURaw9 & msg, r2p_msgs::ImuRaw & ros_msg) {
+	ros_msg.linear_acceleration.x = msg.acc_x;
+	ros_msg.linear_acceleration.y = msg.acc_y;
+	ros_msg.linear_acceleration.z = msg.acc_z;
+	ros_msg.angular_velocity.x = msg.gyro_x;
+	ros_msg.angular_velocity.y = msg.gyro_y;
+	ros_msg.angular_velocity.z = msg.gyro_z;
+	ros_msg.magnetic_field.x = msg.mag_x;
+	ros_msg.magnetic_field.y = msg.mag_y;
+	ros_msg.magnetic_field.z = msg.mag_z;
+}
 
-	node.subscribe(imu_sub, "imu");
-	node.subscribe(imu_raw_sub, "imu_raw");
-	node.subscribe(odometry_sub, "odometry");
+float imu_raw_delta(const r2p::IMURaw9 & msg, const r2p_msgs::ImuRaw & ros_msg) {
+	float delta = 0.0f;
 
-	for (;;) {
-		node.spin(r2p::Time::ms(1000));
-	}
+	delta = max_delta(delta, msg.acc_x, ros_msg.linear_acceleration.x);
+	delta = max_delta(delta, msg.acc_y, ros_msg.linear_acceleration.y);
+	delta = max_delta(delta, msg.acc_z, ros_msg.linear_acceleration.z);
+	delta = max_delta(delta, msg.gyro_x, ros_msg.angular_velocity.x);
+	delta = max_delta(delta, msg.gyro_y, ros_msg.angular_velocity.y);
+	delta = max_delta(delta, msg.gyro_z, ros_msg.angular_velocity.z);
+	delta = max_delta(delta, msg.mag_x, ros_msg.magnetic_field.x);
+	delta = max_delta(delta, msg.mag_y, ros_msg.magnetic_field.y);
+	delta = max_delta(delta, msg.mag_z, ros_msg.magnetic_field.z);
 
-	return CH_SUCCESS;
+	return delta;
 }
 
+static RosBridge<r2p::Velocity3Msg, r2p_msgs::Vector3_32, odometry_convert, odometry_delta> odometry_bridge("odometry", "odom", 10, 0.0f);
+static RosBridge<r2p::IMUMsg, r2p_msgs::Vector3_32, imu_convert, imu_delta> imu_bridge("imu", "imu", 10, 0.0f);
+static RosBridge<r2p::IMURaw9, r2p_msgs::ImuRaw, imu_raw_convert, imu_raw_delta> imu_raw_bridge("imu_raw", "imu_raw", 20, 0.0f);
+
 /*
- * ROS rosserial publisher thread.
+ * R2P subscriber node.
+ * Moves the messages of the bridged topics into their snapshots, the I/O
+ * thread never waits and never sees a torn message. New messages wake up
+ * the I/O thread, which decides whether to publish them.
  */
+#define ROS_RX_EVENT    EVENT_MASK(0)
+#define ROS_TX_EVENT    EVENT_MASK(1)
 
-float yaw = 0;
-geometry_msgs::Vector3 odom_msg;
-
-msg_t rosserial_pub_thread(void * arg) {
-	r2p_msgs::Vector3_32 odometry_msg;
-	r2p_msgs::Vector3_32 imu_msg;
-	r2p_msgs::ImuRaw imu_raw_msg;
-	ros::Publisher odometry_pub("odom", &odometry_msg);
-	ros::Publisher imu_pub("imu", &imu_msg);
-	ros::Publisher imu_raw_pub("imu_raw", &imu_raw_msg);
-	systime_t last_sample;
+static Thread * ros_io_tp = NULL;
 
-	odom_msg.x = 0.0;
-	odom_msg.y = 0.0;
-	odom_msg.z = 0.0;
+msg_t r2p_sub_node(void * arg) {
+	r2p::Node node("r2p_sub");
+	RosBridgeBase * bp;
 
 	(void) arg;
-	chRegSetThreadName("rosserial_pub");
+	chRegSetThreadName("r2p_sub");
 
-	nh.initNode();
-	nh.advertise(odometry_pub);
-	nh.advertise(imu_pub);
-	nh.advertise(imu_raw_pub);
+	for (bp = RosBridgeBase::first(); bp != NULL; bp = bp->get_next()) {
+		bp->subscribe(node);
+	}
 
 	for (;;) {
-		last_sample = chTimeNow();
-
-		odometry_msg.x = odometry_data.x;
-		odometry_msg.y = odometry_data.y;
-		odometry_msg.z = odometry_data.w;
-		odometry_pub.publish(&odometry_msg);
-
-		imu_msg.x = imu_data.roll;
-		imu_msg.y = imu_data.pitch;
-		imu_msg.z = imu_data.yaw;
-		imu_pub.publish(&imu_msg);
-
-		imu_raw_msg.linear_acceleration.x = imu_raw_data.acc_x;
-		imu_raw_msg.linear_acceleration.y = imu_raw_data.acc_y;
-		imu_raw_msg.linear_acceleration.z = imu_raw_data.acc_z;
-		imu_raw_msg.angular_velocity.x = imu_raw_data.gyro_x;
-		imu_raw_msg.angular_velocity.y = imu_raw_data.gyro_y;
-		imu_raw_msg.angular_velocity.z = imu_raw_data.gyro_z;
-		imu_raw_msg.magnetic_field.x = imu_raw_data.mag_x;
-		imu_raw_msg.magnetic_field.y = imu_raw_data.mag_y;
-		imu_raw_msg.magnetic_field.z = imu_raw_data.mag_z;
-		imu_raw_pub.publish(&imu_raw_msg);
-
-		nh.spinOnce();
+		bool fresh = false;
 
-		// Sleep for 50 milliseconds from last execution
-		chThdSleepUntil(last_sample + MS2ST(50));
+		node.spin(r2p::Time::ms(1000));
+		for (bp = RosBridgeBase::first(); bp != NULL; bp = bp->get_next()) {
+			fresh |= bp->fetch();
+		}
+		if (fresh) {
+			chEvtSignal(ros_io_tp, ROS_TX_EVENT);
+		}
 	}
 
 	return CH_SUCCESS;
 }
 
-
 /*
- * ROS rosserial subscriber thread.
+ * ROS rosserial subscriber callbacks, called by the I/O thread.
  */
 void cmd_vel_cb( const geometry_msgs::Twist& cmd_vel_msg){
-	r2p::Velocity3Msg * msgp;
+	Setpoint sp;
 
-	vel_node.set_enabled(true);
-
-	// Motor setpoints
-	if (vel_pub.alloc(msgp)) {
-		msgp->x = cmd_vel_msg.linear.x;
-		msgp->y = cmd_vel_msg.linear.y;
-		msgp->w = cmd_vel_msg.angular.z;
-		vel_pub.publish(*msgp);
-	}
-
-	vel_node.set_enabled(false);
+	sp.x = cmd_vel_msg.linear.x;
+	sp.y = cmd_vel_msg.linear.y;
+	sp.w = cmd_vel_msg.angular.z;
+	vel_streamer.set(SETPOINT_ROS, sp);
 }
 
 void balcfg_cb( const r2p_msgs::PidParameters& PID_config_msg){
 	r2p::PIDCfgMsg * msgp;
 
-	balcfg_node.set_enabled(true);
-
 	if (balcfg_pub.alloc(msgp)) {
 		msgp->k = PID_config_msg.k;
 		msgp->ti = PID_config_msg.ti;
 		msgp->td = PID_config_msg.td;
 		balcfg_pub.publish(*msgp);
 	}
-
-	balcfg_node.set_enabled(false);
-
 }
 
 void velcfg_cb( const r2p_msgs::PidParameters& PID_config_msg){
 	r2p::PIDCfgMsg * msgp;
 
-	velcfg_node.set_enabled(true);
-
 	if (velcfg_pub.alloc(msgp)) {
 		msgp->k = PID_config_msg.k;
 		msgp->ti = PID_config_msg.ti;
 		msgp->td = PID_config_msg.td;
 		velcfg_pub.publish(*msgp);
 	}
-
-	velcfg_node.set_enabled(false);
-
 }
 
-msg_t rosserial_sub_thread(void * arg) {
+/*
+ * ROS rosserial I/O thread.
+ * The only owner of the NodeHandle and of the serial channel: it sleeps until
+ * input arrives or a callback stores a new sample, bridges the samples that
+ * are due and lets spinOnce() parse the input and run the subscriber
+ * callbacks. The timeout keeps the rosserial synchronization going when idle.
+ */
+msg_t rosserial_io_thread(void * arg) {
 	ros::Subscriber<geometry_msgs::Twist> cmd_vel_sub("cmd_vel", &cmd_vel_cb );
 	ros::Subscriber<r2p_msgs::PidParameters> balcfg_sub("balcfg", balcfg_cb );
 	ros::Subscriber<r2p_msgs::PidParameters> velcfg_sub("velcfg", velcfg_cb );
+	EventListener el;
+	RosBridgeBase * bp;
+	systime_t wait = MS2ST(100);
+
 	(void) arg;
-	chRegSetThreadName("cmd_vel_sub");
+	chRegSetThreadName("rosserial_io");
 
 	nh.initNode();
+	for (bp = RosBridgeBase::first(); bp != NULL; bp = bp->get_next()) {
+		bp->advertise(nh);
+	}
 	nh.subscribe(cmd_vel_sub);
 	nh.subscribe(balcfg_sub);
 	nh.subscribe(velcfg_sub);
 
+	chEvtRegisterMask(chnGetEventSource(ROS_CHANNEL), &el, ROS_RX_EVENT);
+
 	for (;;) {
+		eventmask_t mask = chEvtWaitAnyTimeout(ROS_RX_EVENT | ROS_TX_EVENT, wait);
+		systime_t now = chTimeNow();
+
+		if (mask & ROS_RX_EVENT) {
+			chEvtGetAndClearFlags(&el);
+		}
+
+		wait = MS2ST(100);
+		for (bp = RosBridgeBase::first(); bp != NULL; bp = bp->get_next()) {
+			bp->bridge(now, wait);
+		}
+
 		nh.spinOnce();
-		chThdSleepMilliseconds(5);
 	}
 
+	chEvtUnregister(chnGetEventSource(ROS_CHANNEL), &el);
 	return CH_SUCCESS;
 }
 
@@ -375,8 +389,7 @@ msg_t rosserial_sub_thread(void * arg) {
  */
 extern "C" {
 int main(void) {
-//	Thread *usb_shelltp = NULL;
-//	Thread *serial_shelltp = NULL;
+	Thread *shelltp = NULL;
 
 	halInit();
 	chSysInit();
@@ -386,15 +399,18 @@ int main(void) {
 	 */
 	sduObjectInit(&SDU1);
 	sduStart(&SDU1, &serusbcfg);
+	utxObjectInit(&UTX1);
+	utxStart(&UTX1, &SDU1);
 
 	/*
 	 * Activates the USB driver and then the USB bus pull-up on D+.
 	 * Note, a delay is inserted in order to not have to disconnect the cable
-	 * after a reset.
+	 * after a reset. No data port here, the device only exposes the shell
+	 * function.
 	 */
 	usbDisconnectBus(serusbcfg.usbp);
 	chThdSleepMilliseconds(500);
-	usbStart(serusbcfg.usbp, &usbcfg);
+	usbStart(serusbcfg.usbp, &usbcfg_shell);
 	usbConnectBus(serusbcfg.usbp);
 
 	/* Start the serial driver. */
@@ -403,7 +419,7 @@ int main(void) {
 	/*
 	 * Shell manager initialization.
 	 */
-//	shellInit();
+	shellInit();
 
 	r2p::Middleware::instance.initialize(wa_info, sizeof(wa_info), r2p::Thread::LOWEST);
 	rtcantra.initialize(rtcan_config);
@@ -412,32 +428,23 @@ int main(void) {
 	r2p::ledsub_conf ledsub_conf = {"led"};
 	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, r2p::ledsub_node, &ledsub_conf);
 
-	r2p::Thread::create_heap(NULL, THD_WA_SIZE(1024), NORMALPRIO, r2p_sub_node, NULL);
-
-	r2p::Thread::create_heap(NULL, THD_WA_SIZE(4096), NORMALPRIO, rosserial_pub_thread, NULL);
-	r2p::Thread::create_heap(NULL, THD_WA_SIZE(2048), NORMALPRIO, rosserial_sub_thread, NULL);
+	ros_io_tp = chThdCreateFromHeap(NULL, THD_WA_SIZE(4096), NORMALPRIO, rosserial_io_thread, NULL);
 
-	balcfg_node.advertise(balcfg_pub, "balcfg", r2p::Time::INFINITE);
-	velcfg_node.advertise(velcfg_pub, "velcfg", r2p::Time::INFINITE);
-	vel_node.advertise(vel_pub, "velocity", r2p::Time::INFINITE);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(1024), NORMALPRIO, r2p_sub_node, NULL);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO + 1, vel_streamer.thread, &vel_streamer);
 
 	for (;;) {
-/*
-		if (!usb_shelltp && (SDU1.config->usbp->state == USB_ACTIVE))
-			usb_shelltp = shellCreate(&usb_shell_cfg, SHELL_WA_SIZE, NORMALPRIO);
-		else if (chThdTerminated(usb_shelltp)) {
-			chThdRelease(usb_shelltp);
-			usb_shelltp = NULL;
-		}
-*/
-/*
-		if (!serial_shelltp)
-			serial_shelltp = shellCreate(&serial_shell_cfg, SHELL_WA_SIZE, NORMALPRIO);
-		else if (chThdTerminated(serial_shelltp)) {
-			chThdRelease(serial_shelltp);
-			serial_shelltp = NULL;
+#if USE_USB_SERIAL
+		if (!shelltp)
+#else
+		if (!shelltp && (SDU1.config->usbp->state == USB_ACTIVE))
+#endif
+			shelltp = shellCreate(&shell_cfg, SHELL_WA_SIZE, NORMALPRIO);
+		else if (chThdTerminated(shelltp)) {
+			chThdRelease(shelltp); /* Recovers memory of the previous shell.   */
+			shelltp = NULL; /* Triggers spawning of a new shell.        */
 		}
-*/
+		CommandPublisherBase::idle_all();
 		r2p::Thread::sleep(r2p::Time::ms(500));
 	}
 
@@ -1,4 +1,5 @@
 #include <stdlib.h> // atof()
+#include <string.h>
 
 #include "ch.h"
 #include "hal.h"
@@ -6,10 +7,20 @@
 #include "shell.h"
 
 #include "usbcfg.h"
+#include "telemetry.h"
+#include "timesync.h"
 
 #include <r2p/Middleware.hpp>
 #include <r2p/node/led.hpp>
 #include <r2p/msg/motor.hpp>
+#include <r2p/msg/imu.hpp>
+
+#include "cmdpub.hpp"
+#include "setpoint.hpp"
+#include "kinematics.hpp"
+#include "saturation.hpp"
+#include "odometry.hpp"
+#include "msgs.hpp"
 
 #ifndef R2P_MODULE_NAME
 #define R2P_MODULE_NAME "USB"
@@ -22,16 +33,12 @@ RTCANConfig rtcan_config = { 1000000, 100, 60 };
 
 r2p::Middleware r2p::Middleware::instance(R2P_MODULE_NAME, "BOOT_"R2P_MODULE_NAME);
 
-r2p::Node vel_node("speedpub", false);
-r2p::Publisher<r2p::Speed3Msg> vel_pub;
-bool speed_first_time = true;
+CommandPublisher<r2p::Speed3Msg> vel_pub("speedpub", "speed3");
 
-r2p::Node pidcfg_node("pidcfg", false);
-r2p::Publisher<r2p::PIDCfgMsg> pidcfg_pub;
-bool pidcfg_first_time = true;
+CommandPublisher<r2p::PIDCfgMsg> pidcfg_pub("pidcfg", "pidcfg");
 
-BaseSequentialStream * serialp;
 bool stream_enc = false;
+static uint32_t stream_dropped = 0;
 
 /*
  * DP resistor control is not possible on the STM32F3-Discovery, using stubs
@@ -58,10 +65,6 @@ void usb_lld_connect_bus(USBDriver *usbp) {
 /* Kinematics.                                                               */
 /*===========================================================================*/
 
-template<typename T> static inline T clamp(T min, T value, T max) {
-	return (value < min) ? min : ((value > max) ? max : value);
-}
-
 /*
  *  //_______________________\\
  * //            x            \\
@@ -89,14 +92,13 @@ template<typename T> static inline T clamp(T min, T value, T max) {
  */
 
 // Robot parameters
-#define _L        0.160f    // Wheel distance [m]
-#define _R        0.035f    // Wheel radius [m]
+#define _L_UM     160000    // Wheel distance [um]
+#define _R_UM     35000     // Wheel radius [um]
 #define _MAX_DTH  52.0f     // Maximum wheel angular speed [rad/s]
-
-#define _m1_R     (-1.0f / _R)
-#define _mL_R     (-_L / _R)
-#define _C60_R    (0.500000000f / _R)   // cos(60°) / R
-#define _C30_R    (0.866025404f / _R)   // cos(30°) / R
+#define _MAX_ACC  1.0f      // Body acceleration [m/s^2] and jerk [m/s^3] limits
+#define _MAX_JERK 5.0f
+#define _MAX_DW   4.0f      // Body angular acceleration [rad/s^2] and jerk [rad/s^3] limits
+#define _MAX_DDW  20.0f
 
 #define _TICKS 64.0f
 #define _RATIO 29.0f
@@ -105,17 +107,72 @@ template<typename T> static inline T clamp(T min, T value, T max) {
 #define R2T(r) (_TICKS * _RATIO)/(r * 2 * _PI)
 #define T2R(t) (t / R2T)
 
-#define M2T(m) (m * _TICKS * _RATIO)/(2 * _PI * _R)
+#define M2T(m) (m * _TICKS * _RATIO)/(2 * _PI * (_R_UM / 1000000.0f))
 #define T2M(t) (t / _M2TICK)
 
+typedef Omni3Kinematics<float, _L_UM, _R_UM> Kinematics;
+
+/* Only used by the streamer thread, the shell sets the priority.*/
+WheelSaturation<Kinematics> wheel_saturation(_MAX_DTH);
+
+/*
+ * Wheel angular speeds of a body velocity setpoint, scaled as a whole into
+ * the wheel limits.
+ */
+static void wheel_speeds(WheelSaturation<Kinematics> & sat, const Setpoint & sp, float dth[Kinematics::NUM_WHEELS]) {
+	const BodyVelocity<float> v = { sp.x, sp.y, sp.w };
+
+	sat.apply(v, dth);
+}
+
+/*
+ * The motor boards take integer rad/s, rounded rather than truncated.
+ */
+static inline int16_t round_speed(float dth) {
+	return (int16_t) ((dth >= 0.0f) ? (dth + 0.5f) : (dth - 0.5f));
+}
+
+void speed3_fill(r2p::Speed3Msg & msg, const Setpoint & sp) {
+	float dth[Kinematics::NUM_WHEELS];
+
+	wheel_speeds(wheel_saturation, sp, dth);
+	msg.value[0] = round_speed(dth[0]);
+	msg.value[1] = round_speed(dth[1]);
+	msg.value[2] = round_speed(dth[2]);
+}
+
+SetpointStreamer<r2p::Speed3Msg, speed3_fill> vel_streamer(vel_pub, _MAX_ACC, _MAX_JERK, _MAX_DW, _MAX_DDW);
+
+/* Owned by the dispatcher node, the shell reads the snapshot.*/
+Odometry<Kinematics> odometry;
+static Snapshot<tlm_pose_t> pose_snapshot;
+static volatile bool odometry_reset = false;
+static float odometry_delta[Kinematics::NUM_WHEELS] = { 0.0f, 0.0f, 0.0f };
+static uint32_t odometry_last_us = 0;
+static r2p::Publisher<r2p::OdometryMsg> pose_pub;
+
 /*===========================================================================*/
 /* Command line related.                                                     */
 /*===========================================================================*/
 
 #define SHELL_WA_SIZE   THD_WA_SIZE(2048)
 
+/*
+ * Both shells write the shell setpoint mailbox, which takes a single
+ * writer: their writes are serialized.
+ */
+static MUTEX_DECL(shell_setpoint_mtx);
+
+static void shell_setpoint(const Setpoint & sp) {
+
+	chMtxLock(&shell_setpoint_mtx);
+	vel_streamer.set(SETPOINT_SHELL, sp);
+	chMtxUnlock();
+}
+
 static void cmd_run(BaseSequentialStream *chp, int argc, char *argv[]) {
-	r2p::Speed3Msg * msgp;
+	Setpoint sp;
+	float dth[3];
 
 	(void) argv;
 
@@ -124,41 +181,19 @@ static void cmd_run(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	vel_node.set_enabled(true);
-
-	if (speed_first_time) {
-		vel_node.advertise(vel_pub, "speed3", r2p::Time::INFINITE);
-		speed_first_time = false;
-	}
-
-	float x = atof(argv[0]);
-	float y = atof(argv[1]);
-	float w = atof(argv[2]);
-
-	// Wheel angular speeds
-	const float dthz123 = _mL_R * w;
-	const float dx12 = _C60_R * y;
-	const float dy12 = _C30_R * x;
-
-	float dth1 = dx12 - dy12 + dthz123;
-	float dth2 = dx12 + dy12 + dthz123;
-	float dth3 = _m1_R * y + dthz123;
-
-	// Motor setpoints
-	if (vel_pub.alloc(msgp)) {
-		msgp->value[0] = (int16_t) clamp(-_MAX_DTH, dth1, _MAX_DTH);
-		msgp->value[1] = (int16_t) clamp(-_MAX_DTH, dth2, _MAX_DTH);
-		msgp->value[2] = (int16_t) clamp(-_MAX_DTH, dth3, _MAX_DTH);
-		vel_pub.publish(*msgp);
-	}
-
-	chprintf(chp, "SETPOINT: %f %f %f\r\n", dth1, dth2, dth3);
+	sp.x = atof(argv[0]);
+	sp.y = atof(argv[1]);
+	sp.w = atof(argv[2]);
+	shell_setpoint(sp);
 
-	vel_node.set_enabled(false);
+	/* A copy, the streamer owns the counters.*/
+	WheelSaturation<Kinematics> sat = wheel_saturation;
+	wheel_speeds(sat, sp, dth);
+	chprintf(chp, "SETPOINT: %f %f %f\r\n", dth[0], dth[1], dth[2]);
 }
 
 static void cmd_stop(BaseSequentialStream *chp, int argc, char *argv[]) {
-	r2p::Speed3Msg * msgp;
+	Setpoint sp = { 0.0f, 0.0f, 0.0f };
 
 	(void) argv;
 
@@ -167,25 +202,10 @@ static void cmd_stop(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	vel_node.set_enabled(true);
-
-	if (speed_first_time) {
-		vel_node.advertise(vel_pub, "speed3", r2p::Time::INFINITE);
-		speed_first_time = false;
-	}
-
 	// Stop motors
-	if (vel_pub.alloc(msgp)) {
-		msgp->value[0] = 0;
-		msgp->value[1] = 0;
-		msgp->value[2] = 0;
-		vel_pub.publish(*msgp);
-	}
-
-	vel_node.set_enabled(false);
+	shell_setpoint(sp);
 }
 
-
 static void cmd_enc(BaseSequentialStream *chp, int argc, char *argv[]) {
 
 	(void) argv;
@@ -195,10 +215,53 @@ static void cmd_enc(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	serialp = chp;
 	stream_enc = !stream_enc;
+	chprintf(chp, "%lu lines dropped\r\n", stream_dropped);
+}
+
+static void cmd_odometry(BaseSequentialStream *chp, int argc, char *argv[]) {
+	tlm_pose_t pose;
+
+	if ((argc == 1) && (strcmp(argv[0], "reset") == 0)) {
+		odometry_reset = true;
+		return;
+	} else if ((argc == 2) && (strcmp(argv[0], "imu") == 0)) {
+		float gain = atof(argv[1]);
+
+		if ((gain < 0.0f) || (gain > 1.0f)) {
+			chprintf(chp, "IMU gain must be between 0 and 1\r\n");
+			return;
+		}
+		odometry.imu_gain = gain;
+		return;
+	} else if (argc > 0) {
+		chprintf(chp, "Usage: odom [reset|imu <gain>]\r\n");
+		return;
+	}
+
+	pose_snapshot.read(pose);
+	chprintf(chp, "pose %f %f %f, twist %f %f %f\r\n", pose.x, pose.y, pose.theta, pose.vx, pose.vy, pose.w);
+	chprintf(chp, "samples %lu, IMU gain %f\r\n", odometry.samples, odometry.imu_gain);
 }
 
+static void cmd_saturation(BaseSequentialStream *chp, int argc, char *argv[]) {
+	static const char * const priorities[] = { "uniform", "rotation", "translation" };
+
+	if (argc == 0) {
+		chprintf(chp, "max %f rad/s, %s first, %lu saturated\r\n", wheel_saturation.max_dth,
+				priorities[wheel_saturation.priority], wheel_saturation.saturations);
+		return;
+	}
+
+	for (unsigned i = 0; i < sizeof(priorities) / sizeof(priorities[0]); i++) {
+		if ((argc == 1) && (strcmp(argv[0], priorities[i]) == 0)) {
+			wheel_saturation.priority = (SaturationPriority) i;
+			return;
+		}
+	}
+
+	chprintf(chp, "Usage: sat [uniform|rotation|translation]\r\n");
+}
 
 static void cmd_pidcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
 	r2p::PIDCfgMsg * msgp;
@@ -210,24 +273,15 @@ static void cmd_pidcfg(BaseSequentialStream *chp, int argc, char *argv[]) {
 		return;
 	}
 
-	pidcfg_node.set_enabled(true);
-
-	if (pidcfg_first_time) {
-		pidcfg_node.advertise(pidcfg_pub, "pidcfg", r2p::Time::INFINITE);
-		pidcfg_first_time = false;
-	}
-
 	if (pidcfg_pub.alloc(msgp)) {
 		msgp->k = atof(argv[0]);
 		msgp->ti = atof(argv[1]);
 		msgp->td = atof(argv[2]);
 		pidcfg_pub.publish(*msgp);
 	}
-
-	pidcfg_node.set_enabled(false);
 }
 
-static const ShellCommand commands[] = { { "r", cmd_run }, { "s", cmd_stop }, { "e", cmd_enc }, { "pidcfg", cmd_pidcfg}, { NULL, NULL } };
+static const ShellCommand commands[] = { { "r", cmd_run }, { "s", cmd_stop }, { "e", cmd_enc }, { "odom", cmd_odometry }, { "sat", cmd_saturation }, { "pidcfg", cmd_pidcfg}, { NULL, NULL } };
 
 static const ShellConfig usb_shell_cfg = { (BaseSequentialStream *) &SDU1, commands };
 
@@ -235,28 +289,125 @@ static const ShellConfig serial_shell_cfg = { (BaseSequentialStream *) &SD3, com
 
 
 /*
- * Encoder subscriber node.
+ * Integrates the accumulated encoder increments through the forward
+ * kinematics, fusing the IMU yaw if enabled, and publishes the pose and
+ * twist on "pose".
+ */
+static void odometry_update(void) {
+	uint32_t now = tsNow();
+	r2p::OdometryMsg * msgp;
+	tlm_pose_t pose;
+
+	if (odometry_reset) {
+		odometry_reset = false;
+		odometry.reset();
+		odometry_last_us = 0;
+	}
+	odometry.update(odometry_delta, (odometry_last_us != 0) ? (now - odometry_last_us) * 1e-6f : 0.0f);
+	odometry_last_us = now;
+	for (unsigned i = 0; i < Kinematics::NUM_WHEELS; i++)
+		odometry_delta[i] = 0.0f;
+
+	pose.x = odometry.pose.x;
+	pose.y = odometry.pose.y;
+	pose.theta = odometry.pose.theta;
+	pose.vx = odometry.twist.x;
+	pose.vy = odometry.twist.y;
+	pose.w = odometry.twist.w;
+	pose_snapshot.write(pose);
+
+	if (pose_pub.alloc(msgp)) {
+		msgp->x = pose.x;
+		msgp->y = pose.y;
+		msgp->theta = pose.theta;
+		msgp->vx = pose.vx;
+		msgp->vy = pose.vy;
+		msgp->w = pose.w;
+		pose_pub.publish(*msgp);
+	}
+}
+
+/*
+ * Writes a text line to the data port only if it fits in the output queue
+ * as a whole, the dispatcher never waits on a host that stopped reading.
+ */
+static void stream_line(const char * linep, size_t n) {
+	bool fits;
+
+	chSysLock();
+	fits = (chOQGetEmptyI(&SDU2.oqueue) >= n);
+	chSysUnlock();
+
+	if (fits)
+		chnWriteTimeout((BaseChannel *) &SDU2, (const uint8_t *) linep, n, TIME_IMMEDIATE);
+	else
+		stream_dropped++;
+}
+
+/*
+ * Subscriber callbacks, run by the dispatcher node. The three encoders
+ * publish on their own topics at the same rate: the increments are
+ * accumulated and integrated on each encoder1 sample.
  */
-msg_t encoder_sub_node(void * arg) {
-	r2p::Node node("enc1_sub");
-	r2p::Subscriber<r2p::EncoderMsg, 5> enc_sub;
-	r2p::EncoderMsg * msgp;
+static bool encoder1_cb(const r2p::EncoderMsg & msg) {
+
+	if (stream_enc) {
+		char line[24];
+		int n = chsnprintf(line, sizeof(line), "%f\r\n", msg.delta * 50); // delta_rad to rad/s
+
+		stream_line(line, ((size_t) n < sizeof(line)) ? n : sizeof(line) - 1);
+	}
+	odometry_delta[0] += msg.delta;
+	odometry_update();
+
+	return true;
+}
+
+static bool encoder2_cb(const r2p::EncoderMsg & msg) {
+
+	odometry_delta[1] += msg.delta;
+
+	return true;
+}
+
+static bool encoder3_cb(const r2p::EncoderMsg & msg) {
+
+	odometry_delta[2] += msg.delta;
+
+	return true;
+}
+
+static bool imu_cb(const r2p::IMUMsg & msg) {
+
+	odometry.imu(msg.yaw);
+
+	return true;
+}
+
+/*
+ * Subscriber dispatcher node.
+ * A single thread serves all the subscriptions: spin() sleeps on the node
+ * event until any subscriber has a message, then runs the callbacks of the
+ * subscribers with pending messages.
+ */
+msg_t sub_dispatcher_node(void * arg) {
+	r2p::Node node("sub_disp");
+	r2p::Subscriber<r2p::EncoderMsg, 5> enc1_sub(encoder1_cb);
+	r2p::Subscriber<r2p::EncoderMsg, 5> enc2_sub(encoder2_cb);
+	r2p::Subscriber<r2p::EncoderMsg, 5> enc3_sub(encoder3_cb);
+	r2p::Subscriber<r2p::IMUMsg, 5> imu_sub(imu_cb);
 
 	(void) arg;
-	chRegSetThreadName("enc_sub");
+	chRegSetThreadName("sub_disp");
 
-	node.subscribe(enc_sub, "encoder1");
+	node.subscribe(enc1_sub, "encoder1");
+	node.subscribe(enc2_sub, "encoder2");
+	node.subscribe(enc3_sub, "encoder3");
+	node.subscribe(imu_sub, "imu");
+	node.advertise(pose_pub, "pose", r2p::Time::INFINITE);
 
 	for (;;) {
-		node.spin(r2p::Time::ms(1000));
-		if (enc_sub.fetch(msgp)) {
-			if (stream_enc) {
-				chprintf((BaseSequentialStream*) serialp, "%f\r\n", msgp->delta * 50); // delta_rad to rad/s
-			}
-			enc_sub.release(*msgp);
-		} else {
-			r2p::Thread::sleep(r2p::Time::ms(1));
-		}
+		node.spin(r2p::Time::ms(100));
 	}
 
 	return CH_SUCCESS;
@@ -278,6 +429,16 @@ int main(void) {
 	 */
 	sduObjectInit(&SDU1);
 	sduStart(&SDU1, &serusbcfg);
+	utxObjectInit(&UTX1);
+	utxStart(&UTX1, &SDU1);
+
+	/*
+	 * Initializes the data port, streams do not share the shell queues.
+	 */
+	sduObjectInit(&SDU2);
+	sduStart(&SDU2, &serusbcfg2);
+	utxObjectInit(&UTX2);
+	utxStart(&UTX2, &SDU2);
 
 	/*
 	 * Activates the USB driver and then the USB bus pull-up on D+.
@@ -307,7 +468,8 @@ int main(void) {
 	r2p::ledsub_conf ledsub_conf = { "led" };
 	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO, r2p::ledsub_node, &ledsub_conf);
 
-	r2p::Thread::create_heap(NULL, THD_WA_SIZE(1024), NORMALPRIO, encoder_sub_node, NULL);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(1024), NORMALPRIO + 1, sub_dispatcher_node, NULL);
+	r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO + 1, vel_streamer.thread, &vel_streamer);
 
 	for (;;) {
 		if (!usb_shelltp && (SDU1.config->usbp->state == USB_ACTIVE))
@@ -324,6 +486,7 @@ int main(void) {
 			serial_shelltp = NULL;
 		}
 
+		CommandPublisherBase::idle_all();
 		r2p::Thread::sleep(r2p::Time::ms(500));
 	}
 
@@ -113,6 +113,13 @@ CSRC = $(PORTSRC) \
        $(MODULE_PATH)/board.c \
        $(MODULE_PATH)/stubs.c \
        $(MODULE_PATH)/usbcfg.c \
+       $(MODULE_PATH)/usbtx.c \
+       $(MODULE_PATH)/bulkusb.c \
+       $(MODULE_PATH)/telemetry.c \
+       $(MODULE_PATH)/streamq.c \
+       $(MODULE_PATH)/timesync.c \
+       $(MODULE_PATH)/top.c \
+       $(MODULE_PATH)/stackinfo.c \
        $(PACKAGES_CSRC) \
        $(PRJ_CSRC)
 
@@ -227,7 +234,8 @@ DLIBS =
 #
 
 # List all user C define here, like -D_DEBUG=1
-UDEFS += -DR2P_ITERATE_PUBSUB=1 -DR2P_USE_BRIDGE_MODE=0 -DR2P_USE_BOOTLOADER=0 #-DR2P_ASSERT=""
+R2P_USE_BRIDGE_MODE ?= 0
+UDEFS += -DR2P_ITERATE_PUBSUB=1 -DR2P_USE_BRIDGE_MODE=$(R2P_USE_BRIDGE_MODE) -DR2P_USE_BOOTLOADER=0 #-DR2P_ASSERT=""
 
 # Define ASM defines here
 UADEFS +=
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <r2p/Middleware.hpp>
+
+/*
+ * Messages published by the module itself.
+ */
+
+namespace r2p {
+
+/*
+ * Stack usage of one thread, see stackinfo.h. A report is a burst of
+ * messages with index 0 .. count - 1, the exceptions stack being the last
+ * one. A zero size means unknown.
+ */
+class StackInfoMsg: public Message {
+public:
+	char name[12];
+	uint16_t size;
+	uint16_t free;
+	uint8_t index;
+	uint8_t count;
+} R2P_PACKED;
+
+/*
+ * Wheel odometry, pose in the odometry frame [m, rad] and body twist
+ * [m/s, rad/s], published at the encoder rate.
+ */
+class OdometryMsg: public Message {
+public:
+	float x;
+	float y;
+	float theta;
+	float vx;
+	float vy;
+	float w;
+} R2P_PACKED;
+
+/*
+ * Dispatch latency probe, stamped with the module time in microseconds when
+ * published.
+ */
+class LatencyMsg: public Message {
+public:
+	uint32_t stamp;
+	uint32_t seq;
+} R2P_PACKED;
+
+}
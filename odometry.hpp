@@ -0,0 +1,109 @@
+#pragma once
+
+#include <math.h>
+
+#include "kinematics.hpp"
+
+/*
+ * Planar pose in the odometry frame: position [m] and heading [rad].
+ */
+struct Pose {
+	float x;
+	float y;
+	float theta;
+};
+
+/*
+ * Wheel odometry integrator.
+ *
+ * update() takes the wheel angle increments [rad] of one encoder sample,
+ * maps them through the forward kinematics to the body displacement and
+ * integrates it at the mid-sample heading, which keeps the error of an arc
+ * second order in the heading change. The twist is the displacement over
+ * the sample period.
+ *
+ * The IMU yaw [rad], fed with imu(), is optionally fused with a
+ * complementary filter: every sample the heading moves imu_gain of the way
+ * towards the IMU heading, so slip and wheel radius errors do not
+ * accumulate while the encoders still filter the IMU noise. 0 is encoders
+ * only, the IMU heading is aligned to the odometry one the first time it is
+ * seen after a reset.
+ *
+ * No ChibiOS dependency, the class is also used by the host tools.
+ */
+template<typename Kinematics>
+class Odometry {
+private:
+	float yaw_origin;
+	float imu_theta;
+	bool imu_valid;
+
+	static float wrap(float angle) {
+		while (angle > (float) M_PI)
+			angle -= 2.0f * (float) M_PI;
+		while (angle < -(float) M_PI)
+			angle += 2.0f * (float) M_PI;
+		return angle;
+	}
+
+public:
+	static const unsigned NUM_WHEELS = Kinematics::NUM_WHEELS;
+
+	Pose pose;
+	BodyVelocity<float> twist;
+	float imu_gain;
+	uint32_t samples;
+
+	Odometry(float imu_gain = 0.0f) :
+			imu_gain(imu_gain) {
+		reset();
+	}
+
+	void reset(float x = 0.0f, float y = 0.0f, float theta = 0.0f) {
+		pose.x = x;
+		pose.y = y;
+		pose.theta = theta;
+		twist.x = twist.y = twist.w = 0.0f;
+		yaw_origin = 0.0f;
+		imu_theta = 0.0f;
+		imu_valid = false;
+		samples = 0;
+	}
+
+	void imu(float yaw) {
+		if (!imu_valid) {
+			yaw_origin = yaw - pose.theta;
+			imu_valid = true;
+		}
+		imu_theta = wrap(yaw - yaw_origin);
+	}
+
+	/*
+	 * Integrates one encoder sample, dt is its period in seconds; the twist
+	 * is not updated if it is not positive.
+	 */
+	void update(const float delta[NUM_WHEELS], float dt) {
+		BodyVelocity<float> d;
+		float dtheta, heading, c, s;
+
+		Kinematics::forward(delta, d);
+
+		dtheta = d.w;
+		if (imu_valid && (imu_gain > 0.0f))
+			dtheta += imu_gain * wrap(imu_theta - (pose.theta + dtheta));
+
+		heading = pose.theta + 0.5f * dtheta;
+		c = cosf(heading);
+		s = sinf(heading);
+		pose.x += d.x * c - d.y * s;
+		pose.y += d.x * s + d.y * c;
+		pose.theta = wrap(pose.theta + dtheta);
+
+		if (dt > 0.0f) {
+			twist.x = d.x / dt;
+			twist.y = d.y / dt;
+			twist.w = dtheta / dt;
+		}
+		samples++;
+	}
+};
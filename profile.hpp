@@ -0,0 +1,266 @@
+#pragma once
+
+#include <ch.h>
+#include <hal.h>
+
+#include "timesync.h"
+#include "setpoint.hpp"
+
+#define PROFILE_MAX_POINTS      128
+
+/*
+ * Point of a velocity profile, time from the start of the playback in
+ * microseconds.
+ */
+struct ProfilePoint {
+	uint32_t t_us;
+	Setpoint sp;
+};
+
+enum ProfileState {
+	PROFILE_IDLE, PROFILE_PLAYING, PROFILE_PAUSED, PROFILE_DONE, PROFILE_ABORTED
+};
+
+/*
+ * Velocity profile player.
+ *
+ * A profile is uploaded point by point into the on-module buffer, then
+ * played back by a real time thread: it sleeps until the last system tick
+ * before each point is due and spins on the microsecond clock for the rest
+ * of that tick only, so every setpoint is published within a few
+ * microseconds of its time without starving the lower priority threads,
+ * whatever the host latency. The streamer target is taken over during the
+ * playback: each point becomes the target at its time and a first limited
+ * step towards it is published at once, then the streamer follows within
+ * the acceleration and jerk limits. The actual publish time of each point
+ * is recorded for the report.
+ *
+ * Pausing and aborting hand the target back to the streamer with a zero
+ * setpoint, so the robot stops within the trajectory limits. A paused
+ * playback resumes with the next point, shifted by the pause duration, and
+ * ramps up to it within the limits too.
+ *
+ * The thread is started with:
+ *
+ *   r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO + 2, player.thread, &player);
+ */
+template<typename Streamer>
+class ProfilePlayer {
+private:
+	Streamer & streamer;
+	Thread * volatile tp;
+	volatile bool pause_request;
+	volatile bool abort_request;
+	Mutex points_mtx;
+
+	static const eventmask_t CTRL_EVENT = EVENT_MASK(0);
+	static const uint32_t US_PER_TICK = 1000000 / CH_FREQUENCY;
+
+	/*
+	 * Waits until the microsecond clock reaches due, returns false if a
+	 * pause or an abort was requested meanwhile. The thread sleeps up to the
+	 * last tick boundary before due, the timeout of n ticks expiring on the
+	 * n-th tick interrupt, and spins less than a tick.
+	 */
+	bool wait_until(uint32_t due) {
+		for (;;) {
+			uint32_t now_us;
+			systime_t now;
+			int32_t left;
+			systime_t ticks;
+
+			chSysLock();
+			now_us = tsNowI();
+			now = chTimeNow();
+			chSysUnlock();
+
+			left = (int32_t) (due - now_us);
+			if (left <= 0)
+				return true;
+
+			/* The module time is the tick count extended by the phase within the tick.*/
+			ticks = (systime_t) ((left + (now_us - (uint32_t) now * US_PER_TICK)) / US_PER_TICK);
+			if (ticks == 0)
+				break;
+
+			chEvtWaitAnyTimeout(CTRL_EVENT, ticks);
+			if (pause_request || abort_request)
+				return false;
+		}
+		while ((int32_t) (due - tsNow()) > 0)
+			;
+		return true;
+	}
+
+public:
+	ProfilePoint points[PROFILE_MAX_POINTS];
+	uint32_t actual_us[PROFILE_MAX_POINTS];
+	volatile uint16_t count;
+	volatile uint16_t played;
+	volatile ProfileState state;
+
+	ProfilePlayer(Streamer & streamer) :
+			streamer(streamer), tp(NULL), pause_request(false), abort_request(false), count(0), played(0),
+			state(PROFILE_IDLE) {
+		chMtxInit(&points_mtx);
+	}
+
+	/*
+	 * Stores a point, index 0 starts a new profile. Points must come in
+	 * order with increasing times, returns false otherwise or while playing.
+	 * The shell and the command receiver both upload points, uploads and
+	 * play() are serialized by a mutex.
+	 */
+	bool put(uint16_t index, const ProfilePoint & point) {
+		bool stored = false;
+
+		chMtxLock(&points_mtx);
+		if ((state != PROFILE_PLAYING) && (state != PROFILE_PAUSED) && (index < PROFILE_MAX_POINTS)
+				&& (index <= count) && ((index == 0) || (point.t_us >= points[index - 1].t_us))) {
+			points[index] = point;
+			count = index + 1;
+			played = 0;
+			state = PROFILE_IDLE;
+			stored = true;
+		}
+		chMtxUnlock();
+		return stored;
+	}
+
+	/*
+	 * Drops the uploaded profile, returns false while playing.
+	 */
+	bool clear() {
+		bool cleared = false;
+
+		chMtxLock(&points_mtx);
+		if ((state != PROFILE_PLAYING) && (state != PROFILE_PAUSED)) {
+			count = 0;
+			played = 0;
+			cleared = true;
+		}
+		chMtxUnlock();
+		return cleared;
+	}
+
+	/*
+	 * The requests and the state are changed with the system locked and the
+	 * player is signaled in the same critical section, the event stays
+	 * pending until it waits. A resume cancels a pause whether or not the
+	 * player has stopped yet.
+	 */
+	bool play() {
+		bool started = false;
+
+		chMtxLock(&points_mtx);
+		chSysLock();
+		if ((count > 0) && (state != PROFILE_PLAYING) && (state != PROFILE_PAUSED) && (tp != NULL)) {
+			pause_request = false;
+			abort_request = false;
+			state = PROFILE_PLAYING;
+			chEvtSignalI(tp, CTRL_EVENT);
+			started = true;
+		}
+		chSysUnlock();
+		chMtxUnlock();
+		return started;
+	}
+
+	void pause() {
+		chSysLock();
+		if (state == PROFILE_PLAYING) {
+			pause_request = true;
+			chEvtSignalI(tp, CTRL_EVENT);
+		}
+		chSysUnlock();
+	}
+
+	void resume() {
+		chSysLock();
+		if (pause_request) {
+			pause_request = false;
+			chEvtSignalI(tp, CTRL_EVENT);
+		}
+		chSysUnlock();
+	}
+
+	void abort() {
+		chSysLock();
+		if ((state == PROFILE_PLAYING) || (state == PROFILE_PAUSED)) {
+			abort_request = true;
+			chEvtSignalI(tp, CTRL_EVENT);
+		}
+		chSysUnlock();
+	}
+
+	msg_t run() {
+		const Setpoint zero = { 0.0f, 0.0f, 0.0f };
+
+		tp = chThdSelf();
+
+		for (;;) {
+			uint32_t start_us;
+			uint16_t i;
+
+			while (state != PROFILE_PLAYING)
+				chEvtWaitAny(CTRL_EVENT);
+
+			/* A short lead so the first point is on time too.*/
+			start_us = tsNow() + 2000;
+			streamer.acquire();
+
+			i = 0;
+			while (i < count) {
+				if (!wait_until(start_us + points[i].t_us)) {
+					if (abort_request)
+						break;
+					if (!pause_request)
+						continue; /* Resumed before the pause took effect.*/
+
+					/* Paused, the robot stops and the timeline is shifted.*/
+					uint32_t paused_us = tsNow();
+
+					streamer.release(zero);
+					chSysLock();
+					state = PROFILE_PAUSED;
+					chSysUnlock();
+					while (pause_request && !abort_request)
+						chEvtWaitAny(CTRL_EVENT);
+					if (abort_request)
+						break;
+					chSysLock();
+					state = PROFILE_PLAYING;
+					chSysUnlock();
+					streamer.acquire();
+					start_us += tsNow() - paused_us;
+					continue;
+				}
+
+				actual_us[i] = tsNow() - start_us;
+				streamer.publish_target(points[i].sp);
+				played = ++i;
+			}
+
+			if (i < count) {
+				streamer.release(zero);
+				chSysLock();
+				state = PROFILE_ABORTED;
+				chSysUnlock();
+			} else {
+				streamer.release(points[count - 1].sp);
+				chSysLock();
+				state = PROFILE_DONE;
+				chSysUnlock();
+			}
+		}
+
+		return CH_SUCCESS;
+	}
+
+	static msg_t thread(void * arg) {
+		ProfilePlayer * playerp = reinterpret_cast<ProfilePlayer *>(arg);
+
+		chRegSetThreadName("profile");
+		return playerp->run();
+	}
+};
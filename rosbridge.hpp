@@ -0,0 +1,186 @@
+#pragma once
+
+#include <string.h>
+
+#include <ch.h>
+
+#include <r2p/Middleware.hpp>
+#include <ros.h>
+
+#include "snapshot.hpp"
+
+/*
+ * Generic r2p to rosserial topic bridge.
+ *
+ * Each bridged topic is one static RosBridge object, it registers itself on
+ * construction so the r2p subscriber node and the rosserial I/O thread only
+ * walk the list:
+ *
+ *   static RosBridge<r2p::IMUMsg, r2p_msgs::Vector3_32, imu_convert, imu_delta>
+ *          imu_bridge("imu", "imu", 10, 0.0f);
+ *
+ * The r2p node fetches the messages straight into a snapshot of the r2p
+ * type, which keeps two copies of each. The I/O thread reads the latest one
+ * only when the snapshot sequence changed and converts it into the ROS
+ * message it owns. That ROS message is also the last published value the
+ * change metric compares with, so no other copy is kept. The converter and
+ * the change metric are template arguments, so they are inlined as in hand
+ * written code, and the only indirection is one virtual call per topic.
+ *
+ * A new message is published at most once every min_period_ms and only if
+ * the change metric from the last published message exceeds threshold. A
+ * rate limited message is published as soon as its period expires.
+ */
+class RosBridgeBase {
+private:
+	RosBridgeBase * next;
+
+protected:
+	uint32_t seq;
+	systime_t last_pub;
+
+	static RosBridgeBase *& head() {
+		static RosBridgeBase * headp = NULL;
+		return headp;
+	}
+
+	/*
+	 * Checks whether the topic may publish now, otherwise shortens the wait
+	 * of the I/O thread to the end of its period.
+	 */
+	bool due(systime_t now, systime_t & wait) const {
+		systime_t elapsed = now - last_pub;
+
+		if ((published == 0) || (elapsed >= MS2ST(min_period_ms)))
+			return true;
+		if (MS2ST(min_period_ms) - elapsed < wait)
+			wait = MS2ST(min_period_ms) - elapsed;
+		return false;
+	}
+
+	/*
+	 * Marks a new message as consumed, returns whether it changed enough to
+	 * be published.
+	 */
+	bool changed(uint32_t s, float delta, systime_t now) {
+		seq = s;
+		if ((published > 0) && (delta <= threshold)) {
+			skipped++;
+			return false;
+		}
+		last_pub = now;
+		published++;
+		return true;
+	}
+
+public:
+	const char * const r2p_topic;
+	const char * const ros_topic;
+	uint16_t min_period_ms;
+	float threshold;
+	uint32_t published;
+	uint32_t skipped;
+
+	RosBridgeBase(const char * r2p_topic, const char * ros_topic, uint16_t min_period_ms, float threshold) :
+			next(NULL), seq(0), last_pub(0), r2p_topic(r2p_topic), ros_topic(ros_topic),
+			min_period_ms(min_period_ms), threshold(threshold), published(0), skipped(0) {
+		RosBridgeBase ** pp = &head();
+
+		while (*pp != NULL)
+			pp = &(*pp)->next;
+		*pp = this;
+	}
+
+	static RosBridgeBase * first() {
+		return head();
+	}
+
+	RosBridgeBase * get_next() const {
+		return next;
+	}
+
+	static RosBridgeBase * find(const char * ros_topic) {
+		for (RosBridgeBase * bp = head(); bp != NULL; bp = bp->next) {
+			if (strcmp(bp->ros_topic, ros_topic) == 0)
+				return bp;
+		}
+		return NULL;
+	}
+
+	/* Called by the r2p subscriber node.*/
+	virtual void subscribe(r2p::Node & node) = 0;
+	virtual bool fetch() = 0;
+
+	/* Called by the rosserial I/O thread.*/
+	virtual void advertise(ros::NodeHandle & nh) = 0;
+	virtual void bridge(systime_t now, systime_t & wait) = 0;
+};
+
+
+/*
+ * Largest of delta and of the absolute difference between a and b, builds a
+ * change metric one field at a time. r2p messages are packed, fields are
+ * passed by value rather than through pointers.
+ */
+static inline float max_delta(float delta, float a, float b) {
+	float d = (a > b) ? (a - b) : (b - a);
+
+	return (d > delta) ? d : delta;
+}
+
+
+template<typename R2PMsg, typename RosMsg,
+		void (*convert)(const R2PMsg &, RosMsg &),
+		float (*delta)(const R2PMsg &, const RosMsg &)>
+class RosBridge : public RosBridgeBase {
+private:
+	r2p::Subscriber<R2PMsg, 5> sub;
+	Snapshot<R2PMsg> latest;
+	RosMsg ros_msg;
+	ros::Publisher pub;
+
+public:
+	RosBridge(const char * r2p_topic, const char * ros_topic, uint16_t min_period_ms, float threshold) :
+			RosBridgeBase(r2p_topic, ros_topic, min_period_ms, threshold), pub(ros_topic, &ros_msg) {
+	}
+
+	void subscribe(r2p::Node & node) {
+		node.subscribe(sub, r2p_topic);
+	}
+
+	/*
+	 * Moves the queued messages into the snapshot, returns whether there
+	 * was any.
+	 */
+	bool fetch() {
+		R2PMsg * msgp;
+		bool fresh = false;
+
+		while (sub.fetch(msgp)) {
+			latest.write(*msgp);
+			sub.release(*msgp);
+			fresh = true;
+		}
+
+		return fresh;
+	}
+
+	void advertise(ros::NodeHandle & nh) {
+		nh.advertise(pub);
+	}
+
+	void bridge(systime_t now, systime_t & wait) {
+		R2PMsg msg;
+		uint32_t s;
+
+		if ((latest.sequence() == seq) || !due(now, wait))
+			return;
+
+		s = latest.read(msg);
+		if (!changed(s, (published > 0) ? delta(msg, ros_msg) : 0.0f, now))
+			return;
+
+		convert(msg, ros_msg);
+		pub.publish(&ros_msg);
+	}
+};
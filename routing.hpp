@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Topic routing table of a transport.
+ *
+ * Each route matches a topic, exactly or by prefix with a trailing '*', on
+ * a transport, by name or any with "*". The first matching route decides:
+ * a denied topic is not advertised, subscribed or forwarded on the
+ * transport, an allowed one is forwarded one message out of decimation
+ * (0 and 1 forward all) and at most rate_hz messages per second (0 is
+ * unlimited). Topics without a route cross as before.
+ *
+ * The decimation phase and the rate limiter are kept by the user in a
+ * RouteState, one per topic and direction, so that the topics matching a
+ * wildcard route each get the full rate and traffic in one direction does
+ * not use the budget of the other. The route only keeps the counters.
+ *
+ * The defaults are a const table in flash, copied into a RAM buffer that
+ * the shell edits at runtime. Editing bumps the generation, so that the
+ * states look their route up again. The table does not lock: the firmware
+ * calls it with the system locked.
+ *
+ * No ChibiOS dependency, the class is also used by the host tools.
+ */
+
+enum {
+	ROUTE_TOPIC_LENGTH = 16, ROUTE_TRANSPORT_LENGTH = 8
+};
+
+struct RouteConfig {
+	const char * topic;
+	const char * transport;
+	bool allow;
+	uint16_t rate_hz;
+	uint16_t decimation;
+};
+
+struct Route {
+	char topic[ROUTE_TOPIC_LENGTH];
+	char transport[ROUTE_TRANSPORT_LENGTH];
+	bool allow;
+	uint16_t rate_hz;
+	uint16_t decimation;
+
+	/* Counters.*/
+	uint32_t forwarded;
+	uint32_t denied;
+	uint32_t decimated;
+	uint32_t limited;
+};
+
+/*
+ * Route of one topic in one direction, with its limiter state.
+ */
+struct RouteState {
+	int route;
+	uint32_t generation;
+	uint32_t phase;
+	uint32_t next_us;
+	bool started;
+
+	RouteState() :
+			route(-1), generation(0), phase(0), next_us(0), started(false) {
+	}
+};
+
+class RoutingTable {
+private:
+	Route * routes;
+	unsigned capacity;
+	unsigned length;
+
+	static bool match(const char * pattern, const char * name) {
+		size_t n = strlen(pattern);
+
+		if ((n > 0) && (pattern[n - 1] == '*'))
+			return strncmp(pattern, name, n - 1) == 0;
+		return strcmp(pattern, name) == 0;
+	}
+
+	static void copy(char * dstp, const char * srcp, size_t size) {
+		strncpy(dstp, srcp, size - 1);
+		dstp[size - 1] = '\0';
+	}
+
+public:
+	uint32_t generation;
+
+	RoutingTable(Route * routes, unsigned capacity) :
+			routes(routes), capacity(capacity), length(0), generation(1) {
+	}
+
+	unsigned size() const {
+		return length;
+	}
+
+	const Route & operator[](unsigned index) const {
+		return routes[index];
+	}
+
+	/*
+	 * Replaces the routes with a default table.
+	 */
+	void load(const RouteConfig * configs, unsigned count) {
+		length = 0;
+		for (unsigned i = 0; (i < count) && (i < capacity); i++)
+			insert(length, configs[i].topic, configs[i].transport, configs[i].allow, configs[i].rate_hz,
+					configs[i].decimation);
+		generation++;
+	}
+
+	/*
+	 * Inserts a route before index, false if the table is full.
+	 */
+	bool insert(unsigned index, const char * topic, const char * transport, bool allow, uint16_t rate_hz = 0,
+			uint16_t decimation = 0) {
+		Route * routep;
+
+		if ((length >= capacity) || (index > length))
+			return false;
+
+		memmove(&routes[index + 1], &routes[index], (length - index) * sizeof(Route));
+		routep = &routes[index];
+		memset(routep, 0, sizeof(Route));
+		copy(routep->topic, topic, sizeof(routep->topic));
+		copy(routep->transport, transport, sizeof(routep->transport));
+		routep->allow = allow;
+		routep->rate_hz = rate_hz;
+		routep->decimation = decimation;
+		length++;
+		generation++;
+		return true;
+	}
+
+	bool remove(unsigned index) {
+		if (index >= length)
+			return false;
+
+		memmove(&routes[index], &routes[index + 1], (length - index - 1) * sizeof(Route));
+		length--;
+		generation++;
+		return true;
+	}
+
+	void clear_counters() {
+		for (unsigned i = 0; i < length; i++)
+			routes[i].forwarded = routes[i].denied = routes[i].decimated = routes[i].limited = 0;
+	}
+
+	/*
+	 * Index of the route of a topic on a transport, -1 if none.
+	 */
+	int find(const char * topic, const char * transport) const {
+		for (unsigned i = 0; i < length; i++) {
+			if (match(routes[i].topic, topic) && match(routes[i].transport, transport))
+				return (int) i;
+		}
+		return -1;
+	}
+
+	/*
+	 * Whether the topic may be advertised or subscribed on the transport.
+	 */
+	bool allowed(const char * topic, const char * transport) const {
+		int index = find(topic, transport);
+
+		return (index < 0) || routes[index].allow;
+	}
+
+	/*
+	 * Looks the route of a topic up again if the table changed since.
+	 */
+	void resolve(RouteState & state, const char * topic, const char * transport) const {
+		if (state.generation != generation) {
+			state.route = find(topic, transport);
+			state.generation = generation;
+			state.phase = 0;
+			state.started = false;
+		}
+	}
+
+	/*
+	 * Whether a message stamped now_us is forwarded on the route of a
+	 * resolved state, updating the counters.
+	 */
+	bool forward(RouteState & state, uint32_t now_us) {
+		Route * routep;
+
+		if ((state.route < 0) || ((unsigned) state.route >= length))
+			return true;
+		routep = &routes[state.route];
+
+		if (!routep->allow) {
+			routep->denied++;
+			return false;
+		}
+
+		if (routep->decimation > 1) {
+			if (state.phase++ % routep->decimation != 0) {
+				routep->decimated++;
+				return false;
+			}
+		}
+
+		if (routep->rate_hz > 0) {
+			uint32_t period = 1000000 / routep->rate_hz;
+
+			if (state.started && ((int32_t) (now_us - state.next_us) < 0)) {
+				routep->limited++;
+				return false;
+			}
+			/* Keeps the average rate under jitter, without bursting after a pause.*/
+			if (!state.started || ((int32_t) (now_us - state.next_us) >= (int32_t) period))
+				state.next_us = now_us + period;
+			else
+				state.next_us += period;
+			state.started = true;
+		}
+
+		routep->forwarded++;
+		return true;
+	}
+};
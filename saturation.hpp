@@ -0,0 +1,116 @@
+#pragma once
+
+#include <math.h>
+
+#include "kinematics.hpp"
+
+enum SaturationPriority {
+	SATURATE_UNIFORM, SATURATE_ROTATION_FIRST, SATURATE_TRANSLATION_FIRST
+};
+
+/*
+ * Wheel speed saturation.
+ *
+ * Clamping each wheel on its own changes the direction of the body
+ * velocity as soon as one wheel saturates. Since the inverse kinematics is
+ * linear, scaling the whole wheel vector scales the body velocity instead.
+ * Commands within the limit are left alone, the others are scaled:
+ *
+ * - SATURATE_UNIFORM scales the command so that the fastest wheel runs at
+ *   max_dth, the direction of motion is kept.
+ * - SATURATE_ROTATION_FIRST keeps the angular speed, scaled down only if it
+ *   saturates the wheels alone, and scales the translation into the speed
+ *   left.
+ * - SATURATE_TRANSLATION_FIRST does the opposite.
+ *
+ * No ChibiOS dependency, the class is also used by the host tools.
+ */
+template<typename Kinematics>
+class WheelSaturation {
+public:
+	static const unsigned NUM_WHEELS = Kinematics::NUM_WHEELS;
+
+private:
+	/*
+	 * Largest k in [0, 1] for which |a + k * b| <= max_dth on every wheel,
+	 * a being already within the limit.
+	 */
+	float headroom(const float a[NUM_WHEELS], const float b[NUM_WHEELS]) const {
+		float k = 1.0f;
+
+		for (unsigned i = 0; i < NUM_WHEELS; i++) {
+			float room = (b[i] >= 0.0f) ? (max_dth - a[i]) : (max_dth + a[i]);
+			float speed = fabsf(b[i]);
+
+			if (room < k * speed)
+				k = (room > 0.0f) ? (room / speed) : 0.0f;
+		}
+		return k;
+	}
+
+	float limit(const float dth[NUM_WHEELS]) const {
+		const float zero[NUM_WHEELS] = { };
+
+		return headroom(zero, dth);
+	}
+
+public:
+	float max_dth;
+	SaturationPriority priority;
+	uint32_t saturations;
+
+	WheelSaturation(float max_dth, SaturationPriority priority = SATURATE_UNIFORM) :
+			max_dth(max_dth), priority(priority), saturations(0) {
+	}
+
+	/*
+	 * Wheel speeds of the body velocity v within max_dth, returns false if
+	 * the command had to be scaled down.
+	 */
+	bool apply(const BodyVelocity<float> & v, float dth[NUM_WHEELS]) {
+		float first[NUM_WHEELS], second[NUM_WHEELS];
+		BodyVelocity<float> part;
+		float k;
+
+		Kinematics::inverse(v, dth);
+		k = limit(dth);
+		if (k >= 1.0f)
+			return true;
+		saturations++;
+
+		if (priority == SATURATE_UNIFORM) {
+			for (unsigned i = 0; i < NUM_WHEELS; i++)
+				dth[i] *= k;
+			return false;
+		}
+
+		/* The inverse kinematics is linear, the command is the sum of its parts.*/
+		part.x = part.y = 0.0f;
+		part.w = v.w;
+		if (priority == SATURATE_ROTATION_FIRST) {
+			Kinematics::inverse(part, first);
+			part.x = v.x;
+			part.y = v.y;
+			part.w = 0.0f;
+			Kinematics::inverse(part, second);
+		} else {
+			Kinematics::inverse(part, second);
+			part.x = v.x;
+			part.y = v.y;
+			part.w = 0.0f;
+			Kinematics::inverse(part, first);
+		}
+
+		k = limit(first);
+		for (unsigned i = 0; i < NUM_WHEELS; i++)
+			first[i] *= k;
+		if (k >= 1.0f)
+			k = headroom(first, second);
+		else
+			k = 0.0f;
+
+		for (unsigned i = 0; i < NUM_WHEELS; i++)
+			dth[i] = first[i] + k * second[i];
+		return false;
+	}
+};
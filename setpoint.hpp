@@ -0,0 +1,246 @@
+#pragma once
+
+#include <ch.h>
+
+#include "snapshot.hpp"
+#include "trajectory.hpp"
+#include "cmdpub.hpp"
+
+/*
+ * Body velocity setpoint: forward and lateral speed [m/s], angular speed
+ * [rad/s]. Each module maps it to its own speed message.
+ */
+struct Setpoint {
+	float x;
+	float y;
+	float w;
+};
+
+/*
+ * Setpoint sources, each one has its own mailbox and must be written by a
+ * single thread.
+ */
+enum SetpointSource {
+	SETPOINT_SHELL, SETPOINT_ROS, SETPOINT_BINARY, SETPOINT_PROFILE, SETPOINT_NUM_SOURCES
+};
+
+/*
+ * Velocity setpoint streamer.
+ *
+ * Sources post setpoints with set(), a lock-free snapshot per source. The
+ * streamer thread runs every period_ms while a command is active: it takes
+ * the latest setpoint as target, moves the command towards it through the
+ * acceleration and jerk limited trajectories of each body axis and
+ * publishes it, so the motor controllers get a steady and smooth command
+ * stream whatever the rate of the host. If no setpoint arrives for
+ * timeout_ms the target ramps linearly to zero in ramp_ms, once the command
+ * is back to zero the streamer goes idle until the next setpoint.
+ *
+ * A thread that needs exact timing, like the profile player, takes over the
+ * target with acquire() and publish_target(): each target is published
+ * right away as one limited step, over the time since the previous step,
+ * and the streamer keeps stepping towards it every period without timing
+ * out, so the commands stay within the limits whatever the target steps.
+ * release() hands the target back to the sources with the setpoint to
+ * continue from.
+ *
+ * The thread is started with:
+ *
+ *   r2p::Thread::create_heap(NULL, THD_WA_SIZE(512), NORMALPRIO + 1, streamer.thread, &streamer);
+ */
+template<typename MessageType, void (*fill)(MessageType &, const Setpoint &)>
+class SetpointStreamer {
+private:
+	CommandPublisher<MessageType> & pub;
+	Snapshot<Setpoint> mailbox[SETPOINT_NUM_SOURCES];
+	uint32_t seq[SETPOINT_NUM_SOURCES];
+	Thread * volatile tp;
+	Mutex mtx;
+	bool external;
+	Setpoint external_target;
+	systime_t last_step;
+
+	void publish(const Setpoint & sp) {
+		MessageType * msgp;
+
+		if (pub.alloc(msgp)) {
+			fill(*msgp, sp);
+			pub.publish(*msgp);
+			published++;
+		}
+	}
+
+	/*
+	 * Publishes one limited step towards target, over the time since the
+	 * previous step and at most one period.
+	 */
+	void step(const Setpoint & target, systime_t now) {
+		systime_t elapsed = now - last_step;
+		Setpoint command;
+		float dt;
+
+		if (elapsed > MS2ST(period_ms))
+			elapsed = MS2ST(period_ms);
+		dt = (float) elapsed / (float) CH_FREQUENCY;
+		last_step = now;
+
+		command.x = traj_x.update(target.x, dt);
+		command.y = traj_y.update(target.y, dt);
+		command.w = traj_w.update(target.w, dt);
+		publish(command);
+	}
+
+public:
+	uint16_t period_ms;
+	uint16_t timeout_ms;
+	uint16_t ramp_ms;
+	uint32_t published;
+	uint32_t timeouts;
+	AxisTrajectory traj_x;
+	AxisTrajectory traj_y;
+	AxisTrajectory traj_w;
+
+	/*
+	 * Limits in m/s^2 and m/s^3 for the linear axes, rad/s^2 and rad/s^3
+	 * for the angular one.
+	 */
+	SetpointStreamer(CommandPublisher<MessageType> & pub, float linear_accel, float linear_jerk, float angular_accel,
+			float angular_jerk, uint16_t period_ms = 20, uint16_t timeout_ms = 500, uint16_t ramp_ms = 500) :
+			pub(pub), tp(NULL), period_ms(period_ms), timeout_ms(timeout_ms), ramp_ms(ramp_ms), published(0),
+			timeouts(0), traj_x(linear_accel, linear_jerk), traj_y(linear_accel, linear_jerk),
+			traj_w(angular_accel, angular_jerk) {
+		chMtxInit(&mtx);
+		external = false;
+		last_step = 0;
+		for (unsigned i = 0; i < SETPOINT_NUM_SOURCES; i++)
+			seq[i] = 0;
+	}
+
+	void set(SetpointSource source, const Setpoint & sp) {
+		Thread * threadp = tp;
+
+		mailbox[source].write(sp);
+		if (threadp != NULL)
+			chEvtSignal(threadp, EVENT_MASK(0));
+	}
+
+	void acquire() {
+		chMtxLock(&mtx);
+		external = true;
+		/* Holds the current command until the first target.*/
+		external_target.x = traj_x.get_velocity();
+		external_target.y = traj_y.get_velocity();
+		external_target.w = traj_w.get_velocity();
+		chMtxUnlock();
+	}
+
+	void publish_target(const Setpoint & sp) {
+		Thread * threadp = tp;
+
+		chMtxLock(&mtx);
+		external_target = sp;
+		step(sp, chTimeNow());
+		chMtxUnlock();
+
+		/* Wakes the streamer if idle, it follows up to the target.*/
+		if (threadp != NULL)
+			chEvtSignal(threadp, EVENT_MASK(0));
+	}
+
+	void release(const Setpoint & sp) {
+		chMtxLock(&mtx);
+		external = false;
+		chMtxUnlock();
+		set(SETPOINT_PROFILE, sp);
+	}
+
+	msg_t run() {
+		Setpoint target = { 0.0f, 0.0f, 0.0f };
+		Setpoint from = target;
+		systime_t last_set = 0;
+		systime_t ramp_start = 0;
+		systime_t next = 0;
+		bool active = false;
+		bool ramping = false;
+
+		tp = chThdSelf();
+
+		for (;;) {
+			systime_t now = chTimeNow();
+
+			if (!active) {
+				chEvtWaitAny(EVENT_MASK(0));
+				next = chTimeNow();
+			} else {
+				/* Fixed rate, resynchronized if a period was missed.*/
+				next += MS2ST(period_ms);
+				if (next - now > MS2ST(period_ms))
+					next = now;
+				else if (next != now)
+					chThdSleep(next - now);
+			}
+			now = chTimeNow();
+
+			chMtxLock(&mtx);
+
+			for (unsigned i = 0; i < SETPOINT_NUM_SOURCES; i++) {
+				if (mailbox[i].sequence() != seq[i]) {
+					seq[i] = mailbox[i].read(target);
+					last_set = now;
+					active = true;
+					ramping = false;
+				}
+			}
+
+			if (external) {
+				target = external_target;
+				last_set = now;
+				active = true;
+				ramping = false;
+			}
+
+			if (!active) {
+				chMtxUnlock();
+				continue;
+			}
+
+			if (!ramping && (now - last_set >= MS2ST(timeout_ms))) {
+				from = target;
+				ramp_start = now;
+				ramping = true;
+				timeouts++;
+			}
+
+			if (ramping) {
+				systime_t elapsed = now - ramp_start;
+
+				if (elapsed >= MS2ST(ramp_ms)) {
+					target.x = target.y = target.w = 0.0f;
+				} else {
+					float k = 1.0f - (float) elapsed / (float) MS2ST(ramp_ms);
+
+					target.x = from.x * k;
+					target.y = from.y * k;
+					target.w = from.w * k;
+				}
+			}
+
+			step(target, now);
+
+			if (ramping && (now - ramp_start >= MS2ST(ramp_ms)) && traj_x.settled(0.0f) && traj_y.settled(0.0f)
+					&& traj_w.settled(0.0f)) {
+				active = false;
+			}
+			chMtxUnlock();
+		}
+
+		return CH_SUCCESS;
+	}
+
+	static msg_t thread(void * arg) {
+		SetpointStreamer * streamerp = reinterpret_cast<SetpointStreamer *>(arg);
+
+		chRegSetThreadName("setpoint");
+		return streamerp->run();
+	}
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Single writer, multiple readers snapshot of a plain struct.
+ *
+ * The value is kept in two copies guarded by a sequence counter (a seqlock
+ * "latch"): the writer updates copy 0 while the counter is odd, so readers
+ * use copy 1, then copy 1 while the counter is even. A reader always finds
+ * one complete copy, even if it preempted the writer in the middle of an
+ * update, and retries only if the writer completed an update while it was
+ * copying. Neither side ever blocks or locks, the writer can be a
+ * subscriber callback and readers can have any priority.
+ *
+ * Only gcc builtins are used, the template is also used by the host tools.
+ */
+template<typename T>
+class Snapshot {
+private:
+	volatile uint32_t seq;
+	T copies[2];
+
+public:
+	Snapshot() : seq(0) {
+		copies[0] = T();
+		copies[1] = T();
+	}
+
+	/*
+	 * Publishes a new value, only one thread may write.
+	 */
+	void write(const T & value) {
+		seq = seq + 1;
+		__sync_synchronize();
+		copies[0] = value;
+		__sync_synchronize();
+		seq = seq + 1;
+		__sync_synchronize();
+		copies[1] = value;
+		__sync_synchronize();
+	}
+
+	/*
+	 * Copies the latest complete value, returns its sequence number: it
+	 * changes at every write, readers can use it to skip unchanged values.
+	 */
+	uint32_t read(T & value) const {
+		uint32_t s;
+
+		do {
+			s = seq;
+			__sync_synchronize();
+			value = copies[s & 1];
+			__sync_synchronize();
+		} while (seq != s);
+
+		return s >> 1;
+	}
+
+	uint32_t sequence() const {
+		return seq >> 1;
+	}
+};
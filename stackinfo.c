@@ -0,0 +1,106 @@
+/*
+ * Stack usage from the fill pattern, see stackinfo.h.
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+
+#include "stackinfo.h"
+
+#if !CH_DBG_FILL_THREADS || !CH_DBG_ENABLE_STACK_CHECK
+#error "stackinfo requires CH_DBG_FILL_THREADS and CH_DBG_ENABLE_STACK_CHECK"
+#endif
+
+/*
+ * Linker script symbols.
+ */
+extern stkalign_t __main_stack_base__, __main_stack_end__;
+extern stkalign_t __main_thread_stack_base__, __main_thread_stack_end__;
+
+/*
+ * Counts the fill pattern bytes from the stack limit up.
+ */
+static size_t count_free(const uint8_t *p, const uint8_t *endp) {
+  const uint8_t *startp = p;
+
+  while ((p < endp) && (*p == CH_STACK_FILL_VALUE))
+    p++;
+  return (size_t)(p - startp);
+}
+
+/**
+ * @brief   Returns the stack usage of a thread.
+ * @note    The thread must be referenced, e.g. while iterating the registry.
+ */
+void stkGetInfo(Thread *tp, StackInfo *sip) {
+  const uint8_t *basep = (const uint8_t *)tp->p_stklimit;
+  const uint8_t *endp;
+
+  sip->name = chRegGetThreadName(tp);
+  sip->size = 0;
+
+  if (tp->p_stklimit == &__main_thread_stack_base__)
+    sip->size = (size_t)((uint8_t *)&__main_thread_stack_end__ - basep);
+#if CH_USE_HEAP && CH_USE_DYNAMIC
+  else if ((tp->p_flags & THD_MEM_MODE_MASK) == THD_MEM_MODE_HEAP)
+    sip->size = ((union heap_header *)tp - 1)->h.size - sizeof(Thread);
+#endif
+#if CH_USE_MEMPOOLS && CH_USE_DYNAMIC
+  else if ((tp->p_flags & THD_MEM_MODE_MASK) == THD_MEM_MODE_MEMPOOL)
+    sip->size = tp->p_mpool->mp_object_size - sizeof(Thread);
+#endif
+
+  if (sip->size > 0)
+    endp = basep + sip->size;
+  else if (tp == chThdSelf())
+    endp = (const uint8_t *)&endp;
+  else
+    endp = (const uint8_t *)tp->p_ctx.r13;
+  sip->free = count_free(basep, endp);
+}
+
+/**
+ * @brief   Returns the usage of the exceptions stack.
+ */
+void stkGetExceptionInfo(StackInfo *sip) {
+  const uint8_t *basep = (const uint8_t *)&__main_stack_base__;
+  const uint8_t *endp = (const uint8_t *)&__main_stack_end__;
+
+  sip->name = "exceptions";
+  sip->size = (size_t)(endp - basep);
+  sip->free = count_free(basep, endp);
+}
+
+static void print_info(BaseSequentialStream *chp, const StackInfo *sip) {
+
+  chprintf(chp, "%-16s ", sip->name ? sip->name : "?");
+  if (sip->size > 0)
+    chprintf(chp, "%5u %5u %5u %3u%%\r\n", sip->size, sip->size - sip->free,
+             sip->free, (unsigned)(((sip->size - sip->free) * 100) / sip->size));
+  else
+    chprintf(chp, "    -     - %5u    -\r\n", sip->free);
+}
+
+/**
+ * @brief   Shell command printing peak stack usage and margin per thread.
+ */
+void cmd_stack(BaseSequentialStream *chp, int argc, char *argv[]) {
+  StackInfo si;
+  Thread *tp;
+
+  (void)argv;
+  if (argc > 0) {
+    chprintf(chp, "Usage: stack\r\n");
+    return;
+  }
+  chprintf(chp, "name              size  peak  free  use\r\n");
+  tp = chRegFirstThread();
+  do {
+    stkGetInfo(tp, &si);
+    print_info(chp, &si);
+    tp = chRegNextThread(tp);
+  } while (tp != NULL);
+  stkGetExceptionInfo(&si);
+  print_info(chp, &si);
+}
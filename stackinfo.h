@@ -0,0 +1,37 @@
+/*
+ * Stack usage from the fill pattern.
+ *
+ * With CH_DBG_FILL_THREADS the kernel fills every new working area with
+ * CH_STACK_FILL_VALUE, and the startup code fills the main and process
+ * stacks the same way. Stacks grow down towards p_stklimit, so the bytes
+ * still holding the pattern above p_stklimit are the margin left by the
+ * deepest use since the thread started.
+ *
+ * The stack size is known for heap allocated threads, from the heap block
+ * header, and for the main thread, from the linker script. It is reported
+ * as zero for other static threads, only the margin is known for them.
+ */
+
+#ifndef _STACKINFO_H_
+#define _STACKINFO_H_
+
+/**
+ * @brief   Stack usage of one thread.
+ */
+typedef struct {
+  const char            *name;
+  size_t                size;           /* Stack size, zero if unknown.      */
+  size_t                free;           /* Bytes never touched.              */
+} StackInfo;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void stkGetInfo(Thread *tp, StackInfo *sip);
+  void stkGetExceptionInfo(StackInfo *sip);
+  void cmd_stack(BaseSequentialStream *chp, int argc, char *argv[]);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _STACKINFO_H_ */
@@ -0,0 +1,122 @@
+/*
+ * Bounded queue of streamed samples, see streamq.h.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "streamq.h"
+#include "timesync.h"
+
+/**
+ * @brief   Initializes a queue, the default policy is drop oldest.
+ */
+void sqObjectInit(StreamQueue *sqp) {
+
+  memset(sqp, 0, sizeof(*sqp));
+  chSemInit(&sqp->sem, 0);
+  sqp->policy = SQ_DROP_OLDEST;
+  sqp->decimation = 2;
+}
+
+/**
+ * @brief   Changes the overflow policy.
+ *
+ * @param[in] sqp         pointer to the queue
+ * @param[in] policy      overflow policy
+ * @param[in] decimation  samples per accepted sample for @p SQ_DECIMATE
+ */
+void sqSetPolicy(StreamQueue *sqp, sqpolicy_t policy, unsigned decimation) {
+
+  chSysLock();
+  sqp->policy = policy;
+  sqp->decimation = (decimation > 0) ? decimation : 1;
+  memset(sqp->skip, 0, sizeof(sqp->skip));
+  chSysUnlock();
+}
+
+/**
+ * @brief   Posts a sample, never waits.
+ * @details The sample is stamped with the current module time.
+ *
+ * @param[in] sqp       pointer to the queue
+ * @param[in] topic     telemetry topic, less than @p TLM_NUM_TOPICS
+ * @param[in] payloadp  raw message body
+ * @param[in] n         body size, at most @p TLM_MAX_PAYLOAD bytes
+ * @return              @p FALSE if a sample was dropped.
+ */
+bool_t sqPost(StreamQueue *sqp, uint8_t topic, const void *payloadp,
+              size_t n) {
+  StreamSample *sp;
+  bool_t ok = TRUE;
+
+  chDbgCheck((topic < TLM_NUM_TOPICS) && (n <= TLM_MAX_PAYLOAD), "sqPost");
+
+  chSysLock();
+  sqp->posted[topic]++;
+
+  if ((sqp->policy == SQ_DECIMATE) &&
+      (sqp->count >= (STREAMQ_DEPTH * 3) / 4)) {
+    unsigned skip = sqp->skip[topic];
+
+    sqp->skip[topic] = (skip + 1 < sqp->decimation) ? skip + 1 : 0;
+    if (skip != 0) {
+      sqp->dropped[topic]++;
+      chSysUnlock();
+      return FALSE;
+    }
+  }
+  else
+    sqp->skip[topic] = 0;
+
+  if (sqp->count == STREAMQ_DEPTH) {
+    if (sqp->policy != SQ_DROP_OLDEST) {
+      sqp->dropped[topic]++;
+      chSysUnlock();
+      return FALSE;
+    }
+    /* Overwriting the oldest sample, the semaphore count is unchanged.*/
+    sqp->dropped[sqp->buf[sqp->rd].topic]++;
+    sqp->rd = (sqp->rd + 1) % STREAMQ_DEPTH;
+    sqp->count--;
+    ok = FALSE;
+  }
+  else
+    chSemSignalI(&sqp->sem);
+
+  sp = &sqp->buf[(sqp->rd + sqp->count) % STREAMQ_DEPTH];
+  sp->stamp = tsNowI();
+  sp->topic = topic;
+  sp->len = (uint8_t)n;
+  memcpy(sp->payload, payloadp, n);
+  sqp->count++;
+  if (sqp->count > sqp->peak)
+    sqp->peak = sqp->count;
+  chSchRescheduleS();
+  chSysUnlock();
+  return ok;
+}
+
+/**
+ * @brief   Fetches the oldest sample.
+ *
+ * @param[in] sqp       pointer to the queue
+ * @param[out] sp       sample copy
+ * @param[in] timeout   maximum time to wait for a sample
+ * @return              @p FALSE on timeout.
+ */
+bool_t sqFetch(StreamQueue *sqp, StreamSample *sp, systime_t timeout) {
+
+  chSysLock();
+  if (chSemWaitTimeoutS(&sqp->sem, timeout) == RDY_TIMEOUT) {
+    chSysUnlock();
+    return FALSE;
+  }
+  *sp = sqp->buf[sqp->rd];
+  sqp->rd = (sqp->rd + 1) % STREAMQ_DEPTH;
+  sqp->count--;
+  chSysUnlock();
+  return TRUE;
+}
@@ -0,0 +1,77 @@
+/*
+ * Bounded queue of streamed samples.
+ *
+ * Subscriber threads post raw message bodies here and never wait: when the
+ * queue is full the configured overflow policy decides what is lost and the
+ * loss is counted per topic. A single writer thread fetches the samples and
+ * is the only one that can block on a host that stopped reading.
+ *
+ * Overflow policies:
+ * - SQ_DROP_OLDEST, the oldest queued sample is overwritten.
+ * - SQ_DROP_NEWEST, the posted sample is discarded.
+ * - SQ_DECIMATE, above three quarters of the queue only one sample out of
+ *   @p decimation is accepted per topic, newest samples are discarded when
+ *   the queue is still full.
+ */
+
+#ifndef _STREAMQ_H_
+#define _STREAMQ_H_
+
+#include "telemetry.h"
+
+/**
+ * @brief   Number of queued samples.
+ */
+#if !defined(STREAMQ_DEPTH) || defined(__DOXYGEN__)
+#define STREAMQ_DEPTH           32
+#endif
+
+/**
+ * @brief   Overflow policies.
+ */
+typedef enum {
+  SQ_DROP_OLDEST = 0,
+  SQ_DROP_NEWEST = 1,
+  SQ_DECIMATE = 2
+} sqpolicy_t;
+
+/**
+ * @brief   Queued sample.
+ */
+typedef struct {
+  uint32_t              stamp;          /* Module time of the post, in us.   */
+  uint8_t               topic;
+  uint8_t               len;
+  uint8_t               payload[TLM_MAX_PAYLOAD];
+} StreamSample;
+
+/**
+ * @brief   Streamed samples queue.
+ */
+typedef struct {
+  StreamSample          buf[STREAMQ_DEPTH];
+  unsigned              rd;
+  unsigned              count;
+  Semaphore             sem;            /* Counts samples not yet fetched.   */
+  sqpolicy_t            policy;
+  unsigned              decimation;
+  unsigned              skip[TLM_NUM_TOPICS];
+  /* Statistics.*/
+  uint32_t              posted[TLM_NUM_TOPICS];
+  uint32_t              dropped[TLM_NUM_TOPICS];
+  unsigned              peak;
+} StreamQueue;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void sqObjectInit(StreamQueue *sqp);
+  void sqSetPolicy(StreamQueue *sqp, sqpolicy_t policy, unsigned decimation);
+  bool_t sqPost(StreamQueue *sqp, uint8_t topic, const void *payloadp,
+                size_t n);
+  bool_t sqFetch(StreamQueue *sqp, StreamSample *sp, systime_t timeout);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _STREAMQ_H_ */
@@ -0,0 +1,174 @@
+/*
+ * Binary telemetry framing.
+ *
+ * Every streamed sample is sent as a single frame:
+ *
+ *   COBS(topic | seq | stamp | payload | crc16) 0x00
+ *
+ * The stamp is the module time of the sample in microseconds, 32 bits little
+ * endian, wrapping every 71 minutes. The CRC is CRC-16/CCITT-FALSE computed
+ * over topic, seq, stamp and payload and sent little endian. COBS encoding
+ * removes every zero byte from the frame, so the trailing 0x00 is an
+ * unambiguous delimiter and a decoder can resynchronize on the next one after
+ * any corruption. The payload is the raw body of the r2p message, no float
+ * formatting is done on the module. The host sends setpoint and profile
+ * frames to the module with the same framing.
+ *
+ * This file is shared with the host tools, it must not depend on ChibiOS.
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Frame geometry.
+ */
+#define TLM_MAX_PAYLOAD         48
+#define TLM_HEADER_SIZE         6
+#define TLM_CRC_SIZE            2
+#define TLM_MAX_RAW_SIZE        (TLM_HEADER_SIZE + TLM_MAX_PAYLOAD + TLM_CRC_SIZE)
+#define TLM_MAX_FRAME_SIZE      (TLM_MAX_RAW_SIZE + TLM_MAX_RAW_SIZE / 254 + 2)
+
+#define TLM_DELIMITER           0x00
+
+/*
+ * Topic identifiers.
+ */
+#define TLM_TOPIC_ENCODER2      0x01
+#define TLM_TOPIC_IMU           0x02
+#define TLM_TOPIC_PROXIMITY     0x03
+#define TLM_TOPIC_SYNC          0x04
+#define TLM_TOPIC_SNAPSHOT      0x05
+#define TLM_TOPIC_SETPOINT      0x06
+#define TLM_TOPIC_PROFILE       0x07
+#define TLM_TOPIC_PROFILE_CTRL  0x08
+#define TLM_TOPIC_POSE          0x09
+#define TLM_NUM_TOPICS          10
+
+/*
+ * Payload layouts, identical to the bodies of the r2p messages.
+ */
+typedef struct {
+  float delta[2];
+} __attribute__((packed)) tlm_encoder2_t;
+
+typedef struct {
+  float roll;
+  float pitch;
+  float yaw;
+} __attribute__((packed)) tlm_imu_t;
+
+typedef struct {
+  uint16_t value[8];
+} __attribute__((packed)) tlm_proximity_t;
+
+/*
+ * Clock synchronization, the last USB start of frame seen by the module: its
+ * 11 bits frame number and the module time it was latched at.
+ */
+typedef struct {
+  uint32_t sof_us;
+  uint16_t frame;
+} __attribute__((packed)) tlm_sync_t;
+
+/*
+ * Aggregated snapshot, the latest sample of each topic. The ages are the
+ * time between the arrival of each sample and the frame stamp, in
+ * microseconds, saturated at 0xFFFF. Bits 0..2 of valid tell which samples,
+ * in field order, have been received at all.
+ */
+#define TLM_SNAPSHOT_ENCODER2   0x01
+#define TLM_SNAPSHOT_IMU        0x02
+#define TLM_SNAPSHOT_PROXIMITY  0x04
+
+typedef struct {
+  tlm_encoder2_t encoder2;
+  tlm_imu_t imu;
+  tlm_proximity_t proximity;
+  uint16_t age[3];
+  uint8_t valid;
+  uint8_t reserved;
+} __attribute__((packed)) tlm_snapshot_t;
+
+/*
+ * Velocity setpoint, sent by the host to the module: forward and lateral
+ * speed [m/s], angular speed [rad/s].
+ */
+typedef struct {
+  float x;
+  float y;
+  float w;
+} __attribute__((packed)) tlm_setpoint_t;
+
+/*
+ * Wheel odometry, pose [m, rad] and body twist [m/s, rad/s].
+ */
+typedef struct {
+  float x;
+  float y;
+  float theta;
+  float vx;
+  float vy;
+  float w;
+} __attribute__((packed)) tlm_pose_t;
+
+/*
+ * Velocity profile point, time from the start of the playback in
+ * microseconds. Sent by the host to upload a profile, index 0 starts a new
+ * one, and by the module to report the actual publish time of each played
+ * point.
+ */
+typedef struct {
+  uint16_t index;
+  uint32_t t_us;
+  float x;
+  float y;
+  float w;
+} __attribute__((packed)) tlm_profile_point_t;
+
+/*
+ * Profile playback control, sent by the host.
+ */
+#define TLM_PROFILE_PLAY        1
+#define TLM_PROFILE_PAUSE       2
+#define TLM_PROFILE_RESUME      3
+#define TLM_PROFILE_ABORT       4
+#define TLM_PROFILE_REPORT      5
+
+typedef struct {
+  uint8_t cmd;
+} __attribute__((packed)) tlm_profile_ctrl_t;
+
+/**
+ * @brief   Streaming frame decoder.
+ */
+typedef struct {
+  uint8_t   buf[TLM_MAX_FRAME_SIZE];    /* Encoded bytes since last delimiter.*/
+  size_t    len;
+  int       overflow;
+  uint8_t   topic;                      /* Last decoded frame.               */
+  uint8_t   seq;
+  uint32_t  stamp;
+  uint8_t   payload[TLM_MAX_PAYLOAD];
+  size_t    payload_len;
+  uint32_t  frames;                     /* Statistics.                       */
+  uint32_t  crc_errors;
+  uint32_t  framing_errors;
+} TelemetryDecoder;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  uint16_t tlmCRC16(uint16_t crc, const uint8_t *bufp, size_t n);
+  size_t tlmEncode(uint8_t *framep, uint8_t topic, uint8_t seq,
+                   uint32_t stamp, const void *payloadp, size_t n);
+  void tlmDecoderInit(TelemetryDecoder *decp);
+  int tlmDecoderPut(TelemetryDecoder *decp, uint8_t c);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TELEMETRY_H_ */
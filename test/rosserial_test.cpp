@@ -22,53 +22,68 @@
 ros::NodeHandle nh;
 
 
-/*
- * ROS rosserial publisher thread.
- */
-msg_t rosserial_pub_thread(void * arg) {
-	std_msgs::String str_msg;
-	ros::Publisher pub("chatter", &str_msg);
-
-	(void) arg;
-	chRegSetThreadName("rosserial_pub");
-
-	nh.initNode();
-	nh.advertise(pub);
-
-	for (;;) {
-		char hello[] = "Hello world!";
-		str_msg.data = hello;
-		pub.publish(&str_msg);
-		nh.spinOnce();
-		chThdSleepMilliseconds(500);
-	}
-
-	return CH_SUCCESS;
-}
+#if USE_USB_SERIAL
+#define ROS_CHANNEL     ((BaseAsynchronousChannel *) &SDU1)
+#else
+#define ROS_CHANNEL     ((BaseAsynchronousChannel *) &SD3)
+#endif
 
 
 /*
- * ROS rosserial subscriber thread.
+ * ROS rosserial subscriber callback.
  */
 
 void msg_cb( const std_msgs::Empty& toggle_msg){
 	palTogglePad(LED1_GPIO, LED1);
 }
 
-msg_t rosserial_sub_thread(void * arg) {
+
+/*
+ * ROS rosserial I/O thread.
+ * The only user of the NodeHandle: publishes every 500 milliseconds and
+ * wakes up on channel input instead of polling for it.
+ */
+msg_t rosserial_io_thread(void * arg) {
+	std_msgs::String str_msg;
+	ros::Publisher pub("chatter", &str_msg);
 	ros::Subscriber<std_msgs::Empty> sub("toggle_led", &msg_cb );
+	EventListener el;
+	systime_t next_pub;
 
 	(void) arg;
-	chRegSetThreadName("rosserial_sub");
+	chRegSetThreadName("rosserial_io");
 
 	nh.initNode();
+	nh.advertise(pub);
 	nh.subscribe(sub);
 
+	chEvtRegisterMask(chnGetEventSource(ROS_CHANNEL), &el, EVENT_MASK(0));
+	next_pub = chTimeNow();
+
 	for (;;) {
+		systime_t now = chTimeNow();
+
+		/* Neither due nor ahead after a stall, resynchronizes.*/
+		if (((systime_t)(now - next_pub) >= MS2ST(500)) && ((systime_t)(next_pub - now) > MS2ST(500)))
+			next_pub = now;
+
+		if ((systime_t)(now - next_pub) < MS2ST(500)) {
+			char hello[] = "Hello world!";
+			str_msg.data = hello;
+			pub.publish(&str_msg);
+			next_pub += MS2ST(500);
+		}
 		nh.spinOnce();
-		chThdSleepMilliseconds(5);
+
+		/* Sleeps until input arrives or the next publish is due.*/
+		now = chTimeNow();
+		if ((systime_t)(next_pub - now) <= MS2ST(500)) {
+			chEvtWaitAnyTimeout(EVENT_MASK(0), next_pub - now);
+		}
+		chEvtGetAndClearFlags(&el);
 	}
 
+	chEvtUnregister(chnGetEventSource(ROS_CHANNEL), &el);
 	return CH_SUCCESS;
 }
 
@@ -78,8 +93,7 @@ msg_t rosserial_sub_thread(void * arg) {
  */
 extern "C" {
 int main(void) {
-	Thread * pub_tp = NULL;
-	Thread * sub_tp = NULL;
+	Thread * io_tp = NULL;
 
 	halInit();
 	chSysInit();
@@ -111,27 +125,14 @@ int main(void) {
 
 	for (;;) {
 #if USE_USB_SERIAL
-		if (!pub_tp && (SDU1.config->usbp->state == USB_ACTIVE)) {
-#else
-		if (!pub_tp) {
-#endif
-			pub_tp = chThdCreateFromHeap(NULL, THD_WA_SIZE(2048), NORMALPRIO, rosserial_pub_thread, NULL);
-		} else if (chThdTerminated(pub_tp)) {
-			chThdRelease(pub_tp);
-			pub_tp = NULL;
-		}
-
-		chThdSleepMilliseconds(123);
-
-#if USE_USB_SERIAL
-		if (!sub_tp && (SDU1.config->usbp->state == USB_ACTIVE)) {
+		if (!io_tp && (SDU1.config->usbp->state == USB_ACTIVE)) {
 #else
-		if (!sub_tp) {
+		if (!io_tp) {
 #endif
-			sub_tp = chThdCreateFromHeap(NULL, THD_WA_SIZE(2048), NORMALPRIO, rosserial_sub_thread, NULL);
-		} else if (chThdTerminated(sub_tp)) {
-			chThdRelease(sub_tp);
-			sub_tp = NULL;
+			io_tp = chThdCreateFromHeap(NULL, THD_WA_SIZE(2048), NORMALPRIO, rosserial_io_thread, NULL);
+		} else if (chThdTerminated(io_tp)) {
+			chThdRelease(io_tp);
+			io_tp = NULL;
 		}
 
 		chThdSleepMilliseconds(500);
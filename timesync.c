@@ -0,0 +1,63 @@
+/*
+ * Module time base, see timesync.h.
+ */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "timesync.h"
+
+#define US_PER_TICK     (1000000 / CH_FREQUENCY)
+
+static TimeSyncLatch latch;
+
+/**
+ * @brief   Returns the module time in microseconds.
+ * @details The SysTick counter counts down from its reload value within each
+ *          system tick. A wrap whose interrupt is still pending, masked by
+ *          the lock, has not been accounted in the system time yet.
+ */
+uint32_t tsNowI(void) {
+  uint32_t load = SysTick->LOAD + 1;
+  systime_t ticks = chTimeNow();
+  uint32_t val = SysTick->VAL;
+
+  if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+    ticks++;
+    val = SysTick->VAL;
+  }
+  return (uint32_t)ticks * US_PER_TICK +
+         ((load - 1 - val) * US_PER_TICK) / load;
+}
+
+/**
+ * @brief   Returns the module time in microseconds.
+ */
+uint32_t tsNow(void) {
+  uint32_t us;
+
+  chSysLock();
+  us = tsNowI();
+  chSysUnlock();
+  return us;
+}
+
+/**
+ * @brief   Start of frame handler, latches the frame number and time.
+ */
+void tsSOFHookI(USBDriver *usbp) {
+
+  latch.sof_us = tsNowI();
+  latch.frame = (uint16_t)usbGetFrameNumber(usbp);
+  latch.sofs++;
+}
+
+/**
+ * @brief   Returns a consistent copy of the last start of frame latch.
+ */
+void tsGetLatch(TimeSyncLatch *latchp) {
+
+  chSysLock();
+  *latchp = latch;
+  chSysUnlock();
+}
@@ -0,0 +1,33 @@
+/*
+ * Module time base for sample stamping and host clock correlation.
+ *
+ * Time is kept in microseconds: system ticks extended with the SysTick
+ * counter, so the resolution is well below the 1 ms tick. The USB start of
+ * frame handler latches the bus frame number together with the module time,
+ * a host reading the latch can relate the module clock to the bus schedule.
+ */
+
+#ifndef _TIMESYNC_H_
+#define _TIMESYNC_H_
+
+/**
+ * @brief   Last start of frame latch.
+ */
+typedef struct {
+  uint32_t              sof_us;         /* Module time of the SOF.           */
+  uint16_t              frame;          /* USB frame number, 11 bits.        */
+  uint32_t              sofs;           /* SOF interrupts since reset.       */
+} TimeSyncLatch;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  uint32_t tsNowI(void);
+  uint32_t tsNow(void);
+  void tsSOFHookI(USBDriver *usbp);
+  void tsGetLatch(TimeSyncLatch *latchp);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TIMESYNC_H_ */
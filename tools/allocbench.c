@@ -0,0 +1,239 @@
+/*
+ * Host model of the operator new allocators, compares heap fragmentation
+ * after a long allocation churn.
+ *
+ *   allocbench [ops] [live] [seed]
+ *
+ * Up to @p live objects, default 64, are allocated at the same time.
+ *
+ * The heap is modeled after the ChibiOS one: address ordered first fit, an
+ * 8 bytes header per block, sizes rounded to 8 and coalescing on release.
+ * The same workload is run against the heap alone and against the size
+ * classes of chnew.cpp in front of a heap smaller by the pool arenas, so
+ * both configurations use the same RAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEAP_SIZE       (24 * 1024)
+#define ALIGN           8
+#define HEADER          8
+
+#define NUM_CLASSES     4
+static const size_t class_size[NUM_CLASSES] = { 16, 32, 64, 128 };
+static const size_t class_count[NUM_CLASSES] = { 32, 32, 16, 8 };
+
+#define MAX_LIVE        1024
+
+typedef struct Block {
+  size_t        offset;
+  size_t        size;
+  struct Block  *next;
+} Block;
+
+typedef struct {
+  size_t        size;
+  Block         *free_list;             /* Address ordered.                  */
+  unsigned      pool_free[NUM_CLASSES];
+  int           use_pools;
+  unsigned long failures;
+  unsigned long fallbacks;
+} Allocator;
+
+typedef struct {
+  int           used;
+  int           pool;                   /* Class index, -1 for the heap.     */
+  size_t        offset;
+  size_t        size;
+  int           long_lived;
+} Object;
+
+static void heap_init(Allocator *ap, size_t size, int use_pools) {
+  unsigned i;
+
+  memset(ap, 0, sizeof(*ap));
+  ap->use_pools = use_pools;
+  if (use_pools) {
+    for (i = 0; i < NUM_CLASSES; i++) {
+      ap->pool_free[i] = (unsigned)class_count[i];
+      size -= class_size[i] * class_count[i];
+    }
+  }
+  ap->size = size;
+  ap->free_list = malloc(sizeof(Block));
+  ap->free_list->offset = 0;
+  ap->free_list->size = size;
+  ap->free_list->next = NULL;
+}
+
+static int heap_alloc(Allocator *ap, size_t size, size_t *offsetp) {
+  Block **pp, *bp;
+
+  size = ((size + ALIGN - 1) & ~(size_t)(ALIGN - 1)) + HEADER;
+  for (pp = &ap->free_list; (bp = *pp) != NULL; pp = &bp->next) {
+    if (bp->size < size)
+      continue;
+    *offsetp = bp->offset;
+    if (bp->size - size >= HEADER + ALIGN) {
+      bp->offset += size;
+      bp->size -= size;
+    }
+    else {
+      *pp = bp->next;
+      free(bp);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+static void heap_free(Allocator *ap, size_t offset, size_t size) {
+  Block **pp, *bp, *nbp;
+
+  size = ((size + ALIGN - 1) & ~(size_t)(ALIGN - 1)) + HEADER;
+  for (pp = &ap->free_list; (*pp != NULL) && ((*pp)->offset < offset);
+       pp = &(*pp)->next)
+    ;
+  nbp = malloc(sizeof(Block));
+  nbp->offset = offset;
+  nbp->size = size;
+  nbp->next = *pp;
+  *pp = nbp;
+
+  /* Coalescing with the following and the preceding blocks.*/
+  if ((nbp->next != NULL) && (nbp->offset + nbp->size == nbp->next->offset)) {
+    bp = nbp->next;
+    nbp->size += bp->size;
+    nbp->next = bp->next;
+    free(bp);
+  }
+  for (bp = ap->free_list; (bp != NULL) && (bp->next != nbp); bp = bp->next)
+    ;
+  if ((bp != NULL) && (bp->offset + bp->size == nbp->offset)) {
+    bp->size += nbp->size;
+    bp->next = nbp->next;
+    free(nbp);
+  }
+}
+
+static int obj_alloc(Allocator *ap, Object *op, size_t size) {
+  unsigned i;
+
+  op->size = size;
+  op->pool = -1;
+  if (ap->use_pools) {
+    for (i = 0; i < NUM_CLASSES; i++) {
+      if (size > class_size[i])
+        continue;
+      if (ap->pool_free[i] > 0) {
+        ap->pool_free[i]--;
+        op->pool = (int)i;
+        return 1;
+      }
+      ap->fallbacks++;
+      break;
+    }
+  }
+  if (heap_alloc(ap, size, &op->offset))
+    return 1;
+  ap->failures++;
+  return 0;
+}
+
+static void obj_free(Allocator *ap, Object *op) {
+
+  if (op->pool >= 0)
+    ap->pool_free[op->pool]++;
+  else
+    heap_free(ap, op->offset, op->size);
+}
+
+/*
+ * Object sizes: mostly small middleware objects, some message buffers and
+ * thread working areas, with the shell working area re-created on every
+ * simulated USB reconnect.
+ */
+static size_t random_size(void) {
+  int r = rand() % 100;
+
+  if (r < 45)
+    return 8 + rand() % 24;
+  if (r < 75)
+    return 32 + rand() % 32;
+  if (r < 90)
+    return 64 + rand() % 64;
+  if (r < 98)
+    return 128 + rand() % 384;
+  return 600 + rand() % 600;
+}
+
+static void run(const char *label, int use_pools, unsigned long ops,
+                unsigned nlive, unsigned seed) {
+  static Object live[MAX_LIVE];
+  Allocator a;
+  Object shell;
+  Block *bp;
+  size_t free_total = 0, largest = 0;
+  unsigned fragments = 0;
+  unsigned long i;
+  unsigned k;
+
+  srand(seed);
+  memset(live, 0, sizeof(live));
+  heap_init(&a, HEAP_SIZE, use_pools);
+  shell.used = obj_alloc(&a, &shell, 2048 + 80);
+
+  for (i = 0; i < ops; i++) {
+    k = (unsigned)rand() % nlive;
+    if (live[k].used) {
+      /* A quarter of the objects are long lived.*/
+      if (!live[k].long_lived || (rand() % 64 == 0)) {
+        obj_free(&a, &live[k]);
+        live[k].used = 0;
+      }
+    }
+    else {
+      live[k].used = obj_alloc(&a, &live[k], random_size());
+      live[k].long_lived = (rand() % 4 == 0);
+    }
+    if (i % 5000 == 4999) {
+      if (shell.used)
+        obj_free(&a, &shell);
+      shell.used = obj_alloc(&a, &shell, 2048 + 80);
+    }
+  }
+
+  for (bp = a.free_list; bp != NULL; bp = bp->next) {
+    free_total += bp->size;
+    if (bp->size > largest)
+      largest = bp->size;
+    fragments++;
+  }
+  printf("%-12s heap %5zu free %5zu largest %5zu fragments %4u "
+         "fallbacks %6lu failures %6lu\n", label, a.size, free_total,
+         largest, fragments, a.fallbacks, a.failures);
+
+  while (a.free_list != NULL) {
+    bp = a.free_list;
+    a.free_list = bp->next;
+    free(bp);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long ops = (argc >= 2) ? strtoul(argv[1], NULL, 0) : 1000000;
+  unsigned nlive = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 0) : 64;
+  unsigned seed = (argc >= 4) ? (unsigned)strtoul(argv[3], NULL, 0) : 1;
+
+  if ((nlive == 0) || (nlive > MAX_LIVE)) {
+    fprintf(stderr, "live objects must be 1..%u\n", MAX_LIVE);
+    return 2;
+  }
+  printf("%lu operations, %u live objects, %u bytes of RAM\n", ops, nlive,
+         HEAP_SIZE);
+  run("heap", 0, ops, nlive, seed);
+  run("size classes", 1, ops, nlive, seed);
+  return 0;
+}
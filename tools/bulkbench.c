@@ -0,0 +1,125 @@
+/*
+ * Throughput test for the vendor bulk interface, firmware built with
+ * USB_DATA_VENDOR set.
+ *
+ *   bulkbench [seconds]    keeps several large asynchronous transfers queued
+ *                          on the bulk IN endpoint, decodes the telemetry
+ *                          frames and reports the sustained rate
+ *
+ * Start the "bench" shell command, or any binary stream, on the module while
+ * this is running.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libusb-1.0/libusb.h>
+
+#include "telemetry.h"
+
+#define VENDOR_ID       0x0483
+#define PRODUCT_ID      0x5740
+#define DATA_INTERFACE  2
+#define DATA_IN_EP      0x83
+
+#define NUM_TRANSFERS   8
+#define TRANSFER_SIZE   16384
+
+static TelemetryDecoder dec;
+static unsigned long long total_bytes;
+static unsigned long total_transfers;
+static int in_flight;
+static int stopping;
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void LIBUSB_CALL transfer_cb(struct libusb_transfer *xfer) {
+  int i;
+
+  if ((xfer->status == LIBUSB_TRANSFER_COMPLETED) ||
+      (xfer->status == LIBUSB_TRANSFER_TIMED_OUT)) {
+    total_bytes += (unsigned)xfer->actual_length;
+    total_transfers++;
+    for (i = 0; i < xfer->actual_length; i++)
+      tlmDecoderPut(&dec, xfer->buffer[i]);
+    if (!stopping && (libusb_submit_transfer(xfer) == 0))
+      return;
+  }
+  else if (xfer->status != LIBUSB_TRANSFER_CANCELLED) {
+    fprintf(stderr, "transfer failed, status %d\n", xfer->status);
+    stopping = 1;
+  }
+  in_flight--;
+}
+
+int main(int argc, char *argv[]) {
+  struct libusb_transfer *xfers[NUM_TRANSFERS];
+  libusb_device_handle *devh;
+  double seconds, t0, t;
+  int i, ret = 1;
+
+  seconds = (argc >= 2) ? atof(argv[1]) : 10.0;
+
+  if (libusb_init(NULL) != 0) {
+    fprintf(stderr, "libusb_init failed\n");
+    return 1;
+  }
+  devh = libusb_open_device_with_vid_pid(NULL, VENDOR_ID, PRODUCT_ID);
+  if (devh == NULL) {
+    fprintf(stderr, "device %04x:%04x not found\n", VENDOR_ID, PRODUCT_ID);
+    goto out_exit;
+  }
+  if (libusb_claim_interface(devh, DATA_INTERFACE) != 0) {
+    fprintf(stderr, "cannot claim interface %d\n", DATA_INTERFACE);
+    goto out_close;
+  }
+
+  tlmDecoderInit(&dec);
+  for (i = 0; i < NUM_TRANSFERS; i++) {
+    xfers[i] = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(xfers[i], devh, DATA_IN_EP,
+                              malloc(TRANSFER_SIZE), TRANSFER_SIZE,
+                              transfer_cb, NULL, 1000);
+    if (libusb_submit_transfer(xfers[i]) == 0)
+      in_flight++;
+  }
+
+  t0 = now();
+  while (in_flight > 0) {
+    struct timeval tv = { 0, 100000 };
+    libusb_handle_events_timeout(NULL, &tv);
+    t = now() - t0;
+    if (!stopping && (t >= seconds)) {
+      stopping = 1;
+      for (i = 0; i < NUM_TRANSFERS; i++)
+        libusb_cancel_transfer(xfers[i]);
+    }
+  }
+  t = now() - t0;
+
+  printf("time           %10.2f s\n", t);
+  printf("transfers      %10lu\n", total_transfers);
+  printf("bytes          %10llu  %.3f MB/s\n", total_bytes,
+         total_bytes / t / 1e6);
+  printf("frames         %10u  %.0f frames/s\n", dec.frames, dec.frames / t);
+  printf("errors         %10u crc, %u framing\n",
+         dec.crc_errors, dec.framing_errors);
+
+  for (i = 0; i < NUM_TRANSFERS; i++) {
+    free(xfers[i]->buffer);
+    libusb_free_transfer(xfers[i]);
+  }
+  libusb_release_interface(devh, DATA_INTERFACE);
+  ret = 0;
+out_close:
+  libusb_close(devh);
+out_exit:
+  libusb_exit(NULL);
+  return ret;
+}
@@ -0,0 +1,226 @@
+/*
+ * Host test of the vendor bulk driver in bulkusb.c, built on the simulated
+ * USB driver in usbsim/, no libusb nor hardware needed.
+ *
+ *   bulktest
+ *
+ * Checks that messages are packed into transfers and never split, that
+ * the start of frame flushes the buffer being filled, the zero length
+ * packet after a transfer of whole packets, the wait for a free buffer and
+ * its timeout, that nothing is queued unless the device is configured, and
+ * the receive side: one transfer at a time, the host NAKed until it is
+ * read. A random message stream must come out in order. Exits with a
+ * failure if a check did not pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "bulkusb.h"
+
+#define EP_BULK         3
+
+static USBDriver usb;
+static const BulkUSBConfig budcfg = { &usb, EP_BULK, EP_BULK };
+static BulkUSBDriver bud;
+
+static uint8_t written[SIM_DATA_SIZE];
+static size_t nwritten;
+
+/* End offsets of the messages, a transfer may only end on one.*/
+static size_t ends[SIM_LOG_SIZE];
+static unsigned nends;
+
+static unsigned failures = 0;
+
+static void check(int ok, const char *what) {
+  printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+static void setup(void) {
+
+  usbsimInit(&usb);
+  usb.ep[EP_BULK].in_cb = budDataTransmitted;
+  usb.ep[EP_BULK].out_cb = budDataReceived;
+  usbsim_wait_hook = NULL;
+  budObjectInit(&bud);
+  budStart(&bud, &budcfg);
+  budConfigureHookI(&bud);
+  nwritten = 0;
+  nends = 0;
+}
+
+/* The host polls the IN endpoint until it is idle.*/
+static void drain(void) {
+
+  while (usbsimCompleteIn(&usb, EP_BULK))
+    ;
+}
+
+static size_t put(size_t n, systime_t timeout) {
+  uint8_t msg[BULKUSB_TX_SIZE];
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    msg[i] = (uint8_t)((nwritten + i) * 13 + 5);
+  if (budWrite(&bud, msg, n, timeout) != n)
+    return 0;
+  memcpy(&written[nwritten], msg, n);
+  nwritten += n;
+  if (nends < SIM_LOG_SIZE)
+    ends[nends++] = nwritten;
+  return n;
+}
+
+static int transfers_are(const size_t *lens, unsigned n) {
+  unsigned i;
+
+  if (usb.transfers != n)
+    return 0;
+  for (i = 0; i < n; i++) {
+    if (usb.log_len[i] != lens[i])
+      return 0;
+  }
+  return 1;
+}
+
+static int all_bytes_out(void) {
+
+  return (usb.ndata == nwritten) && (memcmp(usb.data, written, nwritten) == 0);
+}
+
+static int no_split_message(void) {
+  size_t offset = 0;
+  unsigned i, j = 0;
+
+  for (i = 0; i < usb.transfers; i++) {
+    if (usb.log_len[i] == 0)
+      continue;
+    offset += usb.log_len[i];
+    while ((j < nends) && (ends[j] < offset))
+      j++;
+    if ((j == nends) || (ends[j] != offset))
+      return 0;
+  }
+  return 1;
+}
+
+int main(void) {
+
+  /* Messages fill a buffer, one that does not fit sends it.*/
+  {
+    static const size_t lens[] = { 500, 100 };
+    unsigned i;
+
+    setup();
+    for (i = 0; i < 5; i++)
+      put(100, TIME_IMMEDIATE);
+    check(usb.transfers == 0, "no transfer before SOF");
+    put(100, TIME_IMMEDIATE);
+    check(transfers_are(lens, 1), "full buffer sent as one transfer");
+    budSOFHookI(&bud);
+    check(transfers_are(lens, 1), "SOF waits for the endpoint");
+    drain();
+    budSOFHookI(&bud);
+    drain();
+    check(transfers_are(lens, 2) && all_bytes_out(), "partial buffer flushed at SOF");
+    check(!bud.txmtx.locked, "writer mutex released");
+  }
+
+  /* Whole packets are terminated by a zero length packet.*/
+  {
+    static const size_t lens[] = { 256, 0, 100 };
+    unsigned i;
+
+    setup();
+    for (i = 0; i < 4; i++)
+      put(64, TIME_IMMEDIATE);
+    budSOFHookI(&bud);
+    drain();
+    put(100, TIME_IMMEDIATE);
+    budSOFHookI(&bud);
+    drain();
+    check(transfers_are(lens, 3) && all_bytes_out(), "ZLP after 256 bytes");
+  }
+
+  /* Both buffers busy, the writer waits for the endpoint or times out.*/
+  {
+    setup();
+    put(BULKUSB_TX_SIZE, TIME_IMMEDIATE);
+    put(BULKUSB_TX_SIZE, TIME_IMMEDIATE);
+    check(put(1, 10) == 0, "timeout with both buffers busy");
+    check(!bud.txmtx.locked, "mutex released on timeout");
+    usbsim_wait_hook = drain;
+    check(put(1, TIME_INFINITE) == 1, "write once a buffer is free");
+    budSOFHookI(&bud);
+    drain();
+    budSOFHookI(&bud);
+    drain();
+    check(all_bytes_out() && (bud.tx_transfers == 3), "nothing lost meanwhile");
+  }
+
+  /* Nothing is queued unless configured.*/
+  {
+    setup();
+    usb.state = USB_SELECTED;
+    check((put(10, TIME_INFINITE) == 0) && !bud.txmtx.locked, "refused until configured");
+    usb.state = USB_ACTIVE;
+    budConfigureHookI(&bud);
+    check(put(10, TIME_INFINITE) == 10, "accepted once configured");
+  }
+
+  /* Random message sizes with the host reading at every frame.*/
+  {
+    unsigned f;
+
+    setup();
+    srand(1);
+    usbsim_wait_hook = drain;
+    for (f = 0; f < 1000; f++) {
+      unsigned k, n = (unsigned)rand() % 4;
+
+      for (k = 0; k < n; k++)
+        put(1 + (size_t)rand() % 200, TIME_INFINITE);
+      budSOFHookI(&bud);
+      drain();
+    }
+    budSOFHookI(&bud);
+    drain();
+    printf("  random stream: %u messages in %u transfers, %.1f bytes per transfer\n",
+           (unsigned)bud.tx_messages, (unsigned)bud.tx_transfers,
+           (double)bud.tx_bytes / bud.tx_transfers);
+    check(all_bytes_out(), "random stream in order");
+    check(no_split_message(), "messages never split");
+  }
+
+  /* Receive side.*/
+  {
+    uint8_t in[300], out[BULKUSB_RX_SIZE];
+    size_t i;
+
+    setup();
+    for (i = 0; i < sizeof(in); i++)
+      in[i] = (uint8_t)(i * 3);
+    check(budRead(&bud, out, sizeof(out), TIME_IMMEDIATE) == 0, "read timeout");
+    check(usbsimReceive(&usb, EP_BULK, in, 200), "OUT endpoint armed");
+    check(!usbsimReceive(&usb, EP_BULK, in, 10), "host NAKed until read");
+    check((budRead(&bud, out, sizeof(out), TIME_IMMEDIATE) == 200) &&
+          (memcmp(out, in, 200) == 0), "whole transfer read");
+    check(usbsimReceive(&usb, EP_BULK, in, sizeof(in)) &&
+          (budRead(&bud, out, sizeof(out), TIME_IMMEDIATE) == BULKUSB_RX_SIZE),
+          "transfer cut at the buffer size");
+    check(usbsimReceive(&usb, EP_BULK, in + 1, 100) &&
+          (budRead(&bud, out, 50, TIME_IMMEDIATE) == 50) &&
+          (memcmp(out, in + 1, 50) == 0), "excess discarded");
+    check(bud.rx_transfers == 3, "receive counters");
+  }
+
+  printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/*
+ * Host simulation of the clock mapping in clocksync.c.
+ *
+ *   clocksim [seconds] [seed]
+ *
+ * A module clock drifting by -50, 0 and +50 ppm streams a sample every
+ * millisecond, received with a random delay of 0.2 to 3.2 ms, and a sync
+ * frame every 100 ms with the SOF latch of the last bus frame, latched with
+ * up to 5 us of interrupt jitter. Each run is mapped with and without the
+ * sync frames, the mapping error after the first quarter is compared to
+ * the true host time of each sample. The module time wraps during the run.
+ * Exits with a failure if a mapping is off by more than the minimum delay
+ * plus 0.1 ms, or if the SOF rate is off by more than 1 ppm.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "clocksync.h"
+
+#define MIN_DELAY_S     0.2e-3
+#define MAX_DELAY_S     3.2e-3
+#define SOF_JITTER_S    5e-6
+
+static unsigned failures = 0;
+
+static double uniform(void) {
+
+  return (double)rand() / RAND_MAX;
+}
+
+/* Module time at host time h.*/
+static uint32_t module_us(double h, double drift) {
+
+  return (uint32_t)(int64_t)(0xFFB00000u + h * 1e6 * (1 + drift));
+}
+
+static void run(double seconds, double drift, int sync) {
+  ClockSync cs;
+  double h, err, max_err = 0, sum_err = 0, rate_err;
+  unsigned n = 0, k = 0;
+
+  csInit(&cs, 1.0);
+  for (h = 0; h < seconds; h += 1e-3, k++) {
+    uint32_t stamp = module_us(h, drift);
+
+    csUpdate(&cs, stamp, h + MIN_DELAY_S +
+             (MAX_DELAY_S - MIN_DELAY_S) * uniform());
+    if (sync && (k % 100 == 0)) {
+      uint32_t sof_us = module_us(k * 1e-3 + SOF_JITTER_S * uniform(), drift);
+
+      csSync(&cs, sof_us, (uint16_t)((k + 1500) & 0x7FF));
+    }
+
+    if (h >= seconds / 4) {
+      err = csToHost(&cs, stamp) - h;
+      sum_err += err;
+      if (fabs(err) > fabs(max_err))
+        max_err = err;
+      n++;
+    }
+  }
+
+  /* The offset falls by the drift per module microsecond.*/
+  rate_err = (cs.b + drift / (1 + drift)) * 1e6;
+  printf("%+4.0f ppm %-8s mean %7.3f ms  max %7.3f ms  rate %+8.3f ppm%s\n",
+         drift * 1e6, sync ? "sof" : "minima", sum_err / n * 1e3,
+         max_err * 1e3, rate_err, cs.sof_rate ? "" : " (fit)");
+
+  if (fabs(max_err) > MIN_DELAY_S + 0.1e-3) {
+    printf("  mapping error FAILED\n");
+    failures++;
+  }
+  if (sync && (!cs.sof_rate || (fabs(rate_err) > 1.0))) {
+    printf("  sof rate FAILED\n");
+    failures++;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  static const double drifts[] = { -50e-6, 0, 50e-6 };
+  double seconds = (argc > 1) ? atof(argv[1]) : 120;
+  unsigned i;
+
+  srand((argc > 2) ? (unsigned)atoi(argv[2]) : 1);
+  if (seconds < 8) {
+    fprintf(stderr, "usage: clocksim [seconds >= 8] [seed]\n");
+    return 2;
+  }
+
+  for (i = 0; i < sizeof(drifts) / sizeof(drifts[0]); i++) {
+    run(seconds, drifts[i], 0);
+    run(seconds, drifts[i], 1);
+  }
+
+  printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/*
+ * Host side mapping of module time to host time, see clocksync.h.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "clocksync.h"
+
+/*
+ * Rate from the oldest SOF pair kept with the window minima to the latest
+ * one, returns 0 if they do not span a window yet.
+ */
+static int sof_rate(ClockSync *csp, double *bp) {
+  double t = 0, ms = 0;
+  unsigned i;
+  int found = 0;
+
+  if (!csp->sof_started)
+    return 0;
+  for (i = 0; i < csp->npoints; i++) {
+    if (csp->pt_sof_valid[i] && (!found || (csp->pt_sof_t[i] < t))) {
+      t = csp->pt_sof_t[i];
+      ms = csp->pt_sof_ms[i];
+      found = 1;
+    }
+  }
+  if (!found || (csp->sof_t - t < csp->window))
+    return 0;
+  *bp = ((csp->sof_ms - ms) * 1e3 - (csp->sof_t - t)) / (csp->sof_t - t);
+  return 1;
+}
+
+static void fit(ClockSync *csp) {
+  double st = 0, so = 0, stt = 0, sto = 0, t, n = csp->npoints;
+  unsigned i;
+
+  csp->t0 = csp->pt_t[(csp->head + CS_POINTS - 1) % CS_POINTS];
+
+  /* Known rate, the least delayed window gives the offset.*/
+  csp->sof_rate = sof_rate(csp, &csp->b);
+  if (csp->sof_rate) {
+    csp->a = csp->pt_off[0] - csp->b * (csp->pt_t[0] - csp->t0);
+    for (i = 1; i < csp->npoints; i++) {
+      double a = csp->pt_off[i] - csp->b * (csp->pt_t[i] - csp->t0);
+      if (a < csp->a)
+        csp->a = a;
+    }
+    csp->valid = 1;
+    return;
+  }
+
+  for (i = 0; i < csp->npoints; i++) {
+    t = csp->pt_t[i] - csp->t0;
+    st += t;
+    so += csp->pt_off[i];
+    stt += t * t;
+    sto += t * csp->pt_off[i];
+  }
+  if ((csp->npoints >= 2) && (n * stt - st * st > 0)) {
+    csp->b = (n * sto - st * so) / (n * stt - st * st);
+    csp->a = (so - csp->b * st) / n;
+  }
+  else {
+    csp->b = 0;
+    csp->a = so / n;
+  }
+  csp->valid = 1;
+}
+
+void csInit(ClockSync *csp, double window_s) {
+
+  memset(csp, 0, sizeof(*csp));
+  csp->window = window_s * 1e6;
+}
+
+int64_t csUnwrap(ClockSync *csp, uint32_t stamp) {
+
+  if (!csp->started) {
+    csp->started = 1;
+    csp->last = stamp;
+  }
+  else
+    csp->last += (int32_t)(stamp - csp->last_raw);
+  csp->last_raw = stamp;
+  return csp->last;
+}
+
+void csUpdate(ClockSync *csp, uint32_t stamp, double host_s) {
+  int first = !csp->started;
+  double t = (double)csUnwrap(csp, stamp);
+  double off = host_s * 1e6 - t;
+
+  if (first || (t - csp->win_start >= csp->window)) {
+    if (!first) {
+      csp->pt_t[csp->head] = csp->win_at;
+      csp->pt_off[csp->head] = csp->win_min;
+      csp->pt_sof_t[csp->head] = csp->sof_t;
+      csp->pt_sof_ms[csp->head] = csp->sof_ms;
+      csp->pt_sof_valid[csp->head] = csp->sof_started;
+      csp->head = (csp->head + 1) % CS_POINTS;
+      if (csp->npoints < CS_POINTS)
+        csp->npoints++;
+      fit(csp);
+    }
+    csp->win_start = (int64_t)t;
+    csp->win_min = off;
+    csp->win_at = t;
+  }
+  else if (off < csp->win_min) {
+    csp->win_min = off;
+    csp->win_at = t;
+  }
+
+  /* Until the first window closes the running minimum is the estimate.*/
+  if (csp->npoints == 0) {
+    csp->t0 = t;
+    csp->a = csp->win_min;
+    csp->b = 0;
+    csp->valid = 1;
+  }
+}
+
+/*
+ * Takes a SOF pair from a sync frame. The latch is older than the frame
+ * stamp, it is unwrapped near the last stamp without moving it. The frame
+ * number wraps every 2048 ms, the module time elapsed tells how many times
+ * it did since the previous pair.
+ */
+void csSync(ClockSync *csp, uint32_t sof_us, uint16_t frame) {
+  double t, frames;
+
+  if (!csp->started)
+    return;
+  t = (double)(csp->last + (int32_t)(sof_us - csp->last_raw));
+  frame &= 0x7FF;
+
+  if (!csp->sof_started) {
+    csp->sof_started = 1;
+    csp->sof_ms = frame;
+  }
+  else {
+    /* No SOF since the previous pair, the bus is suspended.*/
+    if ((sof_us == csp->sof_raw) && (frame == csp->sof_frame))
+      return;
+    frames = (double)((frame - csp->sof_frame) & 0x7FF);
+    frames += 2048.0 * floor(((t - csp->sof_t) * 1e-3 - frames) / 2048.0 + 0.5);
+    csp->sof_ms += frames;
+  }
+  csp->sof_raw = sof_us;
+  csp->sof_frame = frame;
+  csp->sof_t = t;
+}
+
+double csToHost(ClockSync *csp, uint32_t stamp) {
+  double t = (double)csUnwrap(csp, stamp);
+
+  return (t + csp->a + csp->b * (t - csp->t0)) * 1e-6;
+}
@@ -0,0 +1,59 @@
+/*
+ * Host side mapping of module time to host time.
+ *
+ * Every received frame gives a pair (module stamp, host receive time); their
+ * difference is the clock offset plus a transport delay that is never
+ * negative. The smallest difference over each window is the best offset
+ * estimate for that window. Module stamps are unwrapped to 64 bits.
+ *
+ * The sync frames give a second kind of pair, the module time of a USB start
+ * of frame and its 11 bits frame number. Frames are sent exactly every
+ * millisecond by the host controller, so these pairs measure the module
+ * clock rate against the host bus clock with the jitter of the SOF interrupt
+ * only, no transport delay. Once they span a window the rate is taken from
+ * them and the offset is the lowest of the window minima corrected for that
+ * rate. Without sync frames the offset and the rate are fitted by least
+ * squares over the window minima.
+ */
+
+#ifndef _CLOCKSYNC_H_
+#define _CLOCKSYNC_H_
+
+#include <stdint.h>
+
+#define CS_POINTS       16
+
+typedef struct {
+  double    window;                     /* Window length, module us.         */
+  int       started;
+  uint32_t  last_raw;
+  int64_t   last;                       /* Unwrapped module time.            */
+  int64_t   win_start;
+  double    win_min;
+  double    win_at;
+  double    pt_t[CS_POINTS];            /* Window minima.                    */
+  double    pt_off[CS_POINTS];
+  double    pt_sof_t[CS_POINTS];        /* Last SOF pair of each window.     */
+  double    pt_sof_ms[CS_POINTS];
+  int       pt_sof_valid[CS_POINTS];
+  unsigned  npoints;
+  unsigned  head;
+  int       sof_started;                /* Last SOF pair, frames unwrapped.  */
+  uint32_t  sof_raw;
+  uint16_t  sof_frame;
+  double    sof_t;
+  double    sof_ms;
+  double    t0;                         /* Fit: offset = a + b * (t - t0).   */
+  double    a;
+  double    b;
+  int       sof_rate;                   /* Rate from the SOF pairs.          */
+  int       valid;
+} ClockSync;
+
+void csInit(ClockSync *csp, double window_s);
+int64_t csUnwrap(ClockSync *csp, uint32_t stamp);
+void csUpdate(ClockSync *csp, uint32_t stamp, double host_s);
+void csSync(ClockSync *csp, uint32_t sof_us, uint16_t frame);
+double csToHost(ClockSync *csp, uint32_t stamp);
+
+#endif /* _CLOCKSYNC_H_ */
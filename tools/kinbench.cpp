@@ -0,0 +1,250 @@
+/*
+ * Host test and benchmark of the kinematics templates in kinematics.hpp.
+ *
+ *   kinbench [iterations]
+ *
+ * Checks the differential and omni-3 templates, float and Q16, against the
+ * macro code they replaced in main.cpp and main_triskar.cpp, and checks that
+ * forward() inverts inverse() for all the bases. Then times the inverse
+ * kinematics of each. Exits with a failure if a check did not pass.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "kinematics.hpp"
+
+/* Macro code, as it was in main.cpp without the mirrored motor sign.*/
+#define _L2       0.400f
+#define _R2       0.05f
+
+static void macro_differential(float x, float w, float dth[2]) {
+	dth[0] = (1 / _R2) * (x + (_L2 / 2) * w);
+	dth[1] = (1 / _R2) * (x - (_L2 / 2) * w);
+}
+
+/* Macro code, as it was in main_triskar.cpp.*/
+#define _L3       0.160f
+#define _R3       0.035f
+#define _m1_R     (-1.0f / _R3)
+#define _mL_R     (-_L3 / _R3)
+#define _C60_R    (0.500000000f / _R3)
+#define _C30_R    (0.866025404f / _R3)
+
+static void macro_omni3(float x, float y, float w, float dth[3]) {
+	const float dthz123 = _mL_R * w;
+	const float dx12 = _C60_R * y;
+	const float dy12 = _C30_R * x;
+
+	dth[0] = dx12 - dy12 + dthz123;
+	dth[1] = dx12 + dy12 + dthz123;
+	dth[2] = _m1_R * y + dthz123;
+}
+
+typedef DifferentialKinematics<float, 400000, 50000> Differential;
+typedef DifferentialKinematics<Q16, 400000, 50000> DifferentialQ16;
+typedef Omni3Kinematics<float, 160000, 35000> Omni3;
+typedef Omni3Kinematics<Q16, 160000, 35000> Omni3Q16;
+typedef MecanumKinematics<float, 150000, 200000, 50000> Mecanum;
+typedef MecanumKinematics<Q16, 150000, 200000, 50000> MecanumQ16;
+
+static float random_speed(float max) {
+	return ((float) rand() / RAND_MAX * 2.0f - 1.0f) * max;
+}
+
+static BodyVelocity<Q16> to_q16(const BodyVelocity<float> & v) {
+	BodyVelocity<Q16> q = { Q16(v.x), Q16(v.y), Q16(v.w) };
+	return q;
+}
+
+/*
+ * Largest difference between the wheel speeds and the reference.
+ */
+template<unsigned N> static float diff(const float dth[N], const float ref[N]) {
+	float d = 0.0f;
+
+	for (unsigned i = 0; i < N; i++)
+		d = fmaxf(d, fabsf(dth[i] - ref[i]));
+	return d;
+}
+
+template<unsigned N> static float diff(const Q16 dth[N], const float ref[N]) {
+	float d = 0.0f;
+
+	for (unsigned i = 0; i < N; i++)
+		d = fmaxf(d, fabsf(dth[i].to_float() - ref[i]));
+	return d;
+}
+
+static float diff(const BodyVelocity<float> & v, const BodyVelocity<float> & ref) {
+	return fmaxf(fabsf(v.x - ref.x), fmaxf(fabsf(v.y - ref.y), fabsf(v.w - ref.w)));
+}
+
+static float diff(const BodyVelocity<Q16> & v, const BodyVelocity<float> & ref) {
+	BodyVelocity<float> f = { v.x.to_float(), v.y.to_float(), v.w.to_float() };
+	return diff(f, ref);
+}
+
+/*
+ * Largest forward(inverse(v)) error over random velocities.
+ */
+template<typename K, typename T> static float roundtrip(bool planar, T (*convert)(const BodyVelocity<float> &)) {
+	float d = 0.0f;
+
+	for (unsigned i = 0; i < 100000; i++) {
+		BodyVelocity<float> v = { random_speed(2.0f), planar ? 0.0f : random_speed(2.0f), random_speed(4.0f) };
+		typename K::Number dth[K::NUM_WHEELS];
+		T back;
+
+		K::inverse(convert(v), dth);
+		K::forward(dth, back);
+		d = fmaxf(d, diff(back, v));
+	}
+	return d;
+}
+
+static BodyVelocity<float> to_float(const BodyVelocity<float> & v) {
+	return v;
+}
+
+/*
+ * Nanoseconds per call of fn over n random velocities, the outputs are
+ * accumulated into sink so that the calls are not optimized away.
+ */
+template<typename Fn> static double time_ns(Fn fn, unsigned n, volatile float & sink) {
+	clock_t start = clock();
+	float acc = 0.0f;
+
+	for (unsigned i = 0; i < n; i++)
+		acc += fn((float) (i & 0xFF) * 0.01f, (float) ((i >> 8) & 0xFF) * 0.01f, 0.5f);
+	sink = acc;
+	return (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / n;
+}
+
+static float bench_macro_differential(float x, float, float w) {
+	float dth[2];
+
+	macro_differential(x, w, dth);
+	return dth[0] + dth[1];
+}
+
+static float bench_differential(float x, float y, float w) {
+	BodyVelocity<float> v = { x, y, w };
+	float dth[2];
+
+	Differential::inverse(v, dth);
+	return dth[0] + dth[1];
+}
+
+static float bench_differential_q16(float x, float y, float w) {
+	BodyVelocity<float> f = { x, y, w };
+	Q16 dth[2];
+
+	DifferentialQ16::inverse(to_q16(f), dth);
+	return (float) (dth[0].raw + dth[1].raw);
+}
+
+static float bench_macro_omni3(float x, float y, float w) {
+	float dth[3];
+
+	macro_omni3(x, y, w, dth);
+	return dth[0] + dth[1] + dth[2];
+}
+
+static float bench_omni3(float x, float y, float w) {
+	BodyVelocity<float> v = { x, y, w };
+	float dth[3];
+
+	Omni3::inverse(v, dth);
+	return dth[0] + dth[1] + dth[2];
+}
+
+static float bench_omni3_q16(float x, float y, float w) {
+	BodyVelocity<float> f = { x, y, w };
+	Q16 dth[3];
+
+	Omni3Q16::inverse(to_q16(f), dth);
+	return (float) (dth[0].raw + dth[1].raw + dth[2].raw);
+}
+
+static float bench_mecanum(float x, float y, float w) {
+	BodyVelocity<float> v = { x, y, w };
+	float dth[4];
+
+	Mecanum::inverse(v, dth);
+	return dth[0] + dth[1] + dth[2] + dth[3];
+}
+
+static float bench_mecanum_q16(float x, float y, float w) {
+	BodyVelocity<float> f = { x, y, w };
+	Q16 dth[4];
+
+	MecanumQ16::inverse(to_q16(f), dth);
+	return (float) (dth[0].raw + dth[1].raw + dth[2].raw + dth[3].raw);
+}
+
+int main(int argc, char * argv[]) {
+	unsigned n = (argc >= 2) ? (unsigned) atoi(argv[1]) : 10000000;
+	float d2 = 0.0f, d2q = 0.0f, d3 = 0.0f, d3q = 0.0f;
+	float rt2, rt2q, rt3, rt3q, rtm, rtmq;
+	volatile float sink;
+	bool ok;
+
+	if (n == 0) {
+		fprintf(stderr, "iterations must be positive\n");
+		return 2;
+	}
+
+	srand(1);
+	for (unsigned i = 0; i < 100000; i++) {
+		BodyVelocity<float> v = { random_speed(2.0f), random_speed(2.0f), random_speed(4.0f) };
+		BodyVelocity<Q16> q = to_q16(v);
+		float ref2[2], ref3[3];
+		float dth2[2], dth3[3];
+		Q16 dth2q[2], dth3q[3];
+
+		macro_differential(v.x, v.w, ref2);
+		Differential::inverse(v, dth2);
+		DifferentialQ16::inverse(q, dth2q);
+		d2 = fmaxf(d2, diff<2>(dth2, ref2));
+		d2q = fmaxf(d2q, diff<2>(dth2q, ref2));
+
+		macro_omni3(v.x, v.y, v.w, ref3);
+		Omni3::inverse(v, dth3);
+		Omni3Q16::inverse(q, dth3q);
+		d3 = fmaxf(d3, diff<3>(dth3, ref3));
+		d3q = fmaxf(d3q, diff<3>(dth3q, ref3));
+	}
+
+	rt2 = roundtrip<Differential, BodyVelocity<float> >(true, to_float);
+	rt2q = roundtrip<DifferentialQ16, BodyVelocity<Q16> >(true, to_q16);
+	rt3 = roundtrip<Omni3, BodyVelocity<float> >(false, to_float);
+	rt3q = roundtrip<Omni3Q16, BodyVelocity<Q16> >(false, to_q16);
+	rtm = roundtrip<Mecanum, BodyVelocity<float> >(false, to_float);
+	rtmq = roundtrip<MecanumQ16, BodyVelocity<Q16> >(false, to_q16);
+
+	printf("                 vs macro [rad/s]  roundtrip\n");
+	printf("differential     %9.2e          %9.2e\n", d2, rt2);
+	printf("differential q16 %9.2e          %9.2e\n", d2q, rt2q);
+	printf("omni3            %9.2e          %9.2e\n", d3, rt3);
+	printf("omni3 q16        %9.2e          %9.2e\n", d3q, rt3q);
+	printf("mecanum                             %9.2e\n", rtm);
+	printf("mecanum q16                         %9.2e\n", rtmq);
+
+	/* Float within rounding of the macros, Q16 within a few LSB.*/
+	ok = (d2 < 1e-4f) && (d3 < 1e-4f) && (d2q < 1e-3f) && (d3q < 1e-3f);
+	ok = ok && (rt2 < 1e-5f) && (rt3 < 1e-5f) && (rtm < 1e-5f);
+	ok = ok && (rt2q < 1e-4f) && (rt3q < 1e-4f) && (rtmq < 1e-4f);
+
+	printf("inverse [ns]     macro     float       q16\n");
+	printf("differential %9.1f %9.1f %9.1f\n", time_ns(bench_macro_differential, n, sink),
+			time_ns(bench_differential, n, sink), time_ns(bench_differential_q16, n, sink));
+	printf("omni3        %9.1f %9.1f %9.1f\n", time_ns(bench_macro_omni3, n, sink), time_ns(bench_omni3, n, sink),
+			time_ns(bench_omni3_q16, n, sink));
+	printf("mecanum      %9s %9.1f %9.1f\n", "", time_ns(bench_mecanum, n, sink), time_ns(bench_mecanum_q16, n, sink));
+
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+/*
+ * Host test of the Odometry integrator in odometry.hpp.
+ *
+ *   odomtest                     synthetic runs, exits with a failure if
+ *                                the drift is above the limits
+ *   odomtest <log> [imu_gain]    replays a tlmdump log
+ *
+ * The synthetic runs drive the differential base of main.cpp along a
+ * square, a circle and a slalom, sample the wheel angles at about 100 Hz
+ * with jittered periods and the encoder resolution, and compare the
+ * integrated pose with the exact one. A last run makes the right wheel 1%
+ * smaller than the nominal radius and checks that fusing a noisy IMU yaw
+ * removes the heading drift. Euler integration is shown for reference.
+ *
+ * A log is the tlmdump output of a module streaming the encoder2 and imu
+ * topics; the final pose and the path length are printed, so a run that
+ * ends where it started shows the drift.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "odometry.hpp"
+
+/* Geometry of main.cpp.*/
+#define TRACK_UM        400000
+#define RADIUS_UM       50000
+#define TRACK           (TRACK_UM / 1e6)
+#define RADIUS          (RADIUS_UM / 1e6)
+
+/* Encoder resolution, 64 ticks per motor turn and a 29:1 gearbox.*/
+#define TICK            (2.0 * M_PI / (64 * 29))
+
+typedef DifferentialKinematics<float, TRACK_UM, RADIUS_UM> Kinematics;
+
+struct Segment {
+	double v;
+	double w;
+	double t;
+};
+
+struct Result {
+	double pos_error;
+	double theta_error;
+	double euler_pos_error;
+	double length;
+};
+
+static double wrap(double angle) {
+	return atan2(sin(angle), cos(angle));
+}
+
+static double gaussian(void) {
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/*
+ * Robot driven at 1 kHz, the right wheel slipping by right_scale, feeding
+ * the odometry with the quantized wheel increments every 8 to 12 ms, and
+ * with the IMU yaw plus noise if imu_noise is not negative.
+ */
+struct Simulation {
+	Odometry<Kinematics> odometry;
+	double right_scale;
+	double imu_noise;
+	double tx, ty, ttheta;
+	double ex, ey, etheta;
+	double angle[2];
+	long ticks[2];
+	unsigned next_sample;
+	unsigned since;
+	double length;
+
+	Simulation(double right_scale, float imu_gain, double imu_noise) :
+			odometry(imu_gain), right_scale(right_scale), imu_noise(imu_noise), tx(0.0), ty(0.0), ttheta(0.0),
+			ex(0.0), ey(0.0), etheta(0.0), next_sample(10), since(0), length(0.0) {
+		angle[0] = angle[1] = 0.0;
+		ticks[0] = ticks[1] = 0;
+	}
+
+	void step(double v, double w) {
+		const double dt = 0.001;
+		double dtheta = w * dt;
+
+		/* Exact arc.*/
+		if (fabs(dtheta) > 1e-12) {
+			tx += v / w * (sin(ttheta + dtheta) - sin(ttheta));
+			ty -= v / w * (cos(ttheta + dtheta) - cos(ttheta));
+		} else {
+			tx += v * dt * cos(ttheta);
+			ty += v * dt * sin(ttheta);
+		}
+		ttheta += dtheta;
+		length += fabs(v) * dt;
+
+		/* The encoder turns with the wheel, the slip scales the distance.*/
+		angle[0] += (v + TRACK / 2 * w) * dt / (RADIUS * right_scale);
+		angle[1] += (v - TRACK / 2 * w) * dt / RADIUS;
+
+		if (++since >= next_sample)
+			sample();
+	}
+
+	void sample() {
+		BodyVelocity<float> d;
+		float delta[2];
+
+		for (unsigned k = 0; k < 2; k++) {
+			long now = (long) floor(angle[k] / TICK);
+
+			delta[k] = (float) ((now - ticks[k]) * TICK);
+			ticks[k] = now;
+		}
+
+		if (imu_noise >= 0.0)
+			odometry.imu((float) (wrap(ttheta) + imu_noise * gaussian()));
+		odometry.update(delta, since * 0.001f);
+
+		/* Euler, for reference.*/
+		Kinematics::forward(delta, d);
+		ex += d.x * cos(etheta);
+		ey += d.x * sin(etheta);
+		etheta += d.w;
+
+		since = 0;
+		next_sample = 8 + rand() % 5;
+	}
+};
+
+static Result simulate(const Segment * segments, unsigned count, double right_scale, float imu_gain,
+		double imu_noise) {
+	Simulation sim(right_scale, imu_gain, imu_noise);
+	Result result;
+
+	for (unsigned s = 0; s < count; s++) {
+		unsigned steps = (unsigned) (segments[s].t * 1000.0 + 0.5);
+
+		for (unsigned i = 0; i < steps; i++)
+			sim.step(segments[s].v, segments[s].w);
+	}
+	if (sim.since > 0)
+		sim.sample();
+
+	result.pos_error = hypot(sim.odometry.pose.x - sim.tx, sim.odometry.pose.y - sim.ty);
+	result.theta_error = fabs(wrap(sim.odometry.pose.theta - sim.ttheta));
+	result.euler_pos_error = hypot(sim.ex - sim.tx, sim.ey - sim.ty);
+	result.length = sim.length;
+	return result;
+}
+
+static int replay(const char * path, float imu_gain) {
+	Odometry<Kinematics> odometry(imu_gain);
+	FILE * f = fopen(path, "r");
+	char line[256];
+	double last = -1.0;
+	double length = 0.0;
+
+	if (f == NULL) {
+		perror(path);
+		return 2;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		double stamp;
+		char topic[16];
+		unsigned seq;
+		float a, b, c;
+		int n = sscanf(line, "%lf %15s %u %f %f %f", &stamp, topic, &seq, &a, &b, &c);
+
+		if ((n == 6) && (strcmp(topic, "imu") == 0)) {
+			odometry.imu(c);
+		} else if ((n >= 5) && (strcmp(topic, "encoder2") == 0)) {
+			/* Motor 2 is mirrored, as in the firmware.*/
+			float delta[2] = { a, -b };
+			float x = odometry.pose.x, y = odometry.pose.y;
+
+			odometry.update(delta, (last >= 0.0) ? (float) (stamp - last) : 0.0f);
+			length += hypot(odometry.pose.x - x, odometry.pose.y - y);
+			last = stamp;
+		}
+	}
+	fclose(f);
+
+	printf("samples %u, path %.3f m\n", odometry.samples, length);
+	printf("final pose %.4f m %.4f m %.2f deg\n", odometry.pose.x, odometry.pose.y,
+			odometry.pose.theta * 180.0 / M_PI);
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	static const Segment square[] = { { 0.5, 0.0, 4.0 }, { 0.0, M_PI / 4, 2.0 }, { 0.5, 0.0, 4.0 }, { 0.0, M_PI / 4, 2.0 },
+			{ 0.5, 0.0, 4.0 }, { 0.0, M_PI / 4, 2.0 }, { 0.5, 0.0, 4.0 }, { 0.0, M_PI / 4, 2.0 } };
+	static const Segment circle[] = { { 0.5, 0.5, 4 * M_PI } };
+	static const Segment slalom[] = { { 0.6, 1.2, 1.5 }, { 0.6, -1.2, 3.0 }, { 0.6, 1.2, 3.0 }, { 0.6, -1.2, 3.0 },
+			{ 0.6, 1.2, 1.5 }, { -0.4, 0.0, 5.0 } };
+	struct Run {
+		const char * name;
+		const Segment * segments;
+		unsigned count;
+	} runs[] = { { "square", square, sizeof(square) / sizeof(square[0]) }, { "circle", circle, 1 }, { "slalom",
+			slalom, sizeof(slalom) / sizeof(slalom[0]) } };
+	Result slip, fused;
+	bool ok = true;
+
+	if (argc >= 2)
+		return replay(argv[1], (argc >= 3) ? (float) atof(argv[2]) : 0.0f);
+
+	srand(1);
+	printf("run          path [m]  error [mm]  heading [deg]  euler [mm]\n");
+	for (unsigned i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		Result r = simulate(runs[i].segments, runs[i].count, 1.0, 0.0f, -1.0);
+
+		printf("%-12s %8.2f %11.2f %14.3f %11.2f\n", runs[i].name, r.length, r.pos_error * 1e3,
+				r.theta_error * 180.0 / M_PI, r.euler_pos_error * 1e3);
+		/* Only the encoder quantization is left.*/
+		ok = ok && (r.pos_error < 0.005) && (r.theta_error < 0.2 * M_PI / 180.0);
+	}
+
+	slip = simulate(square, sizeof(square) / sizeof(square[0]), 0.99, 0.0f, -1.0);
+	fused = simulate(square, sizeof(square) / sizeof(square[0]), 0.99, 0.05f, 0.01);
+	printf("%-12s %8.2f %11.2f %14.3f\n", "slip", slip.length, slip.pos_error * 1e3, slip.theta_error * 180.0 / M_PI);
+	printf("%-12s %8.2f %11.2f %14.3f\n", "slip + imu", fused.length, fused.pos_error * 1e3,
+			fused.theta_error * 180.0 / M_PI);
+	ok = ok && (fused.theta_error < 1.0 * M_PI / 180.0) && (fused.pos_error < slip.pos_error);
+
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
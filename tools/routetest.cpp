@@ -0,0 +1,166 @@
+/*
+ * Host test of the RoutingTable in routing.hpp.
+ *
+ *   routetest
+ *
+ * Checks first match precedence and wildcards, the decimation ratio, the
+ * rate limiter on a jittered 1 kHz stream, in bursts and after a pause,
+ * that topics sharing a wildcard route and the two directions of a topic
+ * are limited apart, and that edits bump the generation. Exits with a
+ * failure if a check did not pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "routing.hpp"
+
+static unsigned failures = 0;
+
+static void check(bool ok, const char * what) {
+	printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		failures++;
+}
+
+/*
+ * Messages of a topic forwarded out of count, stamped every period_us plus
+ * up to jitter_us.
+ */
+static unsigned stream(RoutingTable & table, RouteState & state, unsigned count, uint32_t & now, uint32_t period_us,
+		uint32_t jitter_us) {
+	unsigned forwarded = 0;
+
+	for (unsigned i = 0; i < count; i++) {
+		now += period_us + ((jitter_us > 0) ? (uint32_t) rand() % jitter_us : 0);
+		if (table.forward(state, now))
+			forwarded++;
+	}
+	return forwarded;
+}
+
+static RouteState resolved(const RoutingTable & table, const char * topic, const char * transport) {
+	RouteState state;
+
+	table.resolve(state, topic, transport);
+	return state;
+}
+
+int main(void) {
+	static const RouteConfig defaults[] = {
+		{ "imu_raw", "*", false, 0, 0 },
+		{ "encoder*", "SDU2", true, 100, 0 },
+		{ "proximity", "SDU2", true, 0, 4 },
+		{ "*", "RTCAN", true, 0, 0 },
+	};
+	Route routes[8];
+	RoutingTable table(routes, 8);
+	RouteState state;
+	uint32_t generation;
+	uint32_t now = 0xFFF00000; /* Wraps during the test.*/
+	unsigned n;
+
+	srand(1);
+	table.load(defaults, sizeof(defaults) / sizeof(defaults[0]));
+
+	check(!table.allowed("imu_raw", "SDU2") && !table.allowed("imu_raw", "RTCAN"), "deny on any transport");
+	check(table.find("encoder2", "SDU2") == 1, "prefix match");
+	check(table.find("encoder2", "RTCAN") == 3, "transport match");
+	check(table.find("pose", "SDU2") < 0 && table.allowed("pose", "SDU2"), "unlisted topics cross");
+	check(table.find("encoder", "RTCAN") == 3 && table.find("imu_raw", "RTCAN") == 0, "first match wins");
+
+	state = resolved(table, "imu_raw", "SDU2");
+	n = stream(table, state, 100, now, 1000, 0);
+	check((n == 0) && (table[state.route].denied == 100), "denied messages counted");
+
+	state = resolved(table, "proximity", "SDU2");
+	n = stream(table, state, 1000, now, 1000, 0);
+	check((n == 250) && (table[state.route].decimated == 750), "decimation 1/4");
+
+	/* 1 kHz with up to 0.5 ms of jitter into a 100 Hz route.*/
+	state = resolved(table, "encoder1", "SDU2");
+	n = stream(table, state, 10000, now, 1000, 500);
+	{
+		double seconds = 10000 * 1.25e-3;
+		double rate = n / seconds;
+
+		printf("  jittered stream: %u of 10000 forwarded, %.1f Hz\n", n, rate);
+		check((rate > 95.0) && (rate <= 100.5), "rate limit under jitter");
+	}
+	check(table[state.route].forwarded + table[state.route].limited == 10000, "rate counters");
+
+	/* A burst is cut to one message, no catching up after a pause.*/
+	now += 5000000;
+	n = stream(table, state, 100, now, 10, 0);
+	check(n == 1, "no burst after a pause");
+
+	/*
+	 * Three topics published in turn on one wildcard route, each at 1 kHz:
+	 * every one gets the route rate, and with decimation every one gets
+	 * its share.
+	 */
+	{
+		RouteState encoders[3];
+		unsigned counts[3] = { 0, 0, 0 };
+		static const char * const names[3] = { "encoder1", "encoder2", "encoder3" };
+		bool fair = true;
+
+		for (unsigned k = 0; k < 3; k++)
+			encoders[k] = resolved(table, names[k], "SDU2");
+		for (unsigned i = 0; i < 3000; i++) {
+			now += 333;
+			if (table.forward(encoders[i % 3], now))
+				counts[i % 3]++;
+		}
+		printf("  wildcard rate: %u %u %u of 1000 each\n", counts[0], counts[1], counts[2]);
+		for (unsigned k = 0; k < 3; k++)
+			fair = fair && (counts[k] >= 99) && (counts[k] <= 101);
+		check(fair, "wildcard route rate per topic");
+
+		table.insert(0, "wheel*", "*", true, 0, 3);
+		for (unsigned k = 0; k < 3; k++) {
+			char name[8] = "wheel0";
+
+			name[5] = (char) ('1' + k);
+			encoders[k] = resolved(table, name, "SDU2");
+			counts[k] = 0;
+		}
+		for (unsigned i = 0; i < 3000; i++) {
+			if (table.forward(encoders[i % 3], now))
+				counts[i % 3]++;
+		}
+		printf("  wildcard decimation: %u %u %u of 1000 each\n", counts[0], counts[1], counts[2]);
+		check((counts[0] == 334) && (counts[1] == 334) && (counts[2] == 334), "wildcard route decimation per topic");
+		table.remove(0);
+	}
+
+	/* Inbound traffic does not use the outbound budget.*/
+	{
+		RouteState out = resolved(table, "encoder2", "SDU2");
+		RouteState in = resolved(table, "encoder2", "SDU2");
+		unsigned n_out = 0, n_in = 0;
+
+		for (unsigned i = 0; i < 1000; i++) {
+			now += 1000;
+			n_in += table.forward(in, now) ? 1 : 0;
+			n_out += table.forward(out, now) ? 1 : 0;
+		}
+		check((n_in == 100) && (n_out == 100), "directions limited apart");
+	}
+
+	generation = table.generation;
+	check(table.insert(0, "encoder2", "SDU2", false) && (table.generation != generation), "insert bumps generation");
+	check(!table.allowed("encoder2", "SDU2") && table.allowed("encoder1", "SDU2"), "added route overrides");
+	generation = table.generation;
+	check(table.remove(0) && (table.generation != generation) && table.allowed("encoder2", "SDU2"), "remove");
+	check(!table.remove(table.size()), "remove out of range");
+	while (table.size() < 8)
+		table.insert(table.size(), "x", "*", true);
+	check(!table.insert(0, "y", "*", true), "full table");
+
+	table.clear_counters();
+	check(table[0].denied == 0 && table[1].forwarded == 0, "clear counters");
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*
+ * Host test and benchmark of the WheelSaturation template in saturation.hpp.
+ *
+ *   sattest [iterations]
+ *
+ * Applies random commands, half of them beyond the wheel limits, to the
+ * differential and omni-3 bases of main.cpp and main_triskar.cpp with every
+ * priority and checks that:
+ * - no wheel exceeds the limit and commands within it are left alone,
+ * - uniform saturation only scales the body velocity, so its direction is
+ *   kept, and no smaller scale than needed is applied,
+ * - rotation (translation) first keeps the rotation (translation) whenever
+ *   it fits alone, and scales the other part only.
+ * Then times apply() against the former per wheel clamp. Exits with a
+ * failure if a check did not pass.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "saturation.hpp"
+
+#define MAX_DTH         52.0f
+
+typedef DifferentialKinematics<float, 400000, 50000> Differential;
+typedef Omni3Kinematics<float, 160000, 35000> Omni3;
+
+static const char * const priorities[] = { "uniform", "rotation", "translation" };
+
+static float random_speed(float max) {
+	return ((float) rand() / RAND_MAX * 2.0f - 1.0f) * max;
+}
+
+static bool close(float a, float b) {
+	return fabsf(a - b) <= 1e-4f * (1.0f + fabsf(a) + fabsf(b));
+}
+
+template<typename K> static unsigned check(SaturationPriority priority, bool planar) {
+	WheelSaturation<K> sat(MAX_DTH, priority);
+	unsigned failures = 0;
+
+	for (unsigned n = 0; n < 200000; n++) {
+		BodyVelocity<float> v = { random_speed(4.0f), planar ? 0.0f : random_speed(4.0f), random_speed(20.0f) };
+		float raw[K::NUM_WHEELS], dth[K::NUM_WHEELS];
+		BodyVelocity<float> out, trans = { v.x, v.y, 0.0f }, rot = { 0.0f, 0.0f, v.w };
+		float peak = 0.0f, peak_rot = 0.0f, peak_trans = 0.0f;
+		float tmp[K::NUM_WHEELS];
+		bool ok = true;
+		bool within;
+
+		K::inverse(v, raw);
+		for (unsigned i = 0; i < K::NUM_WHEELS; i++)
+			peak = fmaxf(peak, fabsf(raw[i]));
+		K::inverse(rot, tmp);
+		for (unsigned i = 0; i < K::NUM_WHEELS; i++)
+			peak_rot = fmaxf(peak_rot, fabsf(tmp[i]));
+		K::inverse(trans, tmp);
+		for (unsigned i = 0; i < K::NUM_WHEELS; i++)
+			peak_trans = fmaxf(peak_trans, fabsf(tmp[i]));
+
+		within = sat.apply(v, dth);
+		K::forward(dth, out);
+
+		for (unsigned i = 0; i < K::NUM_WHEELS; i++)
+			ok = ok && (fabsf(dth[i]) <= MAX_DTH * (1.0f + 1e-5f));
+		if (peak <= MAX_DTH) {
+			ok = ok && within;
+			for (unsigned i = 0; i < K::NUM_WHEELS; i++)
+				ok = ok && (dth[i] == raw[i]);
+		}
+
+		switch (priority) {
+		case SATURATE_UNIFORM: {
+			float k = (peak > MAX_DTH) ? MAX_DTH / peak : 1.0f;
+
+			ok = ok && close(out.x, k * v.x) && close(out.y, k * v.y) && close(out.w, k * v.w);
+			break;
+		}
+		case SATURATE_ROTATION_FIRST:
+			if (peak_rot <= MAX_DTH)
+				ok = ok && close(out.w, v.w);
+			/* Translation scaled, its direction kept.*/
+			ok = ok && close(out.x * v.y, out.y * v.x);
+			break;
+		case SATURATE_TRANSLATION_FIRST:
+			if (peak_trans <= MAX_DTH)
+				ok = ok && close(out.x, v.x) && close(out.y, v.y);
+			break;
+		}
+
+		if (!ok) {
+			if (failures++ < 5) {
+				printf("  %s: %f %f %f -> %f %f %f\n", priorities[priority], v.x, v.y, v.w, out.x, out.y, out.w);
+			}
+		}
+	}
+
+	return failures;
+}
+
+/* Former per wheel clamp of main_triskar.cpp.*/
+static float bench_clamp(float x, float y, float w) {
+	BodyVelocity<float> v = { x, y, w };
+	float dth[3];
+
+	Omni3::inverse(v, dth);
+	for (unsigned i = 0; i < 3; i++)
+		dth[i] = (dth[i] < -MAX_DTH) ? -MAX_DTH : ((dth[i] > MAX_DTH) ? MAX_DTH : dth[i]);
+	return dth[0] + dth[1] + dth[2];
+}
+
+static SaturationPriority bench_priority;
+
+static float bench_saturation(float x, float y, float w) {
+	static WheelSaturation<Omni3> sat(MAX_DTH);
+	BodyVelocity<float> v = { x, y, w };
+	float dth[3];
+
+	sat.priority = bench_priority;
+	sat.apply(v, dth);
+	return dth[0] + dth[1] + dth[2];
+}
+
+static double time_ns(float (*fn)(float, float, float), unsigned n) {
+	clock_t start = clock();
+	volatile float sink;
+	float acc = 0.0f;
+
+	for (unsigned i = 0; i < n; i++)
+		acc += fn((float) (i & 0xFF) * 0.02f, (float) ((i >> 8) & 0xFF) * 0.02f, (float) ((i >> 4) & 0xFF) * 0.05f);
+	sink = acc;
+	(void) sink;
+	return (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / n;
+}
+
+int main(int argc, char * argv[]) {
+	unsigned n = (argc >= 2) ? (unsigned) atoi(argv[1]) : 10000000;
+	unsigned failures = 0;
+
+	if (n == 0) {
+		fprintf(stderr, "iterations must be positive\n");
+		return 2;
+	}
+
+	srand(1);
+	for (unsigned p = 0; p < 3; p++) {
+		unsigned f2 = check<Differential>((SaturationPriority) p, true);
+		unsigned f3 = check<Omni3>((SaturationPriority) p, false);
+
+		printf("%-12s differential %u failures, omni3 %u failures\n", priorities[p], f2, f3);
+		failures += f2 + f3;
+	}
+
+	printf("omni3 [ns]   clamp %.1f", time_ns(bench_clamp, n));
+	for (unsigned p = 0; p < 3; p++) {
+		bench_priority = (SaturationPriority) p;
+		printf(", %s %.1f", priorities[p], time_ns(bench_saturation, n));
+	}
+	printf("\n");
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}
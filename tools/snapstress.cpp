@@ -0,0 +1,144 @@
+/*
+ * Host stress test of the Snapshot template in snapshot.hpp.
+ *
+ *   snapstress [seconds] [readers]
+ *
+ * A writer thread publishes structs whose fields all hold the same counter
+ * while the reader threads check every copy they get. The same run is then
+ * repeated on an unprotected struct, showing that the check does catch
+ * torn reads. Exits with a failure if a Snapshot read was ever torn.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "snapshot.hpp"
+
+struct Sample {
+	uint32_t a;
+	float roll;
+	float pitch;
+	float yaw;
+	uint32_t pad[8];
+	uint32_t b;
+};
+
+static Snapshot<Sample> snapshot;
+static Sample plain;
+static volatile int stop;
+static int use_snapshot;
+
+struct ReaderStats {
+	unsigned long reads;
+	unsigned long torn;
+	unsigned long updates;
+};
+
+static void fill(Sample & s, uint32_t n) {
+	s.a = n;
+	s.roll = (float) n;
+	s.pitch = (float) n;
+	s.yaw = (float) n;
+	for (unsigned i = 0; i < 8; i++)
+		s.pad[i] = n;
+	s.b = n;
+}
+
+static bool consistent(const Sample & s) {
+	if ((s.roll != (float) s.a) || (s.pitch != (float) s.a) || (s.yaw != (float) s.a) || (s.b != s.a))
+		return false;
+	for (unsigned i = 0; i < 8; i++)
+		if (s.pad[i] != s.a)
+			return false;
+	return true;
+}
+
+static void * writer(void * arg) {
+	Sample s;
+	uint32_t n = 0;
+
+	(void) arg;
+	while (!stop) {
+		/* Small counts keep the float conversions exact.*/
+		fill(s, ++n & 0xFFFFF);
+		if (use_snapshot) {
+			snapshot.write(s);
+		} else {
+			volatile uint32_t * dst = (volatile uint32_t *) &plain;
+			const uint32_t * src = (const uint32_t *) &s;
+			for (unsigned i = 0; i < sizeof(s) / sizeof(uint32_t); i++)
+				dst[i] = src[i];
+		}
+	}
+	return NULL;
+}
+
+static void * reader(void * arg) {
+	ReaderStats * stats = (ReaderStats *) arg;
+	uint32_t last = 0;
+	Sample s;
+
+	while (!stop) {
+		if (use_snapshot) {
+			uint32_t seq = snapshot.read(s);
+			if (seq != last)
+				stats->updates++;
+			last = seq;
+		} else {
+			volatile uint32_t * src = (volatile uint32_t *) &plain;
+			uint32_t * dst = (uint32_t *) &s;
+			for (unsigned i = 0; i < sizeof(s) / sizeof(uint32_t); i++)
+				dst[i] = src[i];
+		}
+		stats->reads++;
+		if (!consistent(s))
+			stats->torn++;
+	}
+	return NULL;
+}
+
+static unsigned long run(const char * label, bool with_snapshot, unsigned seconds, unsigned nreaders) {
+	pthread_t wt, rt[16];
+	ReaderStats stats[16] = { };
+	unsigned long reads = 0, torn = 0, updates = 0;
+	struct timespec ts = { (time_t) seconds, 0 };
+
+	use_snapshot = with_snapshot;
+	stop = 0;
+	pthread_create(&wt, NULL, writer, NULL);
+	for (unsigned i = 0; i < nreaders; i++)
+		pthread_create(&rt[i], NULL, reader, &stats[i]);
+	nanosleep(&ts, NULL);
+	stop = 1;
+	pthread_join(wt, NULL);
+	for (unsigned i = 0; i < nreaders; i++) {
+		pthread_join(rt[i], NULL);
+		reads += stats[i].reads;
+		torn += stats[i].torn;
+		updates += stats[i].updates;
+	}
+
+	printf("%-10s %12lu reads %12lu torn", label, reads, torn);
+	if (with_snapshot)
+		printf(" %12lu new values", updates);
+	printf("\n");
+	return torn;
+}
+
+int main(int argc, char * argv[]) {
+	unsigned seconds = (argc >= 2) ? atoi(argv[1]) : 2;
+	unsigned nreaders = (argc >= 3) ? atoi(argv[2]) : 3;
+	unsigned long torn;
+
+	if ((nreaders == 0) || (nreaders > 16)) {
+		fprintf(stderr, "readers must be 1..16\n");
+		return 2;
+	}
+
+	torn = run("snapshot", true, seconds, nreaders);
+	run("plain", false, seconds, nreaders);
+
+	return (torn == 0) ? 0 : 1;
+}
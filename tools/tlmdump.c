@@ -0,0 +1,220 @@
+/*
+ * Host decoder for the binary telemetry stream.
+ *
+ *   tlmdump [-t] <tty>     decodes frames from the module and prints them
+ *                          in the same format as the text streaming mode,
+ *                          prefixed by the module stamp in seconds; with -t
+ *                          the stamp is mapped to the host monotonic clock
+ *   tlmdump -b [samples]   loopback benchmark of the text and binary paths
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+#include "clocksync.h"
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_frame(const TelemetryDecoder *decp, ClockSync *csp) {
+  const uint8_t *p = decp->payload;
+  size_t n = decp->payload_len;
+
+  if (csp != NULL)
+    printf("%.6f ", csToHost(csp, decp->stamp));
+  else
+    printf("%.6f ", decp->stamp * 1e-6);
+
+  switch (decp->topic) {
+  case TLM_TOPIC_ENCODER2: {
+    tlm_encoder2_t enc;
+    if (n < sizeof(enc))
+      break;
+    memcpy(&enc, p, sizeof(enc));
+    printf("encoder2 %3u %f %f\n", decp->seq, enc.delta[0], enc.delta[1]);
+    return;
+  }
+  case TLM_TOPIC_IMU: {
+    tlm_imu_t imu;
+    if (n < sizeof(imu))
+      break;
+    memcpy(&imu, p, sizeof(imu));
+    printf("imu      %3u %f %f %f\n", decp->seq, imu.roll, imu.pitch, imu.yaw);
+    return;
+  }
+  case TLM_TOPIC_PROXIMITY: {
+    tlm_proximity_t prox;
+    unsigned i;
+    if (n < sizeof(prox))
+      break;
+    memcpy(&prox, p, sizeof(prox));
+    printf("proxy    %3u", decp->seq);
+    for (i = 0; i < 8; i++)
+      printf(" %5u", prox.value[i]);
+    printf("\n");
+    return;
+  }
+  case TLM_TOPIC_SNAPSHOT: {
+    tlm_snapshot_t snap;
+    unsigned i;
+    if (n < sizeof(snap))
+      break;
+    memcpy(&snap, p, sizeof(snap));
+    printf("snapshot %3u %f %f %f %f %f", decp->seq, snap.encoder2.delta[0],
+           snap.encoder2.delta[1], snap.imu.roll, snap.imu.pitch, snap.imu.yaw);
+    for (i = 0; i < 8; i++)
+      printf(" %5u", snap.proximity.value[i]);
+    for (i = 0; i < 3; i++) {
+      if (snap.valid & (1 << i))
+        printf(" %5u", snap.age[i]);
+      else
+        printf("     -");
+    }
+    printf("\n");
+    return;
+  }
+  case TLM_TOPIC_POSE: {
+    tlm_pose_t pose;
+    if (n < sizeof(pose))
+      break;
+    memcpy(&pose, p, sizeof(pose));
+    printf("pose     %3u %f %f %f %f %f %f\n", decp->seq, pose.x, pose.y,
+           pose.theta, pose.vx, pose.vy, pose.w);
+    return;
+  }
+  case TLM_TOPIC_SYNC: {
+    tlm_sync_t sync;
+    if (n < sizeof(sync))
+      break;
+    memcpy(&sync, p, sizeof(sync));
+    printf("sync     %3u frame %4u at %.6f\n", decp->seq, sync.frame,
+           sync.sof_us * 1e-6);
+    return;
+  }
+  }
+  printf("topic %u %3u (%zu bytes)\n", decp->topic, decp->seq, n);
+}
+
+static int dump(const char *path, int map_time) {
+  TelemetryDecoder dec;
+  ClockSync cs;
+  struct termios tio;
+  uint8_t buf[512];
+  ssize_t n, i;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_NOCTTY);
+  if (fd < 0) {
+    perror(path);
+    return 1;
+  }
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+
+  tlmDecoderInit(&dec);
+  csInit(&cs, 1.0);
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    double t = now();
+
+    for (i = 0; i < n; i++) {
+      if (tlmDecoderPut(&dec, buf[i])) {
+        csUpdate(&cs, dec.stamp, t);
+        if ((dec.topic == TLM_TOPIC_SYNC) &&
+            (dec.payload_len >= sizeof(tlm_sync_t))) {
+          tlm_sync_t sync;
+          memcpy(&sync, dec.payload, sizeof(sync));
+          csSync(&cs, sync.sof_us, sync.frame);
+        }
+        print_frame(&dec, map_time ? &cs : NULL);
+      }
+    }
+    fflush(stdout);
+  }
+
+  fprintf(stderr, "frames %u, crc errors %u, framing errors %u\n",
+          dec.frames, dec.crc_errors, dec.framing_errors);
+  if (map_time)
+    fprintf(stderr, "clock offset %.1f us, rate error %.2f ppm\n",
+            cs.a, cs.b * 1e6);
+  close(fd);
+  return 0;
+}
+
+/*
+ * Loopback benchmark: formats and parses the same IMU samples through the
+ * chprintf-style text path and through the binary framing, reporting
+ * samples/s and bytes on the wire for both.
+ */
+static int bench(unsigned samples) {
+  TelemetryDecoder dec;
+  char line[64];
+  uint8_t frame[TLM_MAX_FRAME_SIZE];
+  unsigned long text_bytes = 0, bin_bytes = 0, decoded = 0;
+  volatile float sink = 0;
+  double t0, t_text, t_bin;
+  unsigned i;
+  size_t j, len;
+
+  t0 = now();
+  for (i = 0; i < samples; i++) {
+    float roll, pitch, yaw;
+    int l = snprintf(line, sizeof(line), "%f %f %f\r\n",
+                     i * 0.001f, -i * 0.002f, i * 0.003f);
+    text_bytes += (unsigned long)l;
+    if (sscanf(line, "%f %f %f", &roll, &pitch, &yaw) == 3)
+      sink += roll + pitch + yaw;
+  }
+  t_text = now() - t0;
+
+  tlmDecoderInit(&dec);
+  t0 = now();
+  for (i = 0; i < samples; i++) {
+    tlm_imu_t imu = { i * 0.001f, -i * 0.002f, i * 0.003f };
+    len = tlmEncode(frame, TLM_TOPIC_IMU, (uint8_t)i, i * 1000, &imu,
+                    sizeof(imu));
+    bin_bytes += len;
+    for (j = 0; j < len; j++) {
+      if (tlmDecoderPut(&dec, frame[j])) {
+        memcpy(&imu, dec.payload, sizeof(imu));
+        sink += imu.roll + imu.pitch + imu.yaw;
+        decoded++;
+      }
+    }
+  }
+  t_bin = now() - t0;
+
+  printf("samples        %10u\n", samples);
+  printf("text   path    %10.0f samples/s  %5.1f bytes/sample\n",
+         samples / t_text, (double)text_bytes / samples);
+  printf("binary path    %10.0f samples/s  %5.1f bytes/sample\n",
+         samples / t_bin, (double)bin_bytes / samples);
+  printf("decoded        %10lu frames, %u crc errors\n",
+         decoded, dec.crc_errors);
+  return (decoded == samples) ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+
+  if ((argc >= 2) && (strcmp(argv[1], "-b") == 0))
+    return bench((argc >= 3) ? (unsigned)atoi(argv[2]) : 1000000);
+  if ((argc == 3) && (strcmp(argv[1], "-t") == 0))
+    return dump(argv[2], 1);
+  if (argc == 2)
+    return dump(argv[1], 0);
+
+  fprintf(stderr, "Usage: tlmdump [-t] <tty>\n"
+                  "       tlmdump -b [samples]\n");
+  return 2;
+}
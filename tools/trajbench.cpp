@@ -0,0 +1,132 @@
+/*
+ * Host test and benchmark of the AxisTrajectory limiter in trajectory.hpp.
+ *
+ *   trajbench [steps_per_second]
+ *
+ * Runs step and random target sequences at the given rate, default 50 Hz as
+ * the setpoint streamer, and checks that the acceleration limit is never
+ * exceeded, that the output never overshoots the target and that every
+ * target is reached. The jerk is reported, the final step onto the target
+ * may exceed it by the residual acceleration. Then times the update.
+ * Exits with a failure if a check did not pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trajectory.hpp"
+
+#define MAX_ACCEL       1.0f
+#define MAX_JERK        5.0f
+
+struct Stats {
+	float max_accel;
+	float max_jerk;
+	float max_overshoot;
+	float max_settle;
+	unsigned unsettled;
+};
+
+/*
+ * Drives the limiter to target and records the limits, returns the time it
+ * took to settle.
+ */
+static float run_to(AxisTrajectory & traj, float target, float dt, Stats & stats) {
+	float start = traj.get_velocity();
+	float accel = traj.get_accel();
+	float t = 0.0f;
+
+	for (unsigned i = 0; i < 100000; i++) {
+		float v = traj.update(target, dt);
+		float jerk = fabsf(traj.get_accel() - accel) / dt;
+		float overshoot = (target >= start) ? (v - target) : (target - v);
+
+		accel = traj.get_accel();
+		t += dt;
+		if (fabsf(accel) > stats.max_accel)
+			stats.max_accel = fabsf(accel);
+		if (!traj.settled(target) && (jerk > stats.max_jerk))
+			stats.max_jerk = jerk;
+		if (overshoot > stats.max_overshoot)
+			stats.max_overshoot = overshoot;
+		if (traj.settled(target)) {
+			if (t > stats.max_settle)
+				stats.max_settle = t;
+			return t;
+		}
+	}
+
+	stats.unsettled++;
+	return t;
+}
+
+/*
+ * Time to change the velocity by dv with continuous acceleration and jerk
+ * limits.
+ */
+static float min_time(float dv) {
+	float ta = MAX_ACCEL / MAX_JERK;
+
+	dv = fabsf(dv);
+	if (dv <= MAX_ACCEL * ta)
+		return 2.0f * sqrtf(dv / MAX_JERK);
+	return dv / MAX_ACCEL + ta;
+}
+
+int main(int argc, char * argv[]) {
+	float rate = (argc >= 2) ? (float) atof(argv[1]) : 50.0f;
+	float dt = 1.0f / rate;
+	static const float steps[] = { 1.0f, -1.0f, 0.0f, 0.05f, 0.0f, 2.0f, 1.9f, -0.3f, 0.0f };
+	AxisTrajectory traj(MAX_ACCEL, MAX_JERK);
+	Stats stats = { };
+	clock_t start;
+	double elapsed;
+	volatile float sink = 0.0f;
+	unsigned n = 10000000;
+	bool ok;
+
+	if (rate <= 0.0f) {
+		fprintf(stderr, "rate must be positive\n");
+		return 2;
+	}
+
+	printf("rate %g Hz, max accel %g, max jerk %g\n", rate, MAX_ACCEL, MAX_JERK);
+	printf("    from       to   settle    ideal\n");
+	for (unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		float from = traj.get_velocity();
+		float t = run_to(traj, steps[i], dt, stats);
+
+		printf("%8.3f %8.3f %8.3f %8.3f\n", from, steps[i], t, min_time(steps[i] - from));
+	}
+
+	/* Random targets, interrupted before settling half of the times.*/
+	srand(1);
+	traj.reset();
+	for (unsigned i = 0; i < 100000; i++) {
+		float target = (float) (rand() % 4001 - 2000) / 1000.0f;
+
+		if (rand() % 2) {
+			run_to(traj, target, dt, stats);
+		} else {
+			for (unsigned j = rand() % 20; j > 0; j--)
+				traj.update(target, dt);
+		}
+	}
+	run_to(traj, 0.0f, dt, stats);
+
+	printf("max accel %g, max jerk %g, max overshoot %g, unsettled %u\n", stats.max_accel, stats.max_jerk,
+			stats.max_overshoot, stats.unsettled);
+	ok = (stats.max_accel <= MAX_ACCEL * 1.0001f) && (stats.max_overshoot <= 0.0f) && (stats.unsettled == 0);
+
+	traj.reset();
+	start = clock();
+	for (unsigned i = 0; i < n; i++)
+		sink = traj.update((i & 0x400) ? 1.0f : -1.0f, dt);
+	elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("update %.1f ns\n", elapsed * 1e9 / n);
+	(void) sink;
+
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/*
+ * Host benchmark of the BinaryTransport framing in binframe.c against the
+ * hex text framing of DebugTransport.
+ *
+ *   transbench [messages]
+ *
+ * Both paths run over a loopback channel, a byte ring standing for the
+ * output and input queues, with the copies the transports make:
+ * - binary: header and trailer built on the stack, the payload written
+ *   from the message and read back into a pool message,
+ * - text: the message formatted as a hex line with a sum checksum into a
+ *   buffer and written, the line read into a buffer and parsed into the
+ *   message.
+ * Prints messages/s, CPU time per message and wire bytes per message for a
+ * few payload sizes, then checks that the binary decoder rejects corrupted
+ * frames and resynchronizes. Exits with a failure if a message does not
+ * round trip or a corrupted frame gets through.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binframe.h"
+
+#define RING_SIZE       4096
+#define TOPIC           "latency"
+
+/*
+ * Loopback channel, written and read in turns by the benchmark.
+ */
+struct Loopback {
+	uint8_t buf[RING_SIZE];
+	size_t head;
+	size_t tail;
+
+	Loopback() :
+			head(0), tail(0) {
+	}
+
+	size_t write(const uint8_t * p, size_t n) {
+		for (size_t i = 0; i < n; i++)
+			buf[(head + i) % RING_SIZE] = p[i];
+		head += n;
+		return n;
+	}
+
+	size_t read(uint8_t * p, size_t n) {
+		if (n > head - tail)
+			n = head - tail;
+		for (size_t i = 0; i < n; i++)
+			p[i] = buf[(tail + i) % RING_SIZE];
+		tail += n;
+		return n;
+	}
+
+	int get() {
+		return (tail == head) ? -1 : buf[tail++ % RING_SIZE];
+	}
+};
+
+static Loopback channel;
+
+/*===========================================================================*/
+/* Binary framing.                                                           */
+/*===========================================================================*/
+
+static BinFrameDecoder decoder;
+
+static bool binary_send(const void * msgp, size_t n) {
+	uint8_t hdr[BF_MAX_HEADER_SIZE];
+	uint8_t trailer[BF_CRC_SIZE];
+	size_t hdr_len = bfHeader(hdr, BF_TYPE_PUBLISH, TOPIC, n);
+
+	if (hdr_len == 0)
+		return false;
+	bfTrailer(trailer, bfCRC(hdr, hdr_len, msgp, n));
+	channel.write(hdr, hdr_len);
+	channel.write((const uint8_t *) msgp, n);
+	channel.write(trailer, BF_CRC_SIZE);
+	return true;
+}
+
+static bool binary_receive(void * msgp, size_t n) {
+	uint8_t trailer[BF_CRC_SIZE];
+	int c;
+
+	while ((c = channel.get()) >= 0) {
+		if (!bfDecoderPut(&decoder, (uint8_t) c))
+			continue;
+		if ((decoder.type != BF_TYPE_PUBLISH) || (strcmp(decoder.topic, TOPIC) != 0) || (decoder.payload_len != n)
+				|| (channel.read((uint8_t *) msgp, n) != n) || (channel.read(trailer, BF_CRC_SIZE) != BF_CRC_SIZE)) {
+			bfDecoderDrop(&decoder);
+			continue;
+		}
+		if (bfDecoderCheck(&decoder, msgp, trailer))
+			return true;
+	}
+	return false;
+}
+
+/*===========================================================================*/
+/* Hex text framing, as DebugTransport.                                      */
+/*===========================================================================*/
+
+static const char hex[] = "0123456789ABCDEF";
+
+static bool text_send(const void * msgp, size_t n) {
+	char line[8 + sizeof(TOPIC) + 2 * 256 + 6];
+	const uint8_t * p = (const uint8_t *) msgp;
+	uint8_t sum = 0;
+	size_t len = 0;
+
+	line[len++] = '@';
+	line[len++] = hex[n >> 4];
+	line[len++] = hex[n & 0xF];
+	memcpy(&line[len], TOPIC, sizeof(TOPIC) - 1);
+	len += sizeof(TOPIC) - 1;
+	line[len++] = ':';
+	for (size_t i = 0; i < n; i++) {
+		line[len++] = hex[p[i] >> 4];
+		line[len++] = hex[p[i] & 0xF];
+		sum += p[i];
+	}
+	line[len++] = hex[sum >> 4];
+	line[len++] = hex[sum & 0xF];
+	line[len++] = '\r';
+	line[len++] = '\n';
+	channel.write((const uint8_t *) line, len);
+	return true;
+}
+
+static int unhex(char c) {
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool text_receive(void * msgp, size_t n) {
+	char line[8 + sizeof(TOPIC) + 2 * 256 + 6];
+	uint8_t * p = (uint8_t *) msgp;
+	uint8_t sum = 0;
+	size_t len = 0;
+	char * colonp;
+	int c;
+
+	while ((c = channel.get()) >= 0) {
+		if (c == '\n')
+			break;
+		if (len < sizeof(line))
+			line[len++] = (char) c;
+	}
+	if ((c < 0) || (len < 4) || (line[0] != '@') || (line[len - 1] != '\r'))
+		return false;
+
+	colonp = (char *) memchr(line, ':', len);
+	if ((colonp == NULL) || ((size_t) (unhex(line[1]) << 4 | unhex(line[2])) != n)
+			|| (strncmp(&line[3], TOPIC, colonp - &line[3]) != 0) || ((size_t) (&line[len - 1] - colonp - 1) != 2 * n + 2))
+		return false;
+
+	for (size_t i = 0; i < n; i++) {
+		int hi = unhex(colonp[1 + 2 * i]), lo = unhex(colonp[2 + 2 * i]);
+
+		if ((hi < 0) || (lo < 0))
+			return false;
+		p[i] = (uint8_t) (hi << 4 | lo);
+		sum += p[i];
+	}
+	return (unhex(colonp[1 + 2 * n]) << 4 | unhex(colonp[2 + 2 * n])) == sum;
+}
+
+/*===========================================================================*/
+/* Benchmark.                                                                */
+/*===========================================================================*/
+
+struct Result {
+	double ns;
+	double bytes;
+	unsigned failures;
+};
+
+static Result run(bool (*send)(const void *, size_t), bool (*receive)(void *, size_t), size_t n, unsigned count) {
+	uint8_t out[256], in[256];
+	Result result = { 0.0, 0.0, 0 };
+	size_t start_bytes = channel.head;
+	clock_t start;
+
+	for (size_t i = 0; i < n; i++)
+		out[i] = (uint8_t) (i * 37 + 11);
+
+	start = clock();
+	for (unsigned k = 0; k < count; k++) {
+		/* The sequence number changes every message, as in a probe.*/
+		memcpy(out, &k, (n < sizeof(k)) ? n : sizeof(k));
+		if (!send(out, n) || !receive(in, n) || (memcmp(out, in, n) != 0))
+			result.failures++;
+	}
+	result.ns = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / count;
+	result.bytes = (double) (channel.head - start_bytes) / count;
+	return result;
+}
+
+/*
+ * Sends frames with one byte flipped and checks that none is accepted and
+ * that the next good frame still comes through.
+ */
+static unsigned check_corruption(void) {
+	uint8_t out[24], in[24];
+	unsigned failures = 0;
+
+	for (size_t i = 0; i < sizeof(out); i++)
+		out[i] = (uint8_t) i;
+
+	for (unsigned k = 0; k < 200; k++) {
+		size_t start = channel.head;
+		size_t frame_len;
+
+		binary_send(out, sizeof(out));
+		frame_len = channel.head - start;
+		channel.buf[(start + 1 + k % (frame_len - 1)) % RING_SIZE] ^= (uint8_t) (1 << (k % 8));
+		/* A good frame right after the corrupted one.*/
+		binary_send(out, sizeof(out));
+
+		memset(in, 0, sizeof(in));
+		if (!binary_receive(in, sizeof(in)) || (memcmp(out, in, sizeof(out)) != 0))
+			failures++;
+		/* Nothing else may be decoded.*/
+		if (binary_receive(in, sizeof(in)))
+			failures++;
+	}
+	return failures;
+}
+
+int main(int argc, char * argv[]) {
+	static const size_t sizes[] = { 8, 24, 64, 128 };
+	unsigned count = (argc >= 2) ? (unsigned) atoi(argv[1]) : 500000;
+	unsigned failures = 0;
+	unsigned corrupted;
+
+	if (count == 0) {
+		fprintf(stderr, "messages must be positive\n");
+		return 2;
+	}
+
+	bfDecoderInit(&decoder);
+	printf("payload  framing  msgs/s      ns/msg  wire B/msg\n");
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		Result binary = run(binary_send, binary_receive, sizes[i], count);
+		Result text = run(text_send, text_receive, sizes[i], count);
+
+		printf("%7u  binary  %10.0f  %6.1f  %10.1f\n", (unsigned) sizes[i], 1e9 / binary.ns, binary.ns, binary.bytes);
+		printf("%7u  text    %10.0f  %6.1f  %10.1f\n", (unsigned) sizes[i], 1e9 / text.ns, text.ns, text.bytes);
+		failures += binary.failures + text.failures;
+	}
+
+	corrupted = check_corruption();
+	printf("corruption: %u failures, %lu crc errors, %lu framing errors, %lu dropped\n", corrupted,
+			(unsigned long) decoder.crc_errors, (unsigned long) decoder.framing_errors, (unsigned long) decoder.dropped);
+	failures += corrupted;
+
+	printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+	return (failures == 0) ? 0 : 1;
+}
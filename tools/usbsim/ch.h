@@ -0,0 +1,90 @@
+/*
+ * Host stand-in for the ChibiOS kernel, just what the USB drivers under
+ * test use. Everything runs in one thread: locks do nothing and waiting on
+ * a semaphore lets the simulated bus run instead, see usbsim.h.
+ */
+
+#ifndef _CH_H_
+#define _CH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int32_t   msg_t;
+typedef uint32_t  systime_t;
+typedef int       bool_t;
+
+#ifndef FALSE
+#define FALSE           0
+#endif
+#ifndef TRUE
+#define TRUE            (!FALSE)
+#endif
+
+#define RDY_OK          0
+#define RDY_TIMEOUT     -1
+
+#define TIME_IMMEDIATE  ((systime_t)0)
+#define TIME_INFINITE   ((systime_t)-1)
+
+#define Q_OK            RDY_OK
+#define Q_TIMEOUT       RDY_TIMEOUT
+#define Q_RESET         -2
+#define Q_EMPTY         -3
+#define Q_FULL          -4
+
+#define chSysLock()
+#define chSysUnlock()
+#define chSysLockFromIsr()
+#define chSysUnlockFromIsr()
+
+/*
+ * Mutexes, only checked for balance: locked tells whether the mutex is held
+ * and unlocking releases the last one locked, as on the target.
+ */
+typedef struct {
+  bool_t        locked;
+} Mutex;
+
+#define chMtxInit(mp)   ((mp)->locked = FALSE)
+
+void chMtxLock(Mutex *mp);
+Mutex *chMtxUnlock(void);
+
+/*
+ * Binary semaphores.
+ */
+typedef struct {
+  bool_t        taken;
+} BinarySemaphore;
+
+#define chBSemInit(bsp, taken_) ((bsp)->taken = (taken_))
+#define chBSemSignalI(bsp)      ((bsp)->taken = FALSE)
+
+msg_t chBSemWaitTimeoutS(BinarySemaphore *bsp, systime_t time);
+
+/*
+ * Output queue, bytes written by chOQPutTimeout() trigger the notification
+ * like on the target.
+ */
+#define SIM_QUEUE_SIZE  256
+
+typedef struct GenericQueue GenericQueue;
+typedef void (*qnotify_t)(GenericQueue *qp);
+
+struct GenericQueue {
+  uint8_t       buf[SIM_QUEUE_SIZE];
+  size_t        rd;
+  size_t        count;
+  qnotify_t     q_notify;
+  void          *q_link;
+};
+
+typedef GenericQueue OutputQueue;
+
+#define chQGetLink(qp)  ((qp)->q_link)
+
+msg_t chOQGetI(OutputQueue *oqp);
+msg_t chOQPutTimeout(OutputQueue *oqp, uint8_t b, systime_t time);
+
+#endif /* _CH_H_ */
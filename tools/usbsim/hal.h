@@ -0,0 +1,114 @@
+/*
+ * Host stand-in for the ChibiOS USB and Serial over USB drivers.
+ *
+ * The simulated endpoint layer records every IN transfer started by the
+ * driver under test, with its bytes, and completes it only when the test
+ * says so with usbsimCompleteIn(), like the host controller polling the
+ * endpoint. OUT transfers are delivered with usbsimReceive() into the
+ * armed receive buffer. Waiting on a semaphore runs usbsim_wait_hook, the
+ * bus activity that would happen meanwhile on the target.
+ */
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include "ch.h"
+
+#define USB_MAX_ENDPOINTS       5
+
+#define SIM_LOG_SIZE            8192
+#define SIM_DATA_SIZE           (256 * 1024)
+
+typedef uint8_t usbep_t;
+
+typedef enum {
+  USB_UNINIT = 0,
+  USB_STOP = 1,
+  USB_READY = 2,
+  USB_SELECTED = 3,
+  USB_ACTIVE = 4
+} usbstate_t;
+
+typedef struct USBDriver USBDriver;
+
+typedef void (*usbepcallback_t)(USBDriver *usbp, usbep_t ep);
+
+/**
+ * @brief   Simulated endpoint.
+ */
+typedef struct {
+  const uint8_t         *txbuf;
+  size_t                txsize;
+  bool_t                txactive;       /* IN transfer not completed yet.    */
+  usbepcallback_t       in_cb;
+  uint8_t               *rxbuf;
+  size_t                rxmax;
+  size_t                rxsize;
+  bool_t                rxactive;       /* OUT endpoint armed.               */
+  usbepcallback_t       out_cb;
+} USBSimEndpoint;
+
+/**
+ * @brief   Simulated USB driver.
+ */
+struct USBDriver {
+  usbstate_t            state;
+  void                  *in_params[USB_MAX_ENDPOINTS];
+  void                  *out_params[USB_MAX_ENDPOINTS];
+  USBSimEndpoint        ep[USB_MAX_ENDPOINTS + 1];
+  /* IN transfers log, all endpoints.*/
+  usbep_t               log_ep[SIM_LOG_SIZE];
+  size_t                log_len[SIM_LOG_SIZE];
+  unsigned              transfers;
+  uint8_t               data[SIM_DATA_SIZE];
+  size_t                ndata;
+};
+
+#define usbGetDriverStateI(usbp)                ((usbp)->state)
+#define usbGetReceiveTransactionSizeI(usbp, n)  ((usbp)->ep[n].rxsize)
+
+void usbPrepareTransmit(USBDriver *usbp, usbep_t ep, const uint8_t *buf,
+                        size_t n);
+void usbStartTransmitI(USBDriver *usbp, usbep_t ep);
+void usbPrepareReceive(USBDriver *usbp, usbep_t ep, uint8_t *buf, size_t n);
+void usbStartReceiveI(USBDriver *usbp, usbep_t ep);
+
+/*
+ * Serial over USB, only the fields the transmit path uses.
+ */
+typedef enum {
+  SDU_UNINIT = 0,
+  SDU_STOP = 1,
+  SDU_READY = 2
+} sdustate_t;
+
+typedef struct {
+  USBDriver             *usbp;
+  usbep_t               bulk_in;
+  usbep_t               bulk_out;
+  usbep_t               int_in;
+} SerialUSBConfig;
+
+typedef struct {
+  sdustate_t            state;
+  OutputQueue           oqueue;
+  const SerialUSBConfig *config;
+  uint32_t              flags;
+} SerialUSBDriver;
+
+#define CHN_OUTPUT_EMPTY        8
+#define chnAddFlagsI(ip, mask)  ((ip)->flags |= (mask))
+
+void sduDataTransmitted(USBDriver *usbp, usbep_t ep);
+
+/*
+ * Simulation control.
+ */
+extern void (*usbsim_wait_hook)(void);
+
+void usbsimInit(USBDriver *usbp);
+bool_t usbsimCompleteIn(USBDriver *usbp, usbep_t ep);
+bool_t usbsimReceive(USBDriver *usbp, usbep_t ep, const uint8_t *bp,
+                     size_t n);
+
+#endif /* _HAL_H_ */
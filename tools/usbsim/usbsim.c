@@ -0,0 +1,150 @@
+/*
+ * Simulated kernel and USB endpoint layer, see hal.h.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+void (*usbsim_wait_hook)(void) = NULL;
+
+#define SIM_MAX_LOCKS   8
+
+static Mutex *locks[SIM_MAX_LOCKS];
+static unsigned nlocks = 0;
+
+void chMtxLock(Mutex *mp) {
+
+  if (nlocks < SIM_MAX_LOCKS)
+    locks[nlocks++] = mp;
+  mp->locked = TRUE;
+}
+
+Mutex *chMtxUnlock(void) {
+  Mutex *mp;
+
+  if (nlocks == 0)
+    return NULL;
+  mp = locks[--nlocks];
+  mp->locked = FALSE;
+  return mp;
+}
+
+msg_t chBSemWaitTimeoutS(BinarySemaphore *bsp, systime_t time) {
+
+  if (bsp->taken && (time != TIME_IMMEDIATE) && (usbsim_wait_hook != NULL))
+    usbsim_wait_hook();
+  if (bsp->taken)
+    return RDY_TIMEOUT;
+  bsp->taken = TRUE;
+  return RDY_OK;
+}
+
+msg_t chOQGetI(OutputQueue *oqp) {
+  uint8_t b;
+
+  if (oqp->count == 0)
+    return Q_EMPTY;
+  b = oqp->buf[oqp->rd];
+  oqp->rd = (oqp->rd + 1) % SIM_QUEUE_SIZE;
+  oqp->count--;
+  return b;
+}
+
+msg_t chOQPutTimeout(OutputQueue *oqp, uint8_t b, systime_t time) {
+
+  (void)time;
+  if (oqp->count == SIM_QUEUE_SIZE)
+    return Q_TIMEOUT;
+  oqp->buf[(oqp->rd + oqp->count) % SIM_QUEUE_SIZE] = b;
+  oqp->count++;
+  if (oqp->q_notify != NULL)
+    oqp->q_notify(oqp);
+  return Q_OK;
+}
+
+void usbPrepareTransmit(USBDriver *usbp, usbep_t ep, const uint8_t *buf,
+                        size_t n) {
+
+  usbp->ep[ep].txbuf = buf;
+  usbp->ep[ep].txsize = n;
+}
+
+/*
+ * Starting a transfer on a busy endpoint is a driver bug, it is logged
+ * with a size the tests never expect.
+ */
+void usbStartTransmitI(USBDriver *usbp, usbep_t ep) {
+  USBSimEndpoint *epp = &usbp->ep[ep];
+  size_t n = epp->txsize;
+
+  if (usbp->transfers < SIM_LOG_SIZE) {
+    usbp->log_ep[usbp->transfers] = ep;
+    usbp->log_len[usbp->transfers] = epp->txactive ? (size_t)-1 : n;
+    usbp->transfers++;
+  }
+  if ((n > 0) && (usbp->ndata + n <= SIM_DATA_SIZE)) {
+    memcpy(&usbp->data[usbp->ndata], epp->txbuf, n);
+    usbp->ndata += n;
+  }
+  epp->txactive = TRUE;
+}
+
+void usbPrepareReceive(USBDriver *usbp, usbep_t ep, uint8_t *buf, size_t n) {
+
+  usbp->ep[ep].rxbuf = buf;
+  usbp->ep[ep].rxmax = n;
+}
+
+void usbStartReceiveI(USBDriver *usbp, usbep_t ep) {
+
+  usbp->ep[ep].rxactive = TRUE;
+}
+
+void sduDataTransmitted(USBDriver *usbp, usbep_t ep) {
+
+  usbp->ep[ep].txactive = FALSE;
+}
+
+/**
+ * @brief   Resets the simulated driver, configured and without callbacks.
+ */
+void usbsimInit(USBDriver *usbp) {
+
+  memset(usbp, 0, sizeof(*usbp));
+  usbp->state = USB_ACTIVE;
+}
+
+/**
+ * @brief   Completes the IN transfer in progress, if any.
+ */
+bool_t usbsimCompleteIn(USBDriver *usbp, usbep_t ep) {
+  USBSimEndpoint *epp = &usbp->ep[ep];
+
+  if (!epp->txactive)
+    return FALSE;
+  epp->txactive = FALSE;
+  if (epp->in_cb != NULL)
+    epp->in_cb(usbp, ep);
+  return TRUE;
+}
+
+/**
+ * @brief   Delivers an OUT transfer, the host is NAKed if not armed.
+ */
+bool_t usbsimReceive(USBDriver *usbp, usbep_t ep, const uint8_t *bp,
+                     size_t n) {
+  USBSimEndpoint *epp = &usbp->ep[ep];
+
+  if (!epp->rxactive)
+    return FALSE;
+  if (n > epp->rxmax)
+    n = epp->rxmax;
+  memcpy(epp->rxbuf, bp, n);
+  epp->rxsize = n;
+  epp->rxactive = FALSE;
+  if (epp->out_cb != NULL)
+    epp->out_cb(usbp, ep);
+  return TRUE;
+}
@@ -0,0 +1,217 @@
+/*
+ * Host test of the packet aggregating transmitter in usbtx.c, built on the
+ * simulated USB driver in usbsim/.
+ *
+ *   usbtxtest
+ *
+ * Checks that writes are only sent as full packets between frames, that
+ * the start of frame flushes a partial packet, that a transfer ending on a
+ * full packet gets a zero length packet and one not ending on a full packet
+ * does not, that nothing is sent unless the device is configured, and the
+ * bytes per frame of steady streams. Every byte written must come out in
+ * order. Exits with a failure if a check did not pass.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "usbtx.h"
+
+#define EP_IN           1
+
+static USBDriver usb;
+static SerialUSBConfig sducfg = { &usb, EP_IN, 2, 3 };
+static SerialUSBDriver sdu;
+static USBTxDriver utx;
+
+static uint8_t written[SIM_DATA_SIZE];
+static size_t nwritten;
+
+static unsigned failures = 0;
+
+static void check(int ok, const char *what) {
+  printf("%-44s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+static void setup(void) {
+
+  usbsimInit(&usb);
+  usb.ep[EP_IN].in_cb = utxDataTransmitted;
+  memset(&sdu, 0, sizeof(sdu));
+  sdu.config = &sducfg;
+  sdu.state = SDU_READY;
+  sdu.oqueue.q_link = &sdu;
+  utxObjectInit(&utx);
+  utxStart(&utx, &sdu);
+  utxConfigureHookI(&utx);
+  nwritten = 0;
+}
+
+static void put(size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint8_t b = (uint8_t)(nwritten * 7 + 1);
+
+    if (chOQPutTimeout(&sdu.oqueue, b, TIME_INFINITE) != Q_OK)
+      break;
+    written[nwritten++] = b;
+  }
+}
+
+/* The host polls the endpoint until it is idle.*/
+static void drain(void) {
+
+  while (usbsimCompleteIn(&usb, EP_IN))
+    ;
+}
+
+static int transfers_are(const size_t *lens, unsigned n) {
+  unsigned i;
+
+  if (usb.transfers != n)
+    return 0;
+  for (i = 0; i < n; i++) {
+    if (usb.log_len[i] != lens[i])
+      return 0;
+  }
+  return 1;
+}
+
+static int all_bytes_out(void) {
+
+  return (usb.ndata == nwritten) && (memcmp(usb.data, written, nwritten) == 0);
+}
+
+int main(void) {
+
+  /* Full packets go as soon as they are complete, the rest waits.*/
+  {
+    static const size_t lens[] = { 64, 64, 64, 8 };
+
+    setup();
+    put(200);
+    drain();
+    check(transfers_are(lens, 3), "only full packets between frames");
+    utxSOFHookI(&usb);
+    drain();
+    check(transfers_are(lens, 4), "partial packet flushed at SOF");
+    check(all_bytes_out() && (sdu.flags & CHN_OUTPUT_EMPTY), "bytes in order");
+  }
+
+  /* Small writes within a frame become one packet.*/
+  {
+    static const size_t lens[] = { 50 };
+    unsigned i;
+
+    setup();
+    for (i = 0; i < 10; i++)
+      put(5);
+    check(usb.transfers == 0, "no packet before SOF");
+    utxSOFHookI(&usb);
+    drain();
+    check(transfers_are(lens, 1) && all_bytes_out(), "small writes aggregated");
+  }
+
+  /* A transfer ending on a full packet is terminated.*/
+  {
+    static const size_t lens[] = { 64, 64, 0 };
+
+    setup();
+    put(128);
+    drain();
+    utxSOFHookI(&usb);
+    drain();
+    utxSOFHookI(&usb);
+    drain();
+    check(transfers_are(lens, 3) && (utx.zlps == 1), "ZLP after 128 bytes");
+    check(all_bytes_out(), "ZLP carries no data");
+  }
+
+  {
+    static const size_t lens[] = { 64, 6 };
+
+    setup();
+    put(70);
+    drain();
+    utxSOFHookI(&usb);
+    drain();
+    utxSOFHookI(&usb);
+    drain();
+    check(transfers_are(lens, 2) && (utx.zlps == 0), "no ZLP after 70 bytes");
+  }
+
+  /* A new full packet before the SOF ends the transfer instead.*/
+  {
+    static const size_t lens[] = { 64, 64, 10 };
+
+    setup();
+    put(128);
+    drain();
+    put(10);
+    utxSOFHookI(&usb);
+    drain();
+    check(transfers_are(lens, 3) && (utx.zlps == 0), "no ZLP when data follows");
+  }
+
+  /* Nothing is sent before the configuration, a reset frees the endpoint.*/
+  {
+    setup();
+    usb.state = USB_SELECTED;
+    put(100);
+    utxSOFHookI(&usb);
+    check(usb.transfers == 0, "silent until configured");
+
+    usb.state = USB_ACTIVE;
+    utxSOFHookI(&usb);
+    check((usb.transfers == 1) && utx.busy, "sent once configured");
+    utxResetHookI(&utx);
+    check(!utx.busy && !utx.zlp, "reset frees the endpoint");
+  }
+
+  /* Steady streams, the host takes every packet within the frame.*/
+  {
+    static const size_t per_frame[] = { 36, 100, 150 };
+    unsigned k, f;
+
+    for (k = 0; k < 3; k++) {
+      char what[48];
+      double bytes_per_frame, bytes_per_packet;
+
+      setup();
+      for (f = 0; f < 1000; f++) {
+        size_t left = per_frame[k];
+
+        while (left > 0) {
+          size_t n = (left < 12) ? left : 12;
+
+          put(n);
+          left -= n;
+        }
+        utxSOFHookI(&usb);
+        drain();
+      }
+      utxSOFHookI(&usb);
+      drain();
+
+      bytes_per_frame = (double)utx.bytes / utx.frames;
+      bytes_per_packet = (double)utx.bytes / utx.packets;
+      printf("  %3u bytes/frame in 12 byte writes: %u packets, %.1f bytes "
+             "per packet, %.1f per frame\n", (unsigned)per_frame[k],
+             (unsigned)utx.packets, bytes_per_packet, bytes_per_frame);
+      snprintf(what, sizeof(what), "%u bytes per frame",
+               (unsigned)per_frame[k]);
+      check(all_bytes_out() &&
+            (utx.packets <= 1000 * ((per_frame[k] + 63) / 64) + 1) &&
+            (bytes_per_frame >= per_frame[k] - 1), what);
+    }
+  }
+
+  printf("%s\n", (failures == 0) ? "PASS" : "FAIL");
+  return (failures == 0) ? 0 : 1;
+}
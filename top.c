@@ -0,0 +1,129 @@
+/*
+ * Per-thread CPU utilization, see top.h.
+ *
+ * The kernel charges every system tick to the running thread (p_time) and
+ * the context switch hook in chconf.h counts the times a thread is switched
+ * in (p_switches). Both are sampled for all the registry threads at the
+ * start and at the end of an interval, utilization is the share of the
+ * interval ticks. Resolution is one tick.
+ */
+
+#include <stdlib.h>
+
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+
+#include "top.h"
+
+typedef struct {
+  Thread                *tp;
+  const char            *name;
+  tprio_t               prio;
+  systime_t             time;
+  uint32_t              switches;
+} TopSample;
+
+/*
+ * Samples the counters of all the registry threads, returns their number.
+ */
+static unsigned sample(TopSample *sp) {
+  Thread *tp;
+  unsigned n = 0;
+
+  tp = chRegFirstThread();
+  do {
+    if (n < TOP_MAX_THREADS) {
+      chSysLock();
+      sp[n].tp = tp;
+      sp[n].name = tp->p_name;
+      sp[n].prio = tp->p_prio;
+      sp[n].time = tp->p_time;
+      sp[n].switches = tp->p_switches;
+      chSysUnlock();
+      n++;
+    }
+    tp = chRegNextThread(tp);
+  } while (tp != NULL);
+  return n;
+}
+
+/*
+ * Prints a tenths value as a fixed point number.
+ */
+static void print_permille(BaseSequentialStream *chp, uint32_t pm) {
+
+  chprintf(chp, "%3lu.%lu", pm / 10, pm % 10);
+}
+
+static void top_once(BaseSequentialStream *chp, systime_t interval) {
+  static TopSample before[TOP_MAX_THREADS], after[TOP_MAX_THREADS];
+  unsigned nb, na, i, j;
+  systime_t start, ticks;
+  uint32_t idle = 0;
+
+  nb = sample(before);
+  start = chTimeNow();
+  chThdSleep(interval);
+  na = sample(after);
+  ticks = chTimeNow() - start;
+  if (ticks == 0)
+    return;
+
+  chprintf(chp, "name             prio   cpu%%  switch/s\r\n");
+  for (i = 0; i < na; i++) {
+    Thread *tp = after[i].tp;
+    uint32_t dt = after[i].time, ds = after[i].switches, pm;
+
+    /* Threads created during the interval count from zero.*/
+    for (j = 0; j < nb; j++) {
+      if (before[j].tp == tp) {
+        dt -= before[j].time;
+        ds -= before[j].switches;
+        break;
+      }
+    }
+    pm = (dt * 1000) / ticks;
+    if (after[i].prio == IDLEPRIO)
+      idle = pm;
+
+    chprintf(chp, "%-16s %4lu ", after[i].name ? after[i].name : "?",
+             (uint32_t)after[i].prio);
+    print_permille(chp, pm);
+    chprintf(chp, " %9lu\r\n", (ds * CH_FREQUENCY) / ticks);
+  }
+  chprintf(chp, "idle ");
+  print_permille(chp, idle);
+  chprintf(chp, "%%, load ");
+  print_permille(chp, 1000 - idle);
+  chprintf(chp, "%% over %lu ms\r\n", (uint32_t)((ticks * 1000) / CH_FREQUENCY));
+}
+
+/**
+ * @brief   Shell command printing per-thread CPU utilization.
+ * @details <tt>top [ms [n]]</tt> samples over @p ms milliseconds, default
+ *          1000, and repeats @p n times.
+ */
+void cmd_top(BaseSequentialStream *chp, int argc, char *argv[]) {
+  systime_t interval = MS2ST(1000);
+  int n = 1;
+
+  if (argc > 2) {
+    chprintf(chp, "Usage: top [ms [n]]\r\n");
+    return;
+  }
+  if (argc > 0)
+    interval = MS2ST(atoi(argv[0]));
+  if (argc > 1)
+    n = atoi(argv[1]);
+  if (interval == 0) {
+    chprintf(chp, "Usage: top [ms [n]]\r\n");
+    return;
+  }
+
+  while (n-- > 0) {
+    top_once(chp, interval);
+    if (n > 0)
+      chprintf(chp, "\r\n");
+  }
+}
@@ -0,0 +1,23 @@
+/*
+ * Per-thread CPU utilization shell command.
+ */
+
+#ifndef _TOP_H_
+#define _TOP_H_
+
+/**
+ * @brief   Maximum number of threads sampled.
+ */
+#if !defined(TOP_MAX_THREADS) || defined(__DOXYGEN__)
+#define TOP_MAX_THREADS         24
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void cmd_top(BaseSequentialStream *chp, int argc, char *argv[]);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _TOP_H_ */
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <math.h>
+
+/*
+ * Acceleration and jerk limited velocity trajectory along one axis.
+ *
+ * update() moves the output velocity towards the target by one step of dt
+ * seconds. The acceleration is limited to max_accel and changes by at most
+ * max_jerk * dt per step; it is also capped to sqrt(2 * max_jerk * error),
+ * the largest one the jerk limit can still bring back to zero by the time
+ * the target is reached, so the output does not overshoot. The last step
+ * lands exactly on the target.
+ *
+ * No ChibiOS dependency, the class is also used by the host tools.
+ */
+class AxisTrajectory {
+private:
+	float velocity;
+	float accel;
+
+public:
+	float max_accel;
+	float max_jerk;
+
+	AxisTrajectory(float max_accel, float max_jerk) :
+			velocity(0.0f), accel(0.0f), max_accel(max_accel), max_jerk(max_jerk) {
+	}
+
+	void reset(float value = 0.0f) {
+		velocity = value;
+		accel = 0.0f;
+	}
+
+	float update(float target, float dt) {
+		float error = target - velocity;
+		float max_da = max_jerk * dt;
+		float desired = sqrtf(2.0f * max_jerk * fabsf(error));
+		float da, step;
+
+		if (desired > max_accel)
+			desired = max_accel;
+		if (error < 0.0f)
+			desired = -desired;
+
+		da = desired - accel;
+		if (da > max_da)
+			da = max_da;
+		else if (da < -max_da)
+			da = -max_da;
+		accel += da;
+
+		step = accel * dt;
+		if (((error >= 0.0f) && (step >= error)) || ((error <= 0.0f) && (step <= error))) {
+			velocity = target;
+			accel = 0.0f;
+		} else {
+			velocity += step;
+		}
+
+		return velocity;
+	}
+
+	float get_velocity() const {
+		return velocity;
+	}
+
+	float get_accel() const {
+		return accel;
+	}
+
+	bool settled(float target) const {
+		return (velocity == target) && (accel == 0.0f);
+	}
+};
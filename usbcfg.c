@@ -17,24 +17,66 @@
 #include "ch.h"
 #include "hal.h"
 
+#include "usbcfg.h"
+#include "timesync.h"
+
 /*
  * Endpoints to be used for USBD1.
+ *
+ * The device is a composite of two functions, the SDU1 CDC ACM port for the
+ * shell and a data function for streamed data, so that each has its own
+ * queues and backpressure. The data function is either a second CDC ACM port
+ * (SDU2) or, with USB_DATA_VENDOR, a vendor specific bulk interface (BUD1).
+ * The STM32F3 packet memory is 512 bytes: the buffer table takes 64, EP0 128
+ * and each CDC function 144 (bulk IN, bulk OUT and interrupt IN), so there
+ * is no room for a third function.
+ *
+ * Applications that only serve the shell port start the driver with
+ * usbcfg_shell instead, the device then exposes the shell function alone and
+ * the host enumerates no dead data port.
  */
 #define USBD1_DATA_REQUEST_EP           1
 #define USBD1_DATA_AVAILABLE_EP         1
 #define USBD1_INTERRUPT_REQUEST_EP      2
+#define USBD1_DATA2_REQUEST_EP          3
+#define USBD1_DATA2_AVAILABLE_EP        3
+#define USBD1_INTERRUPT2_REQUEST_EP     4
+
+/*
+ * Interfaces.
+ */
+#define USB_SHELL_COMM_IF               0
+#define USB_SHELL_DATA_IF               1
+#define USB_DATA_COMM_IF                2
+#define USB_DATA_DATA_IF                3
+#define USB_DATA_VENDOR_IF              2
 
 /* Virtual serial port over USB.*/
 SerialUSBDriver SDU1;
 
+/* Packet aggregating transmitter for SDU1.*/
+USBTxDriver UTX1;
+
+#if USB_DATA_VENDOR
+/* Vendor bulk data interface.*/
+BulkUSBDriver BUD1;
+#else
+/* Virtual serial port over USB, data port.*/
+SerialUSBDriver SDU2;
+
+/* Packet aggregating transmitter for SDU2.*/
+USBTxDriver UTX2;
+#endif
+
 /*
  * USB Device Descriptor.
  */
 static const uint8_t vcom_device_descriptor_data[18] = {
-  USB_DESC_DEVICE       (0x0110,        /* bcdUSB (1.1).                    */
-                         0x02,          /* bDeviceClass (CDC).              */
-                         0x00,          /* bDeviceSubClass.                 */
-                         0x00,          /* bDeviceProtocol.                 */
+  USB_DESC_DEVICE       (0x0200,        /* bcdUSB (2.0).                    */
+                         0xEF,          /* bDeviceClass (Miscellaneous).    */
+                         0x02,          /* bDeviceSubClass (Common Class).  */
+                         0x01,          /* bDeviceProtocol (Interface
+                                           Association Descriptor).         */
                          0x40,          /* bMaxPacketSize.                  */
                          0x0483,        /* idVendor (ST).                   */
                          0x5740,        /* idProduct.                       */
@@ -53,81 +95,140 @@ static const USBDescriptor vcom_device_descriptor = {
   vcom_device_descriptor_data
 };
 
-/* Configuration Descriptor tree for a CDC.*/
-static const uint8_t vcom_configuration_descriptor_data[67] = {
-  /* Configuration Descriptor.*/
-  USB_DESC_CONFIGURATION(67,            /* wTotalLength.                    */
-                         0x02,          /* bNumInterfaces.                  */
-                         0x01,          /* bConfigurationValue.             */
-                         0,             /* iConfiguration.                  */
-                         0xC0,          /* bmAttributes (self powered).     */
-                         50),           /* bMaxPower (100mA).               */
-  /* Interface Descriptor.*/
-  USB_DESC_INTERFACE    (0x00,          /* bInterfaceNumber.                */
-                         0x00,          /* bAlternateSetting.               */
-                         0x01,          /* bNumEndpoints.                   */
+/*
+ * CDC ACM function, an Interface Association Descriptor followed by the
+ * communication and data interfaces.
+ */
+#define CDC_FUNCTION_DESC_SIZE          66
+#define CDC_FUNCTION_DESC(comm_if, data_if, int_ep, data_ep, iface_string)  \
+  /* Interface Association Descriptor.*/                                    \
+  USB_DESC_INTERFACE_ASSOCIATION(comm_if, /* bFirstInterface.          */  \
+                         0x02,          /* bInterfaceCount.             */  \
+                         0x02,          /* bFunctionClass (CDC).        */  \
+                         0x02,          /* bFunctionSubClass (ACM).     */  \
+                         0x01,          /* bFunctionProcotol (AT).      */  \
+                         iface_string), /* iInterface.                  */  \
+  /* Interface Descriptor.*/                                                \
+  USB_DESC_INTERFACE    (comm_if,       /* bInterfaceNumber.            */  \
+                         0x00,          /* bAlternateSetting.           */  \
+                         0x01,          /* bNumEndpoints.               */  \
                          0x02,          /* bInterfaceClass (Communications
                                            Interface Class, CDC section
-                                           4.2).                            */
+                                           4.2).                        */  \
                          0x02,          /* bInterfaceSubClass (Abstract
-                                         Control Model, CDC section 4.3).   */
+                                         Control Model, CDC section 4.3).*/ \
                          0x01,          /* bInterfaceProtocol (AT commands,
-                                           CDC section 4.4).                */
-                         0),            /* iInterface.                      */
-  /* Header Functional Descriptor (CDC section 5.2.3).*/
-  USB_DESC_BYTE         (5),            /* bLength.                         */
-  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).  */
+                                           CDC section 4.4).            */  \
+                         iface_string), /* iInterface.                  */  \
+  /* Header Functional Descriptor (CDC section 5.2.3).*/                    \
+  USB_DESC_BYTE         (5),            /* bLength.                     */  \
+  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).*/\
   USB_DESC_BYTE         (0x00),         /* bDescriptorSubtype (Header
-                                           Functional Descriptor.           */
-  USB_DESC_BCD          (0x0110),       /* bcdCDC.                          */
-  /* Call Management Functional Descriptor. */
-  USB_DESC_BYTE         (5),            /* bFunctionLength.                 */
-  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).  */
-  USB_DESC_BYTE         (0x01),         /* bDescriptorSubtype (Call Management
-                                           Functional Descriptor).          */
-  USB_DESC_BYTE         (0x00),         /* bmCapabilities (D0+D1).          */
-  USB_DESC_BYTE         (0x01),         /* bDataInterface.                  */
-  /* ACM Functional Descriptor.*/
-  USB_DESC_BYTE         (4),            /* bFunctionLength.                 */
-  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).  */
+                                           Functional Descriptor.       */  \
+  USB_DESC_BCD          (0x0110),       /* bcdCDC.                      */  \
+  /* Call Management Functional Descriptor. */                              \
+  USB_DESC_BYTE         (5),            /* bFunctionLength.             */  \
+  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).*/\
+  USB_DESC_BYTE         (0x01),         /* bDescriptorSubtype (Call
+                                           Management Functional
+                                           Descriptor).                 */  \
+  USB_DESC_BYTE         (0x00),         /* bmCapabilities (D0+D1).      */  \
+  USB_DESC_BYTE         (data_if),      /* bDataInterface.              */  \
+  /* ACM Functional Descriptor.*/                                           \
+  USB_DESC_BYTE         (4),            /* bFunctionLength.             */  \
+  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).*/\
   USB_DESC_BYTE         (0x02),         /* bDescriptorSubtype (Abstract
-                                           Control Management Descriptor).  */
-  USB_DESC_BYTE         (0x02),         /* bmCapabilities.                  */
-  /* Union Functional Descriptor.*/
-  USB_DESC_BYTE         (5),            /* bFunctionLength.                 */
-  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).  */
+                                           Control Management
+                                           Descriptor).                 */  \
+  USB_DESC_BYTE         (0x02),         /* bmCapabilities.              */  \
+  /* Union Functional Descriptor.*/                                         \
+  USB_DESC_BYTE         (5),            /* bFunctionLength.             */  \
+  USB_DESC_BYTE         (0x24),         /* bDescriptorType (CS_INTERFACE).*/\
   USB_DESC_BYTE         (0x06),         /* bDescriptorSubtype (Union
-                                           Functional Descriptor).          */
-  USB_DESC_BYTE         (0x00),         /* bMasterInterface (Communication
-                                           Class Interface).                */
-  USB_DESC_BYTE         (0x01),         /* bSlaveInterface0 (Data Class
-                                           Interface).                      */
-  /* Endpoint 2 Descriptor.*/
-  USB_DESC_ENDPOINT     (USBD1_INTERRUPT_REQUEST_EP|0x80,
-                         0x03,          /* bmAttributes (Interrupt).        */
-                         0x0008,        /* wMaxPacketSize.                  */
-                         0xFF),         /* bInterval.                       */
-  /* Interface Descriptor.*/
-  USB_DESC_INTERFACE    (0x01,          /* bInterfaceNumber.                */
-                         0x00,          /* bAlternateSetting.               */
-                         0x02,          /* bNumEndpoints.                   */
+                                           Functional Descriptor).      */  \
+  USB_DESC_BYTE         (comm_if),      /* bMasterInterface (Communication
+                                           Class Interface).            */  \
+  USB_DESC_BYTE         (data_if),      /* bSlaveInterface0 (Data Class
+                                           Interface).                  */  \
+  /* Interrupt IN Endpoint Descriptor.*/                                    \
+  USB_DESC_ENDPOINT     ((int_ep)|0x80,                                     \
+                         0x03,          /* bmAttributes (Interrupt).    */  \
+                         0x0008,        /* wMaxPacketSize.              */  \
+                         0xFF),         /* bInterval.                   */  \
+  /* Interface Descriptor.*/                                                \
+  USB_DESC_INTERFACE    (data_if,       /* bInterfaceNumber.            */  \
+                         0x00,          /* bAlternateSetting.           */  \
+                         0x02,          /* bNumEndpoints.               */  \
                          0x0A,          /* bInterfaceClass (Data Class
-                                           Interface, CDC section 4.5).     */
+                                           Interface, CDC section 4.5). */  \
                          0x00,          /* bInterfaceSubClass (CDC section
-                                           4.6).                            */
+                                           4.6).                        */  \
                          0x00,          /* bInterfaceProtocol (CDC section
-                                           4.7).                            */
-                         0x00),         /* iInterface.                      */
-  /* Endpoint 3 Descriptor.*/
-  USB_DESC_ENDPOINT     (USBD1_DATA_AVAILABLE_EP,       /* bEndpointAddress.*/
-                         0x02,          /* bmAttributes (Bulk).             */
-                         0x0040,        /* wMaxPacketSize.                  */
-                         0x00),         /* bInterval.                       */
-  /* Endpoint 1 Descriptor.*/
-  USB_DESC_ENDPOINT     (USBD1_DATA_REQUEST_EP|0x80,    /* bEndpointAddress.*/
-                         0x02,          /* bmAttributes (Bulk).             */
-                         0x0040,        /* wMaxPacketSize.                  */
-                         0x00)          /* bInterval.                       */
+                                           4.7).                        */  \
+                         0x00),         /* iInterface.                  */  \
+  /* Bulk OUT Endpoint Descriptor.*/                                        \
+  USB_DESC_ENDPOINT     (data_ep,       /* bEndpointAddress.            */  \
+                         0x02,          /* bmAttributes (Bulk).         */  \
+                         0x0040,        /* wMaxPacketSize.              */  \
+                         0x00),         /* bInterval.                   */  \
+  /* Bulk IN Endpoint Descriptor.*/                                         \
+  USB_DESC_ENDPOINT     ((data_ep)|0x80, /* bEndpointAddress.           */  \
+                         0x02,          /* bmAttributes (Bulk).         */  \
+                         0x0040,        /* wMaxPacketSize.              */  \
+                         0x00)          /* bInterval.                   */
+
+/*
+ * Vendor specific interface with a bulk endpoint pair.
+ */
+#define VENDOR_FUNCTION_DESC_SIZE       23
+#define VENDOR_FUNCTION_DESC(iface, data_ep, iface_string)                  \
+  /* Interface Descriptor.*/                                                \
+  USB_DESC_INTERFACE    (iface,         /* bInterfaceNumber.            */  \
+                         0x00,          /* bAlternateSetting.           */  \
+                         0x02,          /* bNumEndpoints.               */  \
+                         0xFF,          /* bInterfaceClass (Vendor).    */  \
+                         0x00,          /* bInterfaceSubClass.          */  \
+                         0x00,          /* bInterfaceProtocol.          */  \
+                         iface_string), /* iInterface.                  */  \
+  /* Bulk OUT Endpoint Descriptor.*/                                        \
+  USB_DESC_ENDPOINT     (data_ep,       /* bEndpointAddress.            */  \
+                         0x02,          /* bmAttributes (Bulk).         */  \
+                         0x0040,        /* wMaxPacketSize.              */  \
+                         0x00),         /* bInterval.                   */  \
+  /* Bulk IN Endpoint Descriptor.*/                                         \
+  USB_DESC_ENDPOINT     ((data_ep)|0x80, /* bEndpointAddress.           */  \
+                         0x02,          /* bmAttributes (Bulk).         */  \
+                         0x0040,        /* wMaxPacketSize.              */  \
+                         0x00)          /* bInterval.                   */
+
+#if USB_DATA_VENDOR
+#define VCOM_NUM_INTERFACES             3
+#define VCOM_CONFIGURATION_DESC_SIZE    (9 + CDC_FUNCTION_DESC_SIZE +       \
+                                         VENDOR_FUNCTION_DESC_SIZE)
+#else
+#define VCOM_NUM_INTERFACES             4
+#define VCOM_CONFIGURATION_DESC_SIZE    (9 + 2 * CDC_FUNCTION_DESC_SIZE)
+#endif
+
+/* Configuration Descriptor tree for the composite device.*/
+static const uint8_t vcom_configuration_descriptor_data[VCOM_CONFIGURATION_DESC_SIZE] = {
+  /* Configuration Descriptor.*/
+  USB_DESC_CONFIGURATION(VCOM_CONFIGURATION_DESC_SIZE, /* wTotalLength.     */
+                         VCOM_NUM_INTERFACES, /* bNumInterfaces.            */
+                         0x01,          /* bConfigurationValue.             */
+                         0,             /* iConfiguration.                  */
+                         0xC0,          /* bmAttributes (self powered).     */
+                         50),           /* bMaxPower (100mA).               */
+  /* Shell function.*/
+  CDC_FUNCTION_DESC(USB_SHELL_COMM_IF, USB_SHELL_DATA_IF,
+                    USBD1_INTERRUPT_REQUEST_EP, USBD1_DATA_REQUEST_EP, 4),
+  /* Data function.*/
+#if USB_DATA_VENDOR
+  VENDOR_FUNCTION_DESC(USB_DATA_VENDOR_IF, USBD1_DATA2_REQUEST_EP, 5)
+#else
+  CDC_FUNCTION_DESC(USB_DATA_COMM_IF, USB_DATA_DATA_IF,
+                    USBD1_INTERRUPT2_REQUEST_EP, USBD1_DATA2_REQUEST_EP, 5)
+#endif
 };
 
 /*
@@ -138,6 +239,30 @@ static const USBDescriptor vcom_configuration_descriptor = {
   vcom_configuration_descriptor_data
 };
 
+#define SHELL_CONFIGURATION_DESC_SIZE   (9 + CDC_FUNCTION_DESC_SIZE)
+
+/* Configuration Descriptor tree with the shell function only.*/
+static const uint8_t shell_configuration_descriptor_data[SHELL_CONFIGURATION_DESC_SIZE] = {
+  /* Configuration Descriptor.*/
+  USB_DESC_CONFIGURATION(SHELL_CONFIGURATION_DESC_SIZE, /* wTotalLength.    */
+                         2,             /* bNumInterfaces.                  */
+                         0x01,          /* bConfigurationValue.             */
+                         0,             /* iConfiguration.                  */
+                         0xC0,          /* bmAttributes (self powered).     */
+                         50),           /* bMaxPower (100mA).               */
+  /* Shell function.*/
+  CDC_FUNCTION_DESC(USB_SHELL_COMM_IF, USB_SHELL_DATA_IF,
+                    USBD1_INTERRUPT_REQUEST_EP, USBD1_DATA_REQUEST_EP, 4)
+};
+
+/*
+ * Shell only Configuration Descriptor wrapper.
+ */
+static const USBDescriptor shell_configuration_descriptor = {
+  sizeof shell_configuration_descriptor_data,
+  shell_configuration_descriptor_data
+};
+
 /*
  * U.S. English language identifier.
  */
@@ -181,6 +306,24 @@ static const uint8_t vcom_string3[] = {
   '0' + CH_KERNEL_PATCH, 0
 };
 
+/*
+ * Shell function string.
+ */
+static const uint8_t vcom_string4[] = {
+  USB_DESC_BYTE(12),                    /* bLength.                         */
+  USB_DESC_BYTE(USB_DESCRIPTOR_STRING), /* bDescriptorType.                 */
+  'S', 0, 'h', 0, 'e', 0, 'l', 0, 'l', 0
+};
+
+/*
+ * Data function string.
+ */
+static const uint8_t vcom_string5[] = {
+  USB_DESC_BYTE(10),                    /* bLength.                         */
+  USB_DESC_BYTE(USB_DESCRIPTOR_STRING), /* bDescriptorType.                 */
+  'D', 0, 'a', 0, 't', 0, 'a', 0
+};
+
 /*
  * Strings wrappers array.
  */
@@ -188,9 +331,16 @@ static const USBDescriptor vcom_strings[] = {
   {sizeof vcom_string0, vcom_string0},
   {sizeof vcom_string1, vcom_string1},
   {sizeof vcom_string2, vcom_string2},
-  {sizeof vcom_string3, vcom_string3}
+  {sizeof vcom_string3, vcom_string3},
+  {sizeof vcom_string4, vcom_string4},
+  {sizeof vcom_string5, vcom_string5}
 };
 
+/*
+ * Whether the driver was started with the data function.
+ */
+#define has_data_function(usbp)         ((usbp)->config != &usbcfg_shell)
+
 /*
  * Handles the GET_DESCRIPTOR callback. All required descriptors must be
  * handled here.
@@ -200,20 +350,47 @@ static const USBDescriptor *get_descriptor(USBDriver *usbp,
                                            uint8_t dindex,
                                            uint16_t lang) {
 
-  (void)usbp;
   (void)lang;
   switch (dtype) {
   case USB_DESCRIPTOR_DEVICE:
     return &vcom_device_descriptor;
   case USB_DESCRIPTOR_CONFIGURATION:
+    if (!has_data_function(usbp))
+      return &shell_configuration_descriptor;
     return &vcom_configuration_descriptor;
   case USB_DESCRIPTOR_STRING:
-    if (dindex < 4)
+    if (dindex < sizeof vcom_strings / sizeof vcom_strings[0])
       return &vcom_strings[dindex];
   }
   return NULL;
 }
 
+/*
+ * Line coding of each CDC port, 38400 8N1 until the host sets it.
+ */
+static cdc_linecoding_t linecoding[2] = {
+  {{0x00, 0x96, 0x00, 0x00}, LC_STOP_1, LC_PARITY_NONE, 8},
+  {{0x00, 0x96, 0x00, 0x00}, LC_STOP_1, LC_PARITY_NONE, 8}
+};
+
+/*
+ * Handles the class requests. sduRequestsHook() keeps a single line coding
+ * for all the ports, so the line coding requests are answered here with the
+ * one of the port owning the addressed communication interface.
+ */
+static bool_t requests_hook(USBDriver *usbp) {
+  cdc_linecoding_t *lcp;
+
+  if (((usbp->setup[0] & USB_RTYPE_TYPE_MASK) != USB_RTYPE_TYPE_CLASS) ||
+      ((usbp->setup[1] != CDC_GET_LINE_CODING) &&
+       (usbp->setup[1] != CDC_SET_LINE_CODING)))
+    return sduRequestsHook(usbp);
+
+  lcp = (usbp->setup[4] == USB_DATA_COMM_IF) ? &linecoding[1] : &linecoding[0];
+  usbSetupTransfer(usbp, (uint8_t *)lcp, sizeof(*lcp), NULL);
+  return TRUE;
+}
+
 /**
  * @brief   IN EP1 state.
  */
@@ -230,7 +407,7 @@ static USBOutEndpointState ep1outstate;
 static const USBEndpointConfig ep1config = {
   USB_EP_MODE_TYPE_BULK,
   NULL,
-  sduDataTransmitted,
+  utxDataTransmitted,
   sduDataReceived,
   0x0040,
   0x0040,
@@ -261,6 +438,60 @@ static const USBEndpointConfig ep2config = {
   NULL
 };
 
+/**
+ * @brief   IN EP3 state.
+ */
+static USBInEndpointState ep3instate;
+
+/**
+ * @brief   OUT EP3 state.
+ */
+static USBOutEndpointState ep3outstate;
+
+/**
+ * @brief   EP3 initialization structure (both IN and OUT).
+ */
+static const USBEndpointConfig ep3config = {
+  USB_EP_MODE_TYPE_BULK,
+  NULL,
+#if USB_DATA_VENDOR
+  budDataTransmitted,
+  budDataReceived,
+#else
+  utxDataTransmitted,
+  sduDataReceived,
+#endif
+  0x0040,
+  0x0040,
+  &ep3instate,
+  &ep3outstate,
+  1,
+  NULL
+};
+
+#if !USB_DATA_VENDOR
+/**
+ * @brief   IN EP4 state.
+ */
+static USBInEndpointState ep4instate;
+
+/**
+ * @brief   EP4 initialization structure (IN only).
+ */
+static const USBEndpointConfig ep4config = {
+  USB_EP_MODE_TYPE_INTR,
+  NULL,
+  sduInterruptTransmitted,
+  NULL,
+  0x0010,
+  0x0000,
+  &ep4instate,
+  NULL,
+  1,
+  NULL
+};
+#endif
+
 /*
  * Handles the USB driver global events.
  */
@@ -268,6 +499,13 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
 
   switch (event) {
   case USB_EVENT_RESET:
+    chSysLockFromIsr();
+    utxResetHookI(&UTX1);
+#if !USB_DATA_VENDOR
+    if (has_data_function(usbp))
+      utxResetHookI(&UTX2);
+#endif
+    chSysUnlockFromIsr();
     return;
   case USB_EVENT_ADDRESS:
     return;
@@ -279,9 +517,29 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
        must be used.*/
     usbInitEndpointI(usbp, USBD1_DATA_REQUEST_EP, &ep1config);
     usbInitEndpointI(usbp, USBD1_INTERRUPT_REQUEST_EP, &ep2config);
-
-    /* Resetting the state of the CDC subsystem.*/
     sduConfigureHookI(&SDU1);
+    utxConfigureHookI(&UTX1);
+    if (!has_data_function(usbp)) {
+      chSysUnlockFromIsr();
+      return;
+    }
+
+    usbInitEndpointI(usbp, USBD1_DATA2_REQUEST_EP, &ep3config);
+#if !USB_DATA_VENDOR
+    usbInitEndpointI(usbp, USBD1_INTERRUPT2_REQUEST_EP, &ep4config);
+#endif
+
+    /* Resetting the state of the data function, only serviced by
+       applications that start its driver.*/
+#if USB_DATA_VENDOR
+    if (BUD1.state == BUD_READY)
+      budConfigureHookI(&BUD1);
+#else
+    if (SDU2.state == SDU_READY) {
+      sduConfigureHookI(&SDU2);
+      utxConfigureHookI(&UTX2);
+    }
+#endif
 
     chSysUnlockFromIsr();
     return;
@@ -295,18 +553,42 @@ static void usb_event(USBDriver *usbp, usbevent_t event) {
   return;
 }
 
+/*
+ * Handles the start of frame, invoked from ISR every millisecond.
+ */
+static void sof_handler(USBDriver *usbp) {
+
+  chSysLockFromIsr();
+  tsSOFHookI(usbp);
+  utxSOFHookI(usbp);
+#if USB_DATA_VENDOR
+  budSOFHookI(&BUD1);
+#endif
+  chSysUnlockFromIsr();
+}
+
 /*
  * USB driver configuration.
  */
 const USBConfig usbcfg = {
   usb_event,
   get_descriptor,
-  sduRequestsHook,
-  NULL
+  requests_hook,
+  sof_handler
 };
 
 /*
- * Serial over USB driver configuration.
+ * USB driver configuration, shell function only.
+ */
+const USBConfig usbcfg_shell = {
+  usb_event,
+  get_descriptor,
+  requests_hook,
+  sof_handler
+};
+
+/*
+ * Serial over USB driver configuration, shell port.
  */
 const SerialUSBConfig serusbcfg = {
   &USBD1,
@@ -314,3 +596,24 @@ const SerialUSBConfig serusbcfg = {
   USBD1_DATA_AVAILABLE_EP,
   USBD1_INTERRUPT_REQUEST_EP
 };
+
+#if USB_DATA_VENDOR
+/*
+ * Vendor bulk driver configuration.
+ */
+const BulkUSBConfig bulkusbcfg = {
+  &USBD1,
+  USBD1_DATA2_REQUEST_EP,
+  USBD1_DATA2_AVAILABLE_EP
+};
+#else
+/*
+ * Serial over USB driver configuration, data port.
+ */
+const SerialUSBConfig serusbcfg2 = {
+  &USBD1,
+  USBD1_DATA2_REQUEST_EP,
+  USBD1_DATA2_AVAILABLE_EP,
+  USBD1_INTERRUPT2_REQUEST_EP
+};
+#endif
@@ -17,9 +17,32 @@
 #ifndef _USBCFG_H_
 #define _USBCFG_H_
 
+#include "usbtx.h"
+#include "bulkusb.h"
+
+/*
+ * Data function type, a second CDC ACM port (SDU2) when FALSE or a vendor
+ * specific bulk interface (BUD1) for libusb host tools when TRUE. There is
+ * not enough packet memory for both.
+ */
+#if !defined(USB_DATA_VENDOR)
+#define USB_DATA_VENDOR                 FALSE
+#endif
+
 extern SerialUSBDriver SDU1;
+extern USBTxDriver UTX1;
 extern const USBConfig usbcfg;
-extern SerialUSBConfig serusbcfg;
+extern const USBConfig usbcfg_shell;
+extern const SerialUSBConfig serusbcfg;
+
+#if USB_DATA_VENDOR
+extern BulkUSBDriver BUD1;
+extern const BulkUSBConfig bulkusbcfg;
+#else
+extern SerialUSBDriver SDU2;
+extern USBTxDriver UTX2;
+extern const SerialUSBConfig serusbcfg2;
+#endif
 
 #endif  /* _USBCFG_H_ */
 
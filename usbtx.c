@@ -0,0 +1,178 @@
+/*
+ * Packet aggregating transmit path, see usbtx.h.
+ */
+
+#include <string.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "usbtx.h"
+
+/*
+ * Transmitters indexed by IN endpoint.
+ */
+static USBTxDriver *drivers[USB_MAX_ENDPOINTS + 1];
+
+/*
+ * Moves bytes from the output queue into the buffer being filled.
+ */
+static void fill_from_queue(USBTxDriver *utxp) {
+  uint8_t *bufp = utxp->buf[utxp->fill];
+  size_t n = utxp->len[utxp->fill];
+  msg_t b;
+
+  while ((n < USBTX_PACKET_SIZE) &&
+         ((b = chOQGetI(&utxp->sdup->oqueue)) != Q_EMPTY))
+    bufp[n++] = (uint8_t)b;
+  utxp->len[utxp->fill] = n;
+}
+
+/*
+ * Puts the buffer being filled on the wire and swaps buffers, the endpoint
+ * must be idle.
+ */
+static void start_packet(USBTxDriver *utxp) {
+  USBDriver *usbp = utxp->sdup->config->usbp;
+  size_t n = utxp->len[utxp->fill];
+
+  usbPrepareTransmit(usbp, utxp->ep, utxp->buf[utxp->fill], n);
+  usbStartTransmitI(usbp, utxp->ep);
+  utxp->busy = TRUE;
+  utxp->zlp = (n == USBTX_PACKET_SIZE);
+  utxp->active = TRUE;
+  utxp->packets++;
+  utxp->bytes += n;
+
+  /* The next buffer starts filling while this one is being sent.*/
+  utxp->fill ^= 1;
+  utxp->len[utxp->fill] = 0;
+  fill_from_queue(utxp);
+}
+
+/*
+ * Output queue notification, replaces the SerialUSB one. Only full packets
+ * are started here, partial ones wait for the start of frame.
+ */
+static void onotify(GenericQueue *qp) {
+  SerialUSBDriver *sdup = chQGetLink(qp);
+  USBTxDriver *utxp = drivers[sdup->config->bulk_in];
+
+  if ((usbGetDriverStateI(sdup->config->usbp) != USB_ACTIVE) ||
+      (sdup->state != SDU_READY))
+    return;
+
+  if (!utxp->busy) {
+    fill_from_queue(utxp);
+    if (utxp->len[utxp->fill] == USBTX_PACKET_SIZE)
+      start_packet(utxp);
+  }
+}
+
+/**
+ * @brief   Initializes a transmitter object.
+ */
+void utxObjectInit(USBTxDriver *utxp) {
+
+  memset(utxp, 0, sizeof(*utxp));
+}
+
+/**
+ * @brief   Attaches a transmitter to a Serial over USB driver.
+ * @pre     The SerialUSB driver must have been started.
+ */
+void utxStart(USBTxDriver *utxp, SerialUSBDriver *sdup) {
+
+  chSysLock();
+  utxp->sdup = sdup;
+  utxp->ep = sdup->config->bulk_in;
+  drivers[utxp->ep] = utxp;
+  sdup->oqueue.q_notify = onotify;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Resets the transmitter state, to be called on USB configuration.
+ */
+void utxConfigureHookI(USBTxDriver *utxp) {
+
+  utxp->len[0] = utxp->len[1] = 0;
+  utxp->fill = 0;
+  utxp->busy = FALSE;
+  utxp->zlp = FALSE;
+  utxp->active = FALSE;
+}
+
+/**
+ * @brief   Aborts the transmission state, to be called on USB reset.
+ * @details A packet cut off by the reset never completes, the endpoint must
+ *          not be left busy. Queued data waits for the next configuration.
+ */
+void utxResetHookI(USBTxDriver *utxp) {
+
+  utxp->busy = FALSE;
+  utxp->zlp = FALSE;
+  utxp->active = FALSE;
+}
+
+/**
+ * @brief   Bulk IN completion callback, replaces @p sduDataTransmitted.
+ * @details Endpoints without an attached transmitter fall back to the
+ *          SerialUSB behavior.
+ */
+void utxDataTransmitted(USBDriver *usbp, usbep_t ep) {
+  USBTxDriver *utxp = drivers[ep];
+
+  if (utxp == NULL) {
+    sduDataTransmitted(usbp, ep);
+    return;
+  }
+
+  chSysLockFromIsr();
+  utxp->busy = FALSE;
+  fill_from_queue(utxp);
+  if (utxp->len[utxp->fill] == USBTX_PACKET_SIZE)
+    start_packet(utxp);
+  else if (utxp->len[utxp->fill] == 0)
+    chnAddFlagsI(utxp->sdup, CHN_OUTPUT_EMPTY);
+  chSysUnlockFromIsr();
+}
+
+/**
+ * @brief   Start of frame hook, flushes partial packets.
+ * @details A full sized packet followed by an idle frame is terminated with
+ *          a zero length packet so that the host transfer completes.
+ */
+void utxSOFHookI(USBDriver *usbp) {
+  unsigned ep;
+
+  /* Start of frames keep coming after a reset, the endpoints are only
+     initialized once configured.*/
+  if (usbGetDriverStateI(usbp) != USB_ACTIVE)
+    return;
+
+  for (ep = 1; ep <= USB_MAX_ENDPOINTS; ep++) {
+    USBTxDriver *utxp = drivers[ep];
+
+    if ((utxp == NULL) || (utxp->sdup->config->usbp != usbp))
+      continue;
+    if (utxp->active) {
+      utxp->active = FALSE;
+      utxp->frames++;
+    }
+    if (utxp->busy || (utxp->sdup->state != SDU_READY))
+      continue;
+
+    fill_from_queue(utxp);
+    if (utxp->len[utxp->fill] > 0) {
+      start_packet(utxp);
+    }
+    else if (utxp->zlp) {
+      usbPrepareTransmit(usbp, utxp->ep, NULL, 0);
+      usbStartTransmitI(usbp, utxp->ep);
+      utxp->busy = TRUE;
+      utxp->zlp = FALSE;
+      utxp->zlps++;
+    }
+  }
+}
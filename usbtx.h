@@ -0,0 +1,53 @@
+/*
+ * Packet aggregating transmit path for a Serial over USB bulk IN endpoint.
+ *
+ * The stock SerialUSB driver starts a USB transfer as soon as the first byte
+ * lands in an idle output queue, so a stream of small writes becomes a stream
+ * of tiny packets. This layer takes over the output queue notification and
+ * the IN completion callback: bytes are packed into two ping-pong packet
+ * buffers, a buffer is sent as soon as it is full and the partially filled
+ * one is flushed at the next start of frame. A zero length packet terminates
+ * the host transfer when the last packet sent was full sized.
+ */
+
+#ifndef _USBTX_H_
+#define _USBTX_H_
+
+/**
+ * @brief   Bulk IN packet size.
+ */
+#define USBTX_PACKET_SIZE       64
+
+/**
+ * @brief   Packet aggregating transmitter.
+ */
+typedef struct {
+  SerialUSBDriver       *sdup;
+  usbep_t               ep;
+  uint8_t               buf[2][USBTX_PACKET_SIZE];
+  size_t                len[2];
+  unsigned              fill;           /* Buffer being filled.              */
+  bool_t                busy;           /* The other buffer is on the wire.  */
+  bool_t                zlp;            /* Last packet sent was full sized.  */
+  bool_t                active;         /* A packet started this frame.      */
+  /* Statistics.*/
+  uint32_t              packets;
+  uint32_t              zlps;
+  uint32_t              bytes;
+  uint32_t              frames;         /* Frames with at least one packet.  */
+} USBTxDriver;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void utxObjectInit(USBTxDriver *utxp);
+  void utxStart(USBTxDriver *utxp, SerialUSBDriver *sdup);
+  void utxConfigureHookI(USBTxDriver *utxp);
+  void utxResetHookI(USBTxDriver *utxp);
+  void utxDataTransmitted(USBDriver *usbp, usbep_t ep);
+  void utxSOFHookI(USBDriver *usbp);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _USBTX_H_ */